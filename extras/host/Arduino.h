@@ -0,0 +1,249 @@
+/*
+ * Arduino.h
+ *
+ * Minimal host (Linux) replacement for the Arduino core, just enough to compile and run SBMInfo.cpp
+ * against the simulated Smart Battery in SBMSimulator.cpp.
+ *
+ * Time is simulated. delay() and delayMicroseconds() only advance the fake clock, they never sleep.
+ * The serial port is modeled with the 64 byte TX buffer of HardwareSerial and the timing of the selected baudrate,
+ * so Serial.flush() costs the same simulated time as on the real board.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define F_CPU 16000000L
+#define _BV(bit) (1 << (bit))
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define SDA 18
+#define SCL 19
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+/*
+ * Flash strings are plain strings on the host
+ */
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+/*
+ * Power reduction and digital input disable registers written by setup()
+ */
+extern uint8_t PRR;
+extern uint8_t DIDR0;
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+#define ADC0D 0
+#define ADC1D 1
+#define ADC2D 2
+#define ADC3D 3
+
+void cli(void);
+void sei(void);
+
+/*
+ * Status register, only the global interrupt flag is modeled
+ */
+#define SREG_I 7
+class HostStatusRegister {
+public:
+    operator uint8_t() const;
+    HostStatusRegister & operator =(uint8_t aValue);
+};
+extern HostStatusRegister SREG;
+
+/*
+ * TWI registers of the ATmega. Writing TWCR starts the action in the TWI emulation of SBMSimulator.cpp,
+ * which sets TWINT and calls the interrupt service routine when the simulated bus transfer has finished.
+ */
+class HostTWIControlRegister {
+public:
+    operator uint8_t() const {
+        return Value;
+    }
+    HostTWIControlRegister & operator =(uint8_t aValue);
+    HostTWIControlRegister & operator |=(uint8_t aValue) {
+        return *this = Value | aValue;
+    }
+    HostTWIControlRegister & operator &=(uint8_t aValue) {
+        return *this = Value & aValue;
+    }
+    uint8_t Value = 0;
+};
+extern HostTWIControlRegister TWCR;
+extern volatile uint8_t TWDR;
+extern volatile uint8_t TWSR;
+extern volatile uint8_t TWBR;
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+#define TWPS0 0
+#define TWPS1 1
+
+#define ISR(vector) void vector(void)
+#define TWI_vect hostTWIInterrupt
+// weak, since it is only defined if the sketch uses the hardware TWI
+void hostTWIInterrupt(void) __attribute__((weak));
+
+void pinMode(uint8_t aPin, uint8_t aMode);
+void digitalWrite(uint8_t aPin, uint8_t aValue);
+int digitalRead(uint8_t aPin);
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long aMillis);
+void delayMicroseconds(unsigned int aMicros);
+void yield(void);
+
+/*
+ * Host only functions for the simulated time base
+ */
+void hostAdvanceMicros(uint32_t aMicros);
+uint64_t hostGetMicros(void);
+bool hostInterruptsEnabled(void);
+void hostRequestTWIInterrupt(void);
+// implemented by the TWI emulation in SBMSimulator.cpp
+uint64_t hostTWINextEventMicros(void);
+void hostTWIProcessEvent(void);
+// implemented by the pin level I2C emulation in SBMSimulator.cpp, -1 if the pin is not connected to the simulated bus
+int hostReadI2CPin(uint8_t aPin);
+void hostDriveI2CPin(uint8_t aPin, bool aPullLow);
+
+class String {
+public:
+    String(const char * aString = "") :
+            mString(aString) {
+    }
+    String & operator +=(const char * aString) {
+        mString += aString;
+        return *this;
+    }
+    String & operator +=(int aValue) {
+        mString += std::to_string(aValue);
+        return *this;
+    }
+    const char * c_str() const {
+        return mString.c_str();
+    }
+    unsigned int length() const {
+        return mString.length();
+    }
+private:
+    std::string mString;
+};
+
+class Print {
+public:
+    virtual ~Print() {
+    }
+    virtual size_t write(uint8_t aByte) = 0;
+    virtual size_t write(const uint8_t * aBuffer, size_t aSize);
+    size_t write(const char * aString) {
+        return write((const uint8_t *) aString, strlen(aString));
+    }
+    size_t write(const char * aBuffer, size_t aSize) {
+        return write((const uint8_t *) aBuffer, aSize);
+    }
+
+    size_t print(const __FlashStringHelper * aString);
+    size_t print(const String & aString);
+    size_t print(const char aString[]);
+    size_t print(char aChar);
+    size_t print(unsigned char aValue, int aBase = DEC);
+    size_t print(int aValue, int aBase = DEC);
+    size_t print(unsigned int aValue, int aBase = DEC);
+    size_t print(long aValue, int aBase = DEC);
+    size_t print(unsigned long aValue, int aBase = DEC);
+    size_t print(double aValue, int aDigits = 2);
+
+    size_t println(void);
+    template<typename T> size_t println(T aValue) {
+        size_t tCount = print(aValue);
+        return tCount + println();
+    }
+    template<typename T> size_t println(T aValue, int aFormat) {
+        size_t tCount = print(aValue, aFormat);
+        return tCount + println();
+    }
+
+private:
+    size_t printNumber(unsigned long aValue, uint8_t aBase);
+};
+
+/*
+ * Models the HardwareSerial TX buffer and the UART drain time.
+ * Output is forwarded to stdout if hostEcho is set.
+ */
+class HardwareSerial: public Print {
+public:
+    void begin(unsigned long aBaudrate);
+    void end() {
+    }
+    int availableForWrite(void);
+    int available(void);
+    int read(void);
+    void flush(void);
+    size_t write(uint8_t aByte);
+    using Print::write;
+    operator bool() {
+        return true;
+    }
+
+    /*
+     * Host only
+     */
+    bool hostEcho = true;
+    bool hostEchoCarriageReturn = false; // must be set for binary output
+    uint32_t hostBytesWritten = 0;
+    uint32_t hostByteMicros = 87; // 10 bit at 115200 baud
+    uint64_t hostTxBusyUntilMicros = 0; // time when the last byte has left the UART
+    std::string hostInput; // characters to be returned by read()
+};
+
+extern HardwareSerial Serial;
+
+#define SERIAL_TX_BUFFER_SIZE 64
+
+#endif /* HOST_ARDUINO_H_ */
@@ -0,0 +1,354 @@
+/*
+ * ArduinoHost.cpp
+ *
+ * Host implementation of the Arduino core functions used by SBMInfo.cpp.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+#if !defined(__AVR__)
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+
+/*
+ * With a real bus (USE_LINUX_I2C_DEV), the real time is used and delay() sleeps.
+ * The modeled times of Serial, LCD and bus are then ignored.
+ */
+#if defined(USE_LINUX_I2C_DEV) && !defined(HOST_REAL_TIME)
+#define HOST_REAL_TIME
+#endif
+
+uint8_t PRR;
+uint8_t DIDR0;
+
+HardwareSerial Serial;
+
+uint8_t hostEEPROMContent[E2END + 1];
+uint64_t hostEEPROMBusyUntilMicros = 0;
+uint32_t hostEEPROMWrites = 0;
+// a new ATmega has an erased EEPROM
+static struct HostEEPROMEraser {
+    HostEEPROMEraser() {
+        memset(hostEEPROMContent, 0xFF, sizeof(hostEEPROMContent));
+    }
+} sHostEEPROMEraser;
+HostStatusRegister SREG;
+
+static uint64_t sHostMicros = 0;
+static bool sInterruptsEnabled = true;
+static bool sTWIInterruptPending = false;
+static uint8_t sPinValues[32];
+static uint8_t sPinModes[32];
+
+/*
+ * digitalWrite(), digitalRead() and pinMode() of the Arduino core take about 4 us at 16 MHz
+ */
+#define HOST_PIN_ACCESS_MICROS 4
+
+/*
+ * While interrupts are disabled, the UART data register empty interrupt can not refill the UART,
+ * so the TX buffer is not drained during this time.
+ */
+static void advanceClockTo(uint64_t aMicros) {
+    if (aMicros < sHostMicros) {
+        // clock was already advanced by an interrupt service routine
+        return;
+    }
+    if (!sInterruptsEnabled && Serial.hostTxBusyUntilMicros > sHostMicros) {
+        Serial.hostTxBusyUntilMicros += aMicros - sHostMicros;
+    }
+    sHostMicros = aMicros;
+}
+
+/*
+ * Processes the events of the TWI emulation which are due in this interval
+ */
+void hostAdvanceMicros(uint32_t aMicros) {
+#if defined(HOST_REAL_TIME)
+    (void) aMicros;
+    return;
+#endif
+    uint64_t tTargetMicros = sHostMicros + aMicros;
+    while (hostTWINextEventMicros() <= tTargetMicros) {
+        advanceClockTo(hostTWINextEventMicros());
+        hostTWIProcessEvent();
+    }
+    advanceClockTo(tTargetMicros);
+}
+
+uint64_t hostGetMicros(void) {
+#if defined(HOST_REAL_TIME)
+    static uint64_t sStartMicros = 0;
+    struct timespec tTime;
+    clock_gettime(CLOCK_MONOTONIC, &tTime);
+    uint64_t tMicros = tTime.tv_sec * 1000000ULL + tTime.tv_nsec / 1000;
+    if (sStartMicros == 0) {
+        sStartMicros = tMicros;
+    }
+    sHostMicros = tMicros - sStartMicros;
+#endif
+    return sHostMicros;
+}
+
+static void sleepMicros(uint32_t aMicros) {
+#if defined(HOST_REAL_TIME)
+    struct timespec tTime;
+    tTime.tv_sec = aMicros / 1000000;
+    tTime.tv_nsec = (aMicros % 1000000) * 1000L;
+    nanosleep(&tTime, NULL);
+#else
+    hostAdvanceMicros(aMicros);
+#endif
+}
+
+bool hostInterruptsEnabled(void) {
+    return sInterruptsEnabled;
+}
+
+/*
+ * The interrupt service routine runs with interrupts disabled, as on the AVR
+ */
+static void serviceTWIInterrupt(void) {
+    while (sTWIInterruptPending && sInterruptsEnabled && hostTWIInterrupt != NULL) {
+        sTWIInterruptPending = false;
+        sInterruptsEnabled = false;
+        hostTWIInterrupt();
+        sInterruptsEnabled = true;
+    }
+}
+
+void hostRequestTWIInterrupt(void) {
+    sTWIInterruptPending = true;
+    serviceTWIInterrupt();
+}
+
+void cli(void) {
+    sInterruptsEnabled = false;
+}
+
+void sei(void) {
+    sInterruptsEnabled = true;
+    serviceTWIInterrupt();
+}
+
+HostStatusRegister::operator uint8_t() const {
+    return sInterruptsEnabled ? _BV(SREG_I) : 0;
+}
+
+HostStatusRegister & HostStatusRegister::operator =(uint8_t aValue) {
+    if (aValue & _BV(SREG_I)) {
+        sei();
+    } else {
+        cli();
+    }
+    return *this;
+}
+
+/*
+ * Like the PORT register of the AVR, the value of an input enables its pull-up.
+ * A pin connected to the simulated bus is pulled low by the master only as output with low level.
+ */
+void pinMode(uint8_t aPin, uint8_t aMode) {
+    hostAdvanceMicros(HOST_PIN_ACCESS_MICROS);
+    sPinModes[aPin & 0x1F] = aMode;
+    if (aMode != OUTPUT) {
+        sPinValues[aPin & 0x1F] = (aMode == INPUT_PULLUP) ? HIGH : LOW;
+    }
+    hostDriveI2CPin(aPin, aMode == OUTPUT && sPinValues[aPin & 0x1F] == LOW);
+}
+
+void digitalWrite(uint8_t aPin, uint8_t aValue) {
+    hostAdvanceMicros(HOST_PIN_ACCESS_MICROS);
+    sPinValues[aPin & 0x1F] = aValue;
+    hostDriveI2CPin(aPin, sPinModes[aPin & 0x1F] == OUTPUT && aValue == LOW);
+}
+
+/*
+ * An unconnected input reads high only with pull-up
+ */
+int digitalRead(uint8_t aPin) {
+    hostAdvanceMicros(HOST_PIN_ACCESS_MICROS);
+    int tLevel = hostReadI2CPin(aPin);
+    if (tLevel >= 0) {
+        return tLevel;
+    }
+    return sPinValues[aPin & 0x1F];
+}
+
+unsigned long millis(void) {
+    return hostGetMicros() / 1000;
+}
+
+unsigned long micros(void) {
+    return hostGetMicros();
+}
+
+void delay(unsigned long aMillis) {
+    sleepMicros(aMillis * 1000);
+}
+
+void delayMicroseconds(unsigned int aMicros) {
+    sleepMicros(aMicros);
+}
+
+/*
+ * Called by busy waiting loops, so time must advance here
+ */
+void yield(void) {
+    hostAdvanceMicros(1);
+}
+
+/*
+ * Print
+ */
+size_t Print::write(const uint8_t * aBuffer, size_t aSize) {
+    size_t tCount = 0;
+    while (aSize--) {
+        tCount += write(*aBuffer++);
+    }
+    return tCount;
+}
+
+size_t Print::print(const __FlashStringHelper * aString) {
+    return print(reinterpret_cast<const char *>(aString));
+}
+
+size_t Print::print(const String & aString) {
+    return write(aString.c_str(), aString.length());
+}
+
+size_t Print::print(const char aString[]) {
+    return write(aString);
+}
+
+size_t Print::print(char aChar) {
+    return write((uint8_t) aChar);
+}
+
+size_t Print::print(unsigned char aValue, int aBase) {
+    return print((unsigned long) aValue, aBase);
+}
+
+size_t Print::print(int aValue, int aBase) {
+    return print((long) aValue, aBase);
+}
+
+size_t Print::print(unsigned int aValue, int aBase) {
+    return print((unsigned long) aValue, aBase);
+}
+
+/*
+ * Like the Arduino core, negative numbers are only printed with sign for base 10
+ */
+size_t Print::print(long aValue, int aBase) {
+    if (aBase == DEC && aValue < 0) {
+        size_t tCount = print('-');
+        return tCount + printNumber(-aValue, DEC);
+    }
+    if (aBase == DEC) {
+        return printNumber(aValue, DEC);
+    }
+    // AVR long is 32 bit
+    return printNumber((uint32_t) aValue, aBase);
+}
+
+size_t Print::print(unsigned long aValue, int aBase) {
+    return printNumber(aValue, aBase);
+}
+
+size_t Print::print(double aValue, int aDigits) {
+    char tBuffer[32];
+    int tLength = snprintf(tBuffer, sizeof(tBuffer), "%.*f", aDigits, aValue);
+    return write((const uint8_t *) tBuffer, tLength);
+}
+
+size_t Print::println(void) {
+    return write("\r\n");
+}
+
+size_t Print::printNumber(unsigned long aValue, uint8_t aBase) {
+    char tBuffer[8 * sizeof(long) + 1];
+    char *tStringPtr = &tBuffer[sizeof(tBuffer) - 1];
+    *tStringPtr = '\0';
+    if (aBase < 2) {
+        aBase = 10;
+    }
+    do {
+        char tDigit = aValue % aBase;
+        aValue /= aBase;
+        *--tStringPtr = tDigit < 10 ? tDigit + '0' : tDigit + 'A' - 10;
+    } while (aValue);
+    return write(tStringPtr);
+}
+
+/*
+ * HardwareSerial
+ */
+void HardwareSerial::begin(unsigned long aBaudrate) {
+    // 1 start, 8 data and 1 stop bit
+    hostByteMicros = (10 * 1000000UL + aBaudrate - 1) / aBaudrate;
+}
+
+int HardwareSerial::availableForWrite(void) {
+    uint64_t tNow = hostGetMicros();
+    if (hostTxBusyUntilMicros <= tNow) {
+        return SERIAL_TX_BUFFER_SIZE - 1;
+    }
+    int tPending = (hostTxBusyUntilMicros - tNow + hostByteMicros - 1) / hostByteMicros;
+    if (tPending >= SERIAL_TX_BUFFER_SIZE - 1) {
+        return 0;
+    }
+    return SERIAL_TX_BUFFER_SIZE - 1 - tPending;
+}
+
+int HardwareSerial::available(void) {
+    return hostInput.length();
+}
+
+int HardwareSerial::read(void) {
+    if (hostInput.empty()) {
+        return -1;
+    }
+    int tChar = (uint8_t) hostInput[0];
+    hostInput.erase(0, 1);
+    return tChar;
+}
+
+/*
+ * Block until buffer is empty
+ */
+void HardwareSerial::flush(void) {
+    // flush() polls the UART itself if interrupts are disabled, so the buffer is always drained here
+    if (hostTxBusyUntilMicros > sHostMicros) {
+        sHostMicros = hostTxBusyUntilMicros;
+    }
+}
+
+/*
+ * Block if buffer is full, as HardwareSerial does
+ */
+size_t HardwareSerial::write(uint8_t aByte) {
+    if (availableForWrite() == 0) {
+        uint64_t tNow = hostGetMicros();
+        uint64_t tRoomAvailableAt = hostTxBusyUntilMicros - (SERIAL_TX_BUFFER_SIZE - 2) * hostByteMicros;
+        if (tRoomAvailableAt > tNow) {
+            sHostMicros = tRoomAvailableAt;
+        }
+    }
+    uint64_t tNow = hostGetMicros();
+    if (hostTxBusyUntilMicros < tNow) {
+        hostTxBusyUntilMicros = tNow;
+    }
+    hostTxBusyUntilMicros += hostByteMicros;
+    hostBytesWritten++;
+    if (hostEcho && (aByte != '\r' || hostEchoCarriageReturn)) {
+        putchar(aByte);
+    }
+    return 1;
+}
+
+#endif // !defined(__AVR__)
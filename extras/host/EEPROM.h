@@ -0,0 +1,60 @@
+/*
+ * EEPROM.h
+ *
+ * Host replacement for the Arduino EEPROM library and eeprom_is_ready() of avr/eeprom.h.
+ * The content is kept in hostEEPROMContent, which is erased (0xFF) at start.
+ * A write takes 3.3 ms like on the ATmega328, and a write blocks until the previous one is finished.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef HOST_EEPROM_H_
+#define HOST_EEPROM_H_
+
+#include "Arduino.h"
+
+#define E2END 0x3FF
+#define EEPROM_HOST_MICROS_PER_WRITE 3300
+
+/*
+ * Host only, defined in ArduinoHost.cpp
+ */
+extern uint8_t hostEEPROMContent[E2END + 1];
+extern uint64_t hostEEPROMBusyUntilMicros;
+extern uint32_t hostEEPROMWrites;
+
+inline bool eeprom_is_ready(void) {
+    return hostGetMicros() >= hostEEPROMBusyUntilMicros;
+}
+
+class EEPROMClass {
+public:
+    uint8_t read(int aAddress) {
+        return hostEEPROMContent[aAddress];
+    }
+
+    void write(int aAddress, uint8_t aValue) {
+        uint64_t tNow = hostGetMicros();
+        if (hostEEPROMBusyUntilMicros > tNow) {
+            hostAdvanceMicros(hostEEPROMBusyUntilMicros - tNow);
+        }
+        hostEEPROMContent[aAddress] = aValue;
+        hostEEPROMBusyUntilMicros = hostGetMicros() + EEPROM_HOST_MICROS_PER_WRITE;
+        hostEEPROMWrites++;
+    }
+
+    void update(int aAddress, uint8_t aValue) {
+        if (read(aAddress) != aValue) {
+            write(aAddress, aValue);
+        }
+    }
+
+    uint16_t length() {
+        return E2END + 1;
+    }
+};
+
+static EEPROMClass EEPROM __attribute__((unused));
+
+#endif /* HOST_EEPROM_H_ */
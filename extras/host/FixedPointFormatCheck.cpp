@@ -0,0 +1,104 @@
+/*
+ * FixedPointFormatCheck.cpp
+ *
+ * Compares the integer formatting of FixedPointFormat.h for all 65536 register values with the former float code,
+ * printed by an emulation of Print::printFloat() of the AVR core, where double is a 32 bit float.
+ * The capacity conversion is compared with the former 32 bit long expression for some design voltages.
+ *
+ * Build and run from the repository root with:
+ *   g++ -O2 -Isrc extras/host/FixedPointFormatCheck.cpp -o FixedPointFormatCheck && ./FixedPointFormatCheck
+ * or with "make check" in extras/host.
+ * The exit code is 1 if a value differs.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "FixedPointFormat.h"
+
+/*
+ * Like Print::printFloat() of the AVR core: round by adding half of the last digit, then print the truncated digits
+ */
+void printFloatAVR(char * aBuffer, float aNumber, uint8_t aDigits) {
+    if (aNumber < 0.0f) {
+        *aBuffer++ = '-';
+        aNumber = -aNumber;
+    }
+    float tRounding = 0.5f;
+    for (uint8_t i = 0; i < aDigits; ++i) {
+        tRounding /= 10.0f;
+    }
+    aNumber += tRounding;
+    uint32_t tIntegerPart = (uint32_t) aNumber;
+    float tRemainder = aNumber - (float) tIntegerPart;
+    aBuffer += sprintf(aBuffer, "%lu", (unsigned long) tIntegerPart);
+    if (aDigits > 0) {
+        *aBuffer++ = '.';
+    }
+    while (aDigits-- > 0) {
+        tRemainder *= 10.0f;
+        uint8_t tDigit = (uint8_t) tRemainder;
+        *aBuffer++ = '0' + tDigit;
+        tRemainder -= tDigit;
+    }
+    *aBuffer = '\0';
+}
+
+/*
+ * @return number of differences
+ */
+uint32_t checkFormat(const char * aName, char * (*aFormat)(char *, uint16_t), float (*aConvert)(uint16_t),
+        uint8_t aDigits) {
+    uint32_t tDifferences = 0;
+    for (uint32_t tValue = 0; tValue <= 0xFFFF; ++tValue) {
+        char tFixedPoint[FIXED_POINT_BUFFER_SIZE];
+        char tFloat[32];
+        aFormat(tFixedPoint, tValue);
+        printFloatAVR(tFloat, aConvert(tValue), aDigits);
+        if (strcmp(tFixedPoint, tFloat) != 0) {
+            if (tDifferences < 10) {
+                printf("%s %lu: fixed point %s, float %s\n", aName, (unsigned long) tValue, tFixedPoint, tFloat);
+            }
+            tDifferences++;
+        }
+    }
+    printf("%-12s %lu of 65536 values differ\n", aName, (unsigned long) tDifferences);
+    return tDifferences;
+}
+
+/*
+ * The former float expressions of printVoltage() and printTemperature()
+ */
+float convertVoltage(uint16_t aVoltage) {
+    return (float) aVoltage / 1000;
+}
+float convertTemperature(uint16_t aTemperature) {
+    return (float) (aTemperature / 10.0f) - 273.15f;
+}
+
+uint32_t checkCapacityConversion() {
+    const uint16_t tDesignVoltages[] = { 3600, 3700, 7200, 7400, 10800, 11100, 14400, 14800, 18000 };
+    uint32_t tDifferences = 0;
+    for (uint8_t i = 0; i < sizeof(tDesignVoltages) / sizeof(tDesignVoltages[0]); ++i) {
+        for (uint32_t tCapacity = 0; tCapacity <= 0xFFFF; ++tCapacity) {
+            // the former expression with the 32 bit long of the AVR
+            uint16_t tLong = (uint16_t) (((int32_t) tCapacity * 10000L) / (int32_t) tDesignVoltages[i]);
+            if (convertCentiWattToMilliampere(tCapacity, tDesignVoltages[i]) != tLong) {
+                tDifferences++;
+            }
+        }
+    }
+    printf("%-12s %lu of %lu values differ\n", "Capacity", (unsigned long) tDifferences,
+            (unsigned long) (65536 * sizeof(tDesignVoltages) / sizeof(tDesignVoltages[0])));
+    return tDifferences;
+}
+
+int main() {
+    uint32_t tDifferences = checkFormat("Voltage", formatMillivolt, convertVoltage, 3);
+    tDifferences += checkFormat("Temperature", formatDeciKelvinAsCelsius, convertTemperature, 2);
+    tDifferences += checkCapacityConversion();
+    return (tDifferences == 0) ? 0 : 1;
+}
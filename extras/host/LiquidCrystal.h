@@ -0,0 +1,88 @@
+/*
+ * LiquidCrystal.h
+ *
+ * Host replacement for the Arduino LiquidCrystal library.
+ * Keeps the content of the display in a character buffer and accounts the time
+ * the 4 bit parallel interface of the original library needs for each transferred byte.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef HOST_LIQUIDCRYSTAL_H_
+#define HOST_LIQUIDCRYSTAL_H_
+
+#include "Arduino.h"
+
+// 2 * 4 bit with 100 us settle time each plus the digitalWrite() overhead of the original library
+#define LCD_HOST_MICROS_PER_BYTE 280
+#define LCD_HOST_MICROS_FOR_CLEAR 2000
+
+#define LCD_HOST_MAX_COLUMNS 20
+#define LCD_HOST_MAX_ROWS 4
+
+class LiquidCrystal: public Print {
+public:
+    LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3) {
+        (void) rs;
+        (void) enable;
+        (void) d0;
+        (void) d1;
+        (void) d2;
+        (void) d3;
+        clearContent();
+    }
+
+    void begin(uint8_t aColumns, uint8_t aRows) {
+        mColumns = aColumns;
+        mRows = aRows;
+        clear();
+    }
+
+    void clear() {
+        clearContent();
+        hostCommandsWritten++;
+        hostAdvanceMicros(LCD_HOST_MICROS_FOR_CLEAR);
+    }
+
+    void setCursor(uint8_t aColumn, uint8_t aRow) {
+        mColumn = aColumn;
+        mRow = aRow;
+        hostCommandsWritten++;
+        hostAdvanceMicros(LCD_HOST_MICROS_PER_BYTE);
+    }
+
+    size_t write(uint8_t aByte) {
+        if (mColumn < mColumns && mRow < mRows) {
+            hostContent[mRow][mColumn] = aByte;
+        }
+        mColumn++;
+        hostBytesWritten++;
+        hostAdvanceMicros(LCD_HOST_MICROS_PER_BYTE);
+        return 1;
+    }
+    using Print::write;
+
+    /*
+     * Host only
+     */
+    char hostContent[LCD_HOST_MAX_ROWS][LCD_HOST_MAX_COLUMNS + 1]; // including string terminator
+    uint32_t hostBytesWritten = 0;
+    uint32_t hostCommandsWritten = 0;
+
+private:
+    void clearContent() {
+        for (uint8_t tRow = 0; tRow < LCD_HOST_MAX_ROWS; ++tRow) {
+            memset(hostContent[tRow], ' ', LCD_HOST_MAX_COLUMNS);
+            hostContent[tRow][LCD_HOST_MAX_COLUMNS] = '\0';
+        }
+        mColumn = 0;
+        mRow = 0;
+    }
+    uint8_t mColumns = LCD_HOST_MAX_COLUMNS;
+    uint8_t mRows = LCD_HOST_MAX_ROWS;
+    uint8_t mColumn;
+    uint8_t mRow;
+};
+
+#endif /* HOST_LIQUIDCRYSTAL_H_ */
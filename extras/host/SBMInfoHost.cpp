@@ -0,0 +1,359 @@
+/*
+ * SBMInfoHost.cpp
+ *
+ * Runs setup() and loop() of SBMInfo.cpp on a Linux host against a simulated Smart Battery at address 0x0B
+ * and reports the simulated and the real throughput.
+ *
+ * Build from the repository root with:
+ *   g++ -O2 -Iextras/host -Isrc src/SBMInfo.cpp extras/host/ArduinoHost.cpp extras/host/SBMSimulator.cpp extras/host/SBMInfoHost.cpp -o SBMInfoHost
+ *
+ * Usage:
+ *   ./SBMInfoHost [-c <capture>] [-n <number of loops>] [-t <simulated seconds>] [-l <latency us>] [-k <NAK probability>]
+ *                 [-b <bit error probability>] [-s <seed>] [-L <load current mA>] [-p <number of packs>]
+ *                 [-i <simulated seconds>:<text>] [-e <EEPROM file>] [-w <simulated seconds>:<capture>] [-g <SDA pin>,<SCL pin>]
+ *                 [-F <max clock Hz>] [-S <stretch us>] [-N] [-P] [-q]
+ *   -e loads the EEPROM content from the file, if it exists, and saves it at the end,
+ *   e.g. to start a second time with the register capabilities cached by the first run.
+ *   -w removes the first pack after the given simulated seconds of loop() and inserts a pack with the given capture
+ *   HOST_SWAP_MILLIS later. It can be given more than once. For each swap the time from inserting the pack
+ *   to its first access, to the end of the loop() in which it was accessed first, i.e. identified and printed,
+ *   and to the following first read of its current is reported.
+ *   -i sends the text to the serial input of the sketch after the given simulated seconds of loop(), e.g. -i 3600:d
+ *   -g connects the simulated bus to the given pins for a master which drives the lines with digital pins, default is 18,19.
+ *   Build with -DUSE_PIN_DISCOVERY to let setup() search them.
+ *   -F sets the maximum clock of the packs, default 100000. Above it, the bytes read get bit errors.
+ *   -S lets the packs stretch the clock after each byte for the given time. Both are for -DTUNE_BUS_CLOCK.
+ *   -N adds noise to current and temperature, -P lets the pack support PEC, -q suppresses the serial output of the sketch.
+ *   If -t is given, loop() is called until the simulated time is reached, otherwise -n times.
+ *   -p attaches the given number of packs, all with the same capture, behind simulated TCA9548A multiplexers
+ *   at 0x70, 0x71 etc., 8 packs at each multiplexer. Add -DMAX_NUMBER_OF_PACKS=64 to the build command for more than 4 packs.
+ *   Then the register reads per second show how many packs can be polled at the rate given by the poll periods.
+ *
+ * Add -DSHOW_SCHEDULER_STATISTICS to the build command to get the achieved poll rate and jitter of each register.
+ * Add -DUSE_HARDWARE_TWI to run the interrupt driven AsyncTWI.h backend against the emulated TWI peripheral.
+ * The number of loops then shows the CPU time which is no longer blocked by the bus transfers.
+ * Add -DUSE_SIMULATOR_TRANSPORT to access the simulated pack without bus transfer time.
+ * Add -DUSE_BINARY_TELEMETRY to get the changed values as binary frames, which can be converted to text by SBMTelemetryDecoder.cpp.
+ *
+ * Add -DUSE_LINUX_I2C_DEV to read a real pack with the Linux i2c-dev interface instead of the simulated one.
+ * Then the real time is used and the simulator options are ignored. The device is taken from the environment variable
+ * SBM_I2C_DEVICE, default is /dev/i2c-1.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+#if !defined(__AVR__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "LiquidCrystal.h"
+#include "SBMInfo.h"
+#include "SBMSimulator.h"
+
+void setup(void);
+void loop(void);
+extern LiquidCrystal myLCD;
+
+#define HOST_MAX_NUMBER_OF_PACKS (MUX_MAX_NUMBER * MUX_NUMBER_OF_CHANNELS)
+
+/*
+ * Time for one loop() call which does not access any hardware
+ */
+#define HOST_IDLE_LOOP_MICROS 50
+
+/*
+ * Time between removing a pack and inserting the next one for -w
+ */
+#define HOST_SWAP_MILLIS 1000
+
+struct HostSwap {
+    double Seconds;
+    const char * CaptureFilename;
+    uint64_t InsertMicros;
+    uint64_t IdentifiedMicros;
+};
+
+static void printUsage(const char * aProgramName) {
+    fprintf(stderr,
+            "Usage: %s [-c <capture>] [-n <loops>] [-t <seconds>] [-l <latency us>] [-k <NAK probability>] [-b <bit error probability>] [-s <seed>] [-L <load mA>] [-p <packs>] [-i <seconds>:<text>] [-e <EEPROM file>] [-w <seconds>:<capture>] [-g <SDA pin>,<SCL pin>] [-F <max clock Hz>] [-S <stretch us>] [-N] [-P] [-q]\n",
+            aProgramName);
+}
+
+static double getWallMillis() {
+    struct timespec tTime;
+    clock_gettime(CLOCK_MONOTONIC, &tTime);
+    return tTime.tv_sec * 1000.0 + tTime.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char * argv[]) {
+    const char * tCaptureFilename = "extras/DELL_discharging_SBMInfo.log";
+    unsigned long tNumberOfLoops = 1000;
+    double tSimulatedSeconds = 0;
+    unsigned int tNumberOfPacks = 1;
+    bool tNoise = false;
+    bool tPECSupported = false;
+    int tLoadCurrentOverride = 0;
+    uint32_t tMaxClockHz = 100000;
+    uint32_t tClockStretchMicros = 0;
+    double tInputSeconds = -1;
+    const char * tInputText = NULL;
+    const char * tEEPROMFilename = NULL;
+    std::vector<HostSwap> tSwaps;
+
+    for (int i = 1; i < argc; ++i) {
+        const char * tOption = argv[i];
+        const char * tArgument = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(tOption, "-q") == 0) {
+            Serial.hostEcho = false;
+        } else if (strcmp(tOption, "-N") == 0) {
+            tNoise = true;
+        } else if (strcmp(tOption, "-P") == 0) {
+            tPECSupported = true;
+        } else if (tArgument == NULL) {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            i++;
+            if (strcmp(tOption, "-c") == 0) {
+                tCaptureFilename = tArgument;
+            } else if (strcmp(tOption, "-n") == 0) {
+                tNumberOfLoops = strtoul(tArgument, NULL, 10);
+            } else if (strcmp(tOption, "-t") == 0) {
+                tSimulatedSeconds = atof(tArgument);
+            } else if (strcmp(tOption, "-l") == 0) {
+                SimulatedBus.TransactionLatencyMicros = strtoul(tArgument, NULL, 10);
+            } else if (strcmp(tOption, "-k") == 0) {
+                SimulatedBus.NakProbability = atof(tArgument);
+            } else if (strcmp(tOption, "-b") == 0) {
+                SimulatedBus.BitErrorProbability = atof(tArgument);
+            } else if (strcmp(tOption, "-s") == 0) {
+                SimulatedBus.Seed = strtoul(tArgument, NULL, 10);
+            } else if (strcmp(tOption, "-L") == 0) {
+                tLoadCurrentOverride = atoi(tArgument);
+            } else if (strcmp(tOption, "-i") == 0) {
+                tInputText = strchr(tArgument, ':');
+                if (tInputText == NULL) {
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                tInputSeconds = atof(tArgument);
+                tInputText++;
+            } else if (strcmp(tOption, "-w") == 0) {
+                const char * tCaptureFilename = strchr(tArgument, ':');
+                if (tCaptureFilename == NULL) {
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                HostSwap tSwap = { atof(tArgument), tCaptureFilename + 1, 0, 0 };
+                tSwaps.push_back(tSwap);
+            } else if (strcmp(tOption, "-F") == 0) {
+                tMaxClockHz = strtoul(tArgument, NULL, 10);
+            } else if (strcmp(tOption, "-S") == 0) {
+                tClockStretchMicros = strtoul(tArgument, NULL, 10);
+            } else if (strcmp(tOption, "-g") == 0) {
+                const char * tSCLPin = strchr(tArgument, ',');
+                if (tSCLPin == NULL) {
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                SimulatedPins.SDAPin = atoi(tArgument);
+                SimulatedPins.SCLPin = atoi(tSCLPin + 1);
+            } else if (strcmp(tOption, "-e") == 0) {
+                tEEPROMFilename = tArgument;
+            } else if (strcmp(tOption, "-p") == 0) {
+                tNumberOfPacks = strtoul(tArgument, NULL, 10);
+                if (tNumberOfPacks < 1 || tNumberOfPacks > HOST_MAX_NUMBER_OF_PACKS) {
+                    fprintf(stderr, "Number of packs must be between 1 and %d\n", HOST_MAX_NUMBER_OF_PACKS);
+                    return 1;
+                }
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+    }
+
+#if defined(USE_LINUX_I2C_DEV)
+    tCaptureFilename = "none, real pack";
+    (void) tNoise;
+    (void) tPECSupported;
+    (void) tLoadCurrentOverride;
+    (void) tMaxClockHz;
+    (void) tClockStretchMicros;
+    tSwaps.clear();
+#else
+    /*
+     * The packs for -w follow the packs attached at start. They are attached at the place of the first pack, but not yet inserted.
+     * The size is fixed before attaching, since the bus stores pointers to the packs.
+     */
+    std::vector<SimulatedSmartBattery> tSimulatedBatteries(tNumberOfPacks + tSwaps.size());
+    for (unsigned int i = 0; i < tSimulatedBatteries.size(); ++i) {
+        SimulatedSmartBattery * tBattery = &tSimulatedBatteries[i];
+        tBattery->Noise = tNoise;
+        tBattery->PECSupported = tPECSupported;
+        tBattery->LoadCurrentOverride = tLoadCurrentOverride;
+        tBattery->MaxClockHz = tMaxClockHz;
+        tBattery->ClockStretchMicros = tClockStretchMicros;
+        tBattery->NoiseSeed += i;
+        const char * tFilename = tCaptureFilename;
+        unsigned int tPlace = i;
+        if (i >= tNumberOfPacks) {
+            tFilename = tSwaps[i - tNumberOfPacks].CaptureFilename;
+            tBattery->Inserted = false;
+            tPlace = 0;
+        }
+        if (!tBattery->loadCapture(tFilename)) {
+            fprintf(stderr, "Cannot read capture %s\n", tFilename);
+            return 1;
+        }
+        if (tBattery->PECSupported) {
+            // Version 1.1 with optional PEC support
+            tBattery->setWord(SPEC_INFO, (tBattery->getWord(SPEC_INFO) & 0xFF0F) | 0x0030);
+        }
+        if (tNumberOfPacks == 1) {
+            SimulatedBus.attach(tBattery);
+        } else {
+            SimulatedBus.attach(tBattery, MUX_BASE_ADDRESS + tPlace / MUX_NUMBER_OF_CHANNELS, tPlace % MUX_NUMBER_OF_CHANNELS);
+        }
+    }
+#endif
+
+    if (tEEPROMFilename != NULL) {
+        FILE * tFile = fopen(tEEPROMFilename, "rb");
+        if (tFile != NULL) {
+            if (fread(hostEEPROMContent, 1, sizeof(hostEEPROMContent), tFile) != sizeof(hostEEPROMContent)) {
+                fprintf(stderr, "EEPROM file %s is too short\n", tEEPROMFilename);
+            }
+            fclose(tFile);
+        }
+    }
+
+#if defined(USE_BINARY_TELEMETRY) || defined(USE_DATA_FLASH_DUMP)
+    // binary bytes must not be removed
+    Serial.hostEchoCarriageReturn = true;
+#endif
+    double tWallStartMillis = getWallMillis();
+    setup();
+    uint64_t tSetupMicros = hostGetMicros();
+    uint32_t tSetupTransactions = SimulatedBus.Transactions;
+    uint32_t tSetupMuxTransactions = SimulatedBus.MuxTransactions;
+    uint32_t tSetupLCDTransfers = myLCD.hostBytesWritten + myLCD.hostCommandsWritten;
+    uint32_t tMaxLCDTransfersPerLoop = 0;
+    uint32_t tLoopsWithLCDTransfers = 0;
+
+#if !defined(USE_LINUX_I2C_DEV)
+    SimulatedSmartBattery * tInsertedBattery = &tSimulatedBatteries[0];
+    size_t tNextSwapIndex = 0;
+#endif
+    uint64_t tEndMicros = tSetupMicros + (uint64_t) (tSimulatedSeconds * 1000000);
+    if (tSimulatedSeconds > 0) {
+        tNumberOfLoops = 0;
+    }
+    for (unsigned long i = 0; tSimulatedSeconds > 0 ? hostGetMicros() < tEndMicros : i < tNumberOfLoops; ++i) {
+        uint64_t tLoopStartMicros = hostGetMicros();
+        if (tInputText != NULL && tLoopStartMicros >= tSetupMicros + (uint64_t) (tInputSeconds * 1000000)) {
+            Serial.hostInput += tInputText;
+            tInputText = NULL;
+        }
+#if !defined(USE_LINUX_I2C_DEV)
+        /*
+         * Swap the first pack
+         */
+        if (tNextSwapIndex < tSwaps.size()) {
+            HostSwap * tSwap = &tSwaps[tNextSwapIndex];
+            uint64_t tRemoveMicros = tSetupMicros + (uint64_t) (tSwap->Seconds * 1000000);
+            if (tInsertedBattery != NULL && tLoopStartMicros >= tRemoveMicros) {
+                tInsertedBattery->Inserted = false;
+                tInsertedBattery = NULL;
+            } else if (tInsertedBattery == NULL && tLoopStartMicros >= tRemoveMicros + HOST_SWAP_MILLIS * 1000) {
+                tInsertedBattery = &tSimulatedBatteries[tNumberOfPacks + tNextSwapIndex];
+                tInsertedBattery->insert(tLoopStartMicros);
+                tSwap->InsertMicros = tLoopStartMicros;
+                tNextSwapIndex++;
+            }
+        }
+#endif
+        uint32_t tLoopStartLCDTransfers = myLCD.hostBytesWritten + myLCD.hostCommandsWritten;
+        loop();
+#if !defined(USE_LINUX_I2C_DEV)
+        if (tInsertedBattery != NULL && tNextSwapIndex > 0 && tSwaps[tNextSwapIndex - 1].IdentifiedMicros == 0
+                && tInsertedBattery->FirstAccessMicros != 0) {
+            tSwaps[tNextSwapIndex - 1].IdentifiedMicros = hostGetMicros();
+            tInsertedBattery->FirstCurrentReadMicros = 0; // now record the first read by the poll scheduler
+        }
+#endif
+        uint32_t tLCDTransfers = myLCD.hostBytesWritten + myLCD.hostCommandsWritten - tLoopStartLCDTransfers;
+        if (tLCDTransfers > 0) {
+            tLoopsWithLCDTransfers++;
+            if (tMaxLCDTransfersPerLoop < tLCDTransfers) {
+                tMaxLCDTransfersPerLoop = tLCDTransfers;
+            }
+        }
+        if (hostGetMicros() == tLoopStartMicros) {
+            hostAdvanceMicros(HOST_IDLE_LOOP_MICROS);
+        }
+        if (tSimulatedSeconds > 0) {
+            tNumberOfLoops++;
+        }
+    }
+    double tWallMillis = getWallMillis() - tWallStartMillis;
+    uint64_t tLoopMicros = hostGetMicros() - tSetupMicros;
+    uint32_t tLoopTransactions = SimulatedBus.Transactions - tSetupTransactions;
+    uint32_t tLoopMuxTransactions = SimulatedBus.MuxTransactions - tSetupMuxTransactions;
+    uint32_t tLoopLCDTransfers = myLCD.hostBytesWritten + myLCD.hostCommandsWritten - tSetupLCDTransfers;
+    double tReadsPerSecond = tLoopMicros ? (tLoopTransactions - tLoopMuxTransactions) * 1000000.0 / tLoopMicros : 0;
+
+    fprintf(stderr, "\nCapture:                  %s\n", tCaptureFilename);
+    fprintf(stderr, "Setup:                    %.3f s simulated, %u bus transactions\n", tSetupMicros / 1000000.0,
+            tSetupTransactions);
+    fprintf(stderr, "Loops:                    %lu in %.3f s simulated, %.3f ms per loop\n", tNumberOfLoops,
+            tLoopMicros / 1000000.0, tNumberOfLoops ? tLoopMicros / 1000.0 / tNumberOfLoops : 0);
+    fprintf(stderr, "Bus transactions:         %u in loops, %.1f per loop, %.1f per second, %u bytes total\n", tLoopTransactions,
+            tNumberOfLoops ? (double) tLoopTransactions / tNumberOfLoops : 0,
+            tLoopMicros ? tLoopTransactions * 1000000.0 / tLoopMicros : 0, SimulatedBus.BytesTransferred);
+    fprintf(stderr, "Register reads:           %.1f per second, %.1f per pack and second, %u packs\n", tReadsPerSecond,
+            tReadsPerSecond / tNumberOfPacks, tNumberOfPacks);
+    fprintf(stderr, "Multiplexer transactions: %u in loops\n", tLoopMuxTransactions);
+    fprintf(stderr, "Bus busy:                 %.3f s\n", SimulatedBus.BusyMicros / 1000000.0);
+    fprintf(stderr, "Injected NAKs/bit errors: %u / %u\n", SimulatedBus.InjectedNaks, SimulatedBus.InjectedBitErrors);
+    fprintf(stderr, "Serial bytes:             %u\n", Serial.hostBytesWritten);
+    fprintf(stderr, "LCD bytes/commands:       %u / %u\n", myLCD.hostBytesWritten, myLCD.hostCommandsWritten);
+    fprintf(stderr, "LCD transfers in loops:   %u in %u loops, %.1f per loop with transfers, maximum %u\n", tLoopLCDTransfers,
+            tLoopsWithLCDTransfers, tLoopsWithLCDTransfers ? (double) tLoopLCDTransfers / tLoopsWithLCDTransfers : 0,
+            tMaxLCDTransfersPerLoop);
+    fprintf(stderr, "EEPROM writes:            %u\n", hostEEPROMWrites);
+#if !defined(USE_LINUX_I2C_DEV)
+    for (size_t i = 0; i < tNextSwapIndex; ++i) {
+        SimulatedSmartBattery * tBattery = &tSimulatedBatteries[tNumberOfPacks + i];
+        fprintf(stderr, "Swap to %s at %.3f s: ", tSwaps[i].CaptureFilename, (tSwaps[i].InsertMicros - tSetupMicros) / 1000000.0);
+        if (tBattery->FirstCurrentReadMicros == 0 || tSwaps[i].IdentifiedMicros == 0) {
+            fprintf(stderr, "not polled\n");
+        } else {
+            fprintf(stderr, "first access after %.1f ms, identified after %.1f ms, first polled current after %.1f ms\n",
+                    (tBattery->FirstAccessMicros - tSwaps[i].InsertMicros) / 1000.0,
+                    (tSwaps[i].IdentifiedMicros - tSwaps[i].InsertMicros) / 1000.0,
+                    (tBattery->FirstCurrentReadMicros - tSwaps[i].InsertMicros) / 1000.0);
+        }
+    }
+#endif
+    fprintf(stderr, "Wall time:                %.1f ms, %.0f loops/s\n", tWallMillis,
+            tWallMillis > 0 ? tNumberOfLoops * 1000.0 / tWallMillis : 0);
+
+    if (tEEPROMFilename != NULL) {
+        FILE * tFile = fopen(tEEPROMFilename, "wb");
+        if (tFile == NULL || fwrite(hostEEPROMContent, 1, sizeof(hostEEPROMContent), tFile) != sizeof(hostEEPROMContent)) {
+            fprintf(stderr, "Cannot write EEPROM file %s\n", tEEPROMFilename);
+        }
+        if (tFile != NULL) {
+            fclose(tFile);
+        }
+    }
+    return 0;
+}
+
+#endif // !defined(__AVR__)
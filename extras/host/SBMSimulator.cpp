@@ -0,0 +1,1004 @@
+/*
+ * SBMSimulator.cpp
+ *
+ * Virtual Smart Battery and SMBus for running SBMInfo.cpp on a host.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+#if !defined(__AVR__)
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "util/twi.h"
+#include "SBMInfo.h"
+#include "SMBusPEC.h"
+#include "SBMSimulator.h"
+
+SimulatedSMBus SimulatedBus;
+
+/*
+ * Kinds of values found in a capture
+ */
+#define KIND_NUMBER         0 // "46" or "-105 mA" or "92 %"
+#define KIND_VOLTAGE        1 // "12.212 V"
+#define KIND_TEMPERATURE    2 // "25.95 C"
+#define KIND_TIME           3 // "2915 min" or "Battery not beeing (dis)charged"
+#define KIND_BINARY         4 // "0b11000000"
+#define KIND_DATE           5 // "2012-9-12"
+#define KIND_STRING         6
+#define KIND_DATA           7 // "<raw> - 0x86 41 3B" or "0x86 41 3B"
+#define KIND_VERSION        8 // "1.50"
+#define KIND_HEX            9 // "0x0A"
+#define KIND_STATUS_BYTE    10 // "0b0", upper byte of word
+
+#define MAC_FLAG 0x100 // command is a ManufacturerAccess command
+
+struct CaptureLabelStruct {
+    const char * Label;
+    uint16_t Command;
+    uint8_t Kind;
+};
+
+static const CaptureLabelStruct sCaptureLabels[] = {
+/*
+ * Static info
+ */
+{ "Chemistry", CELL_CHEM, KIND_STRING }, { "Manufacturer Name", MFG_NAME, KIND_STRING }, { "Manufacturer Data",
+MANUFACTURER_DATA, KIND_DATA }, { "Device Name", DEV_NAME, KIND_STRING }, { "Serial Number", SERIAL_NUM, KIND_NUMBER }, {
+        "Manufacture Date (YYYY-MM-DD)", MFG_DATE, KIND_DATE }, { "Design Capacity", DESIGN_CAPACITY, KIND_NUMBER }, {
+        "Design Voltage", DESIGN_VOLTAGE, KIND_VOLTAGE }, { "Charging Current", CHARGING_CURRENT, KIND_NUMBER }, {
+        "Charging Voltage", CHARGING_VOLTAGE, KIND_VOLTAGE }, { "Specification Info", SPEC_INFO, KIND_NUMBER }, { "Cycle Count",
+CYCLE_COUNT, KIND_NUMBER }, { "Max Error of charge calculation (%)", MAX_ERROR, KIND_NUMBER }, { "RemainingTimeAlarm",
+REMAINING_TIME_ALARM, KIND_TIME }, { "Remaining Capacity Alarm", REMAINING_CAPACITY_ALARM, KIND_NUMBER }, {
+        "Battery Mode (BIN)", BATTERY_MODE, KIND_BINARY }, { "Pack Status (BIN)", PACK_STATUS, KIND_BINARY },
+/*
+ * Manufacturer info
+ */
+{ "Device Type", MAC_FLAG | TI_Device_Type, KIND_NUMBER }, { "Firmware Version", MAC_FLAG | TI_Firmware_Version, KIND_VERSION }, {
+        "Hardware Version", MAC_FLAG | BQ20Z70_Hardware_Version, KIND_HEX }, { "End of Discharge Voltage Level", MAC_FLAG
+        | BQ2084_EDV_level, KIND_VOLTAGE }, { "Manufacturer Status (BIN)", MAC_FLAG | BQ20Z70_Manufacturer_Status,
+KIND_STATUS_BYTE }, { "Safety Status", BQ20Z70_SafetyStatus, KIND_BINARY }, { "Permanent Failure Status", BQ20Z70_PFStatus,
+KIND_BINARY }, { "Charging Status", BQ20Z70_ChargingStatus, KIND_BINARY }, { "Operation Status", BQ20Z70_OperationStatus,
+KIND_BINARY }, { "Pack Voltage", BQ20Z70_PackVoltage, KIND_VOLTAGE }, { "Average Voltage of last minute", BQ20Z70_AverageVoltage,
+KIND_VOLTAGE }, { "Sense Resistor (uOhm)", BQ20Z70_SenseResistor, KIND_NUMBER }, { "AFE Data", BQ20Z70_AFEData, KIND_DATA }, {
+        "Manufacturer Info", BQ20Z70_ManufacturerInfo, KIND_DATA },
+/*
+ * Rate and dynamic info
+ */
+{ "Can be delivered for 10 seconds at rate", AtRateOK, KIND_NUMBER }, { "Full Charge Capacity", FULL_CHARGE_CAPACITY,
+KIND_NUMBER }, { "Remaining Capacity", REMAINING_CAPACITY, KIND_NUMBER }, { "Relative Charge(%)", RELATIVE_SOC, KIND_NUMBER }, {
+        "Relative Charge", RELATIVE_SOC, KIND_NUMBER }, { "Absolute Charge(%)", ABSOLUTE_SOC, KIND_NUMBER }, {
+        "Minutes remaining until empty", RUN_TIME_TO_EMPTY, KIND_TIME }, { "Average minutes remaining until empty",
+AVERAGE_TIME_TO_EMPTY, KIND_TIME }, { "Minutes remaining for full charge", TIME_TO_FULL, KIND_TIME }, { "Battery Status (BIN)",
+BATTERY_STATUS, KIND_BINARY }, { "Voltage", VOLTAGE, KIND_VOLTAGE }, { "Current", CURRENT, KIND_NUMBER }, {
+        "Average Current of last minute", AverageCurrent, KIND_NUMBER }, { "Temperature", TEMPERATURE, KIND_TEMPERATURE }, {
+        "Cell 1 Voltage", CELL1_VOLTAGE, KIND_VOLTAGE }, { "Cell 2 Voltage", CELL2_VOLTAGE, KIND_VOLTAGE }, { "Cell 3 Voltage",
+CELL3_VOLTAGE, KIND_VOLTAGE }, { "Cell 4 Voltage", CELL4_VOLTAGE, KIND_VOLTAGE }, { "State of Health", STATE_OF_HEALTH,
+KIND_NUMBER } };
+
+static uint16_t parseValue(const char * aValue, uint8_t aKind) {
+    switch (aKind) {
+    case KIND_VOLTAGE:
+        return lround(atof(aValue) * 1000);
+    case KIND_TEMPERATURE:
+        return lround((atof(aValue) + 273.15) * 10);
+    case KIND_TIME:
+        if (strncmp(aValue, "Battery", 7) == 0) {
+            return 0xFFFF;
+        }
+        return strtol(aValue, NULL, 10);
+    case KIND_BINARY:
+    case KIND_STATUS_BYTE: {
+        if (strncmp(aValue, "0b", 2) == 0) {
+            aValue += 2;
+        }
+        uint16_t tValue = strtol(aValue, NULL, 2);
+        if (aKind == KIND_STATUS_BYTE) {
+            tValue <<= 8;
+        }
+        return tValue;
+    }
+    case KIND_DATE: {
+        int tYear = 1980, tMonth = 0, tDay = 0;
+        sscanf(aValue, "%d-%d-%d", &tYear, &tMonth, &tDay);
+        return ((tYear - 1980) << 9) | (tMonth << 5) | tDay;
+    }
+    case KIND_VERSION: {
+        char * tEnd;
+        uint16_t tMajor = strtol(aValue, &tEnd, 16);
+        uint16_t tMinor = 0;
+        if (*tEnd == '.') {
+            tMinor = strtol(tEnd + 1, NULL, 16);
+        }
+        return (tMajor << 8) | (tMinor & 0xFF);
+    }
+    case KIND_HEX:
+        return strtol(aValue, NULL, 16);
+    default:
+        // signed numbers are read as 16 bit two's complement
+        return (uint16_t) strtol(aValue, NULL, 10);
+    }
+}
+
+/*
+ * SimulatedSmartBattery
+ */
+SimulatedSmartBattery::SimulatedSmartBattery() {
+    for (int i = 0; i < 256; ++i) {
+        mWords[i] = 0xFFFF;
+        mWordValid[i] = false;
+    }
+}
+
+void SimulatedSmartBattery::setWord(uint8_t aCommand, uint16_t aValue) {
+    mWords[aCommand] = aValue;
+    mWordValid[aCommand] = true;
+}
+
+uint16_t SimulatedSmartBattery::getWord(uint8_t aCommand) {
+    return mWords[aCommand];
+}
+
+void SimulatedSmartBattery::setBlock(uint8_t aCommand, const std::string & aContent) {
+    mBlocks[aCommand] = aContent;
+}
+
+void SimulatedSmartBattery::setManufacturerAccessWord(uint16_t aCommand, uint16_t aValue) {
+    mManufacturerAccessWords[aCommand] = aValue;
+}
+
+/*
+ * @return true if line contained a known value
+ */
+bool SimulatedSmartBattery::parseCaptureLine(const std::string & aLine, bool aIsReplay) {
+    size_t tColonPosition = aLine.find(':');
+    if (tColonPosition == std::string::npos) {
+        return false;
+    }
+    std::string tLabel = aLine.substr(0, tColonPosition);
+    std::string tValue = aLine.substr(tColonPosition + 1);
+    if (!tValue.empty() && tValue[0] == ' ') {
+        tValue.erase(0, 1);
+    }
+
+    for (size_t i = 0; i < sizeof(sCaptureLabels) / sizeof(CaptureLabelStruct); ++i) {
+        const CaptureLabelStruct * tEntry = &sCaptureLabels[i];
+        if (tLabel != tEntry->Label) {
+            continue;
+        }
+        if (tEntry->Kind == KIND_STRING) {
+            setBlock(tEntry->Command, tValue);
+        } else if (tEntry->Kind == KIND_DATA) {
+            // use the hex representation, the raw data is not reliable in a text capture
+            std::string tData;
+            const char * tHex = NULL;
+            size_t tHexStart = tValue.rfind(" - 0x");
+            if (tHexStart != std::string::npos) {
+                tHex = tValue.c_str() + tHexStart + 5;
+            } else if (tValue.compare(0, 2, "0x") == 0) {
+                tHex = tValue.c_str() + 2;
+            }
+            if (tHex != NULL) {
+                char * tEnd;
+                while (true) {
+                    long tByte = strtol(tHex, &tEnd, 16);
+                    if (tEnd == tHex) {
+                        break;
+                    }
+                    tData += (char) tByte;
+                    tHex = tEnd;
+                }
+            }
+            setBlock(tEntry->Command, tData);
+        } else {
+            uint16_t tWord = parseValue(tValue.c_str(), tEntry->Kind);
+            if (tEntry->Command & MAC_FLAG) {
+                setManufacturerAccessWord(tEntry->Command & 0xFF, tWord);
+            } else if (aIsReplay) {
+                mReplay.push_back(std::make_pair((uint8_t) tEntry->Command, tWord));
+            } else {
+                setWord(tEntry->Command, tWord);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Reads a log generated by SBMInfo
+ */
+bool SimulatedSmartBattery::loadCapture(const char * aFilename) {
+    FILE * tFile = fopen(aFilename, "r");
+    if (tFile == NULL) {
+        return false;
+    }
+    Name = aFilename;
+    bool tIsReplay = false;
+    char tLine[256];
+    while (fgets(tLine, sizeof(tLine), tFile) != NULL) {
+        std::string tLineString(tLine);
+        while (!tLineString.empty() && (tLineString.back() == '\n' || tLineString.back() == '\r')) {
+            tLineString.pop_back();
+        }
+        if (tLineString.find("*** CHANGED VALUES ***") != std::string::npos) {
+            tIsReplay = true;
+            continue;
+        }
+        parseCaptureLine(tLineString, tIsReplay);
+    }
+    fclose(tFile);
+
+    /*
+     * Initialize model from the captured values
+     */
+    uint16_t tDesignVoltage = mWordValid[DESIGN_VOLTAGE] ? mWords[DESIGN_VOLTAGE] : 11100;
+    mNumberOfCells = (tDesignVoltage + 1800) / 3600;
+    if (mNumberOfCells == 0) {
+        mNumberOfCells = 1;
+    }
+    mRemainingCapacityMilliAmpereSeconds = (double) mWords[REMAINING_CAPACITY] * 3600;
+    std::map<uint16_t, uint16_t>::iterator tDeviceType = mManufacturerAccessWords.find(TI_Device_Type);
+    if (tDeviceType != mManufacturerAccessWords.end() && (tDeviceType->second == 0x0700 || tDeviceType->second == 0x0451)) {
+        initDataFlash();
+    }
+    if (tDeviceType != mManufacturerAccessWords.end() && tDeviceType->second == 0x4500) {
+        initManufacturerRecords();
+    }
+    return true;
+}
+
+static void appendWord(std::string & aRecord, uint16_t aWord) {
+    aRecord.push_back((char) (aWord & 0xFF));
+    aRecord.push_back((char) (aWord >> 8));
+}
+
+/*
+ * Records of the ManufacturerBlockAccess of a bq40z50 and its status blocks, which replace the status words of the capture
+ */
+void SimulatedSmartBattery::initManufacturerRecords() {
+    std::string tRecord;
+    // device number, version and build are big endian
+    uint16_t tVersion = mManufacturerAccessWords[TI_Firmware_Version];
+    const char tFirmwareVersion[] = { 0x45, 0x00, (char) (tVersion >> 8), (char) (tVersion & 0xFF), 0x00, 0x17, 0x00, 0x00, 0x00,
+            0x00, 0x00 };
+    mManufacturerAccessRecords[TI_Firmware_Version] = std::string(tFirmwareVersion, sizeof(tFirmwareVersion));
+    appendWord(tRecord, 0x0018); // FET_EN and GAUGE_EN
+    mManufacturerAccessRecords[BQ40Z50_ManufacturingStatus] = tRecord;
+    // maximum and minimum cell voltages, maximum delta cell voltage, charge and discharge current etc.
+    tRecord.clear();
+    for (uint8_t i = 0; i < 16; ++i) {
+        appendWord(tRecord, (i < 4) ? 4180 + i : (i < 8) ? 3010 - i : i * 11);
+    }
+    mManufacturerAccessRecords[BQ40Z50_LifetimeDataBlock1] = tRecord;
+
+    static const uint8_t sStatusBlocks[][2] = { { BQ40Z50_SafetyStatus, 4 }, { BQ40Z50_PFStatus, 4 }, { BQ40Z50_OperationStatus, 4 }, {
+            BQ40Z50_ChargingStatus, 3 }, { BQ40Z50_GaugingStatus, 3 } };
+    for (size_t i = 0; i < sizeof(sStatusBlocks) / sizeof(sStatusBlocks[0]); ++i) {
+        uint8_t tCommand = sStatusBlocks[i][0];
+        tRecord.clear();
+        appendWord(tRecord, mWordValid[tCommand] ? mWords[tCommand] : 0);
+        tRecord.resize(sStatusBlocks[i][1], '\0');
+        setBlock(tCommand, tRecord);
+    }
+    tRecord.clear();
+    for (uint8_t i = 0; i < 16; ++i) {
+        appendWord(tRecord, (i < mNumberOfCells) ? mWords[VOLTAGE] / mNumberOfCells : 0);
+    }
+    setBlock(BQ40Z50_DAStatus1, tRecord);
+}
+
+/*
+ * Subclass IDs and lengths like the data flash of a bq20z70, the content is a pattern
+ */
+#define LIFETIME_DATA_SUBCLASS_ID 59
+static const uint8_t sDataFlashSubclasses[][2] = { { 0, 22 }, { 1, 25 }, { 2, 10 }, { 3, 14 }, { 16, 25 }, { 17, 6 }, { 18, 10 },
+        { 19, 7 }, { 20, 5 }, { 21, 12 }, { 32, 10 }, { 33, 2 }, { 34, 15 }, { 36, 9 }, { 38, 14 }, { 48, 68 }, { 49, 14 }, { 56,
+                24 }, { 57, 20 }, { 58, 28 }, { LIFETIME_DATA_SUBCLASS_ID, 32 }, { 60, 14 }, { 64, 10 }, { 65, 3 }, { 66, 26 }, {
+                67, 5 }, { 68, 10 }, { 80, 68 }, { 81, 14 }, { 82, 40 }, { 88, 60 }, { 89, 60 }, { 90, 60 }, { 91, 60 }, { 92, 4 }, {
+                104, 20 }, { 105, 9 }, { 106, 18 }, { 107, 30 }, { 112, 28 } };
+
+void SimulatedSmartBattery::initDataFlash() {
+    for (size_t i = 0; i < sizeof(sDataFlashSubclasses) / sizeof(sDataFlashSubclasses[0]); ++i) {
+        uint8_t tSubclassID = sDataFlashSubclasses[i][0];
+        std::string tContent;
+        for (uint8_t j = 0; j < sDataFlashSubclasses[i][1]; ++j) {
+            tContent.push_back((char) (tSubclassID * 31 + j * 7));
+        }
+        mDataFlash[tSubclassID] = tContent;
+    }
+    // the lifetime data starts empty
+    mDataFlash[LIFETIME_DATA_SUBCLASS_ID] = std::string(32, '\0');
+}
+
+/*
+ * Lifetime data words: maximum and minimum voltage, maximum charge and discharge current
+ */
+void SimulatedSmartBattery::updateLifetimeData(uint16_t aVoltage, int16_t aCurrent) {
+    std::map<uint8_t, std::string>::iterator tIterator = mDataFlash.find(LIFETIME_DATA_SUBCLASS_ID);
+    if (tIterator == mDataFlash.end()) {
+        return;
+    }
+    std::string & tData = tIterator->second;
+    uint16_t tWords[4];
+    for (int i = 0; i < 4; ++i) {
+        tWords[i] = (uint8_t) tData[2 * i] | ((uint8_t) tData[2 * i + 1] << 8);
+    }
+    if (aVoltage > tWords[0]) {
+        tWords[0] = aVoltage;
+    }
+    if (aVoltage < tWords[1] || tWords[1] == 0) {
+        tWords[1] = aVoltage;
+    }
+    if (aCurrent > (int16_t) tWords[2]) {
+        tWords[2] = aCurrent;
+    }
+    if (-aCurrent > (int16_t) tWords[3]) {
+        tWords[3] = -aCurrent;
+    }
+    for (int i = 0; i < 4; ++i) {
+        tData[2 * i] = tWords[i] & 0xFF;
+        tData[2 * i + 1] = tWords[i] >> 8;
+    }
+}
+
+bool SimulatedSmartBattery::isDataFlashPageAvailable(uint8_t aCommand) {
+    std::map<uint8_t, std::string>::iterator tIterator = mDataFlash.find(mDataFlashSubclassID);
+    return tIterator != mDataFlash.end() && (size_t) (aCommand - BQ20Z70_DataFlashSubClassPage1) * 32 < tIterator->second.length();
+}
+
+/*
+ * Called once per simulated second while replay list is not empty
+ */
+void SimulatedSmartBattery::applyReplay() {
+    setWord(mReplay[mReplayIndex].first, mReplay[mReplayIndex].second);
+    mReplayIndex++;
+    if (mReplayIndex == mReplay.size()) {
+        mRemainingCapacityMilliAmpereSeconds = (double) mWords[REMAINING_CAPACITY] * 3600;
+    }
+}
+
+/*
+ * Simple linear (dis)charge model, open circuit voltage from 3.0 to 4.2 volt per cell
+ */
+void SimulatedSmartBattery::applyModel(uint32_t aSeconds) {
+    if (!mWordValid[FULL_CHARGE_CAPACITY] || mWords[FULL_CHARGE_CAPACITY] == 0) {
+        return;
+    }
+    if (!mModelInitialized) {
+        mModelInitialized = true;
+        mRandom = NoiseSeed;
+        // continue smoothly with the captured values
+        int tSOC = (mRemainingCapacityMilliAmpereSeconds / 36) / mWords[FULL_CHARGE_CAPACITY];
+        mVoltageOffset = mWords[VOLTAGE] - mNumberOfCells * (3000 + (1200 * tSOC) / 100);
+        mBaseCurrent = mWords[CURRENT];
+        mBaseTemperature = mWords[TEMPERATURE];
+    }
+
+    int16_t tCurrent = LoadCurrentOverride != 0 ? LoadCurrentOverride : mBaseCurrent;
+    if (Noise) {
+        mRandom = mRandom * 1103515245 + 12345;
+        tCurrent += (int) ((mRandom >> 16) % 7) - 3;
+    }
+    double tFullCapacity = (double) mWords[FULL_CHARGE_CAPACITY] * 3600;
+    mRemainingCapacityMilliAmpereSeconds += (double) tCurrent * aSeconds;
+    if (mRemainingCapacityMilliAmpereSeconds < 0) {
+        mRemainingCapacityMilliAmpereSeconds = 0;
+        tCurrent = 0;
+    } else if (mRemainingCapacityMilliAmpereSeconds > tFullCapacity) {
+        mRemainingCapacityMilliAmpereSeconds = tFullCapacity;
+        tCurrent = 0;
+    }
+
+    uint16_t tRemaining = mRemainingCapacityMilliAmpereSeconds / 3600;
+    uint16_t tRelativeSOC = (mRemainingCapacityMilliAmpereSeconds / 36) / mWords[FULL_CHARGE_CAPACITY];
+    setWord(REMAINING_CAPACITY, tRemaining);
+    setWord(RELATIVE_SOC, tRelativeSOC);
+    if (mWordValid[DESIGN_CAPACITY] && mWords[DESIGN_CAPACITY] != 0) {
+        setWord(ABSOLUTE_SOC, (mRemainingCapacityMilliAmpereSeconds / 36) / mWords[DESIGN_CAPACITY]);
+    }
+    setWord(CURRENT, tCurrent);
+    // exponential average over one minute
+    int16_t tAverageCurrent = (int16_t) mWords[AverageCurrent];
+    setWord(AverageCurrent, tAverageCurrent + (tCurrent - tAverageCurrent) / 60);
+    if (tCurrent < 0) {
+        setWord(RUN_TIME_TO_EMPTY, (tRemaining * 60L) / -tCurrent);
+        setWord(AVERAGE_TIME_TO_EMPTY, (tRemaining * 60L) / -tCurrent);
+        setWord(TIME_TO_FULL, 0xFFFF);
+    } else if (tCurrent > 0) {
+        setWord(RUN_TIME_TO_EMPTY, 0xFFFF);
+        setWord(AVERAGE_TIME_TO_EMPTY, 0xFFFF);
+        setWord(TIME_TO_FULL, ((mWords[FULL_CHARGE_CAPACITY] - tRemaining) * 60L) / tCurrent);
+    }
+
+    uint16_t tVoltage = mNumberOfCells * (3000 + (1200 * tRelativeSOC) / 100) + mVoltageOffset;
+    setWord(VOLTAGE, tVoltage);
+    updateLifetimeData(tVoltage, tCurrent);
+    for (uint8_t i = 0; i < mNumberOfCells && i < 4; ++i) {
+        if (mWordValid[CELL1_VOLTAGE - i] && mWords[CELL1_VOLTAGE - i] != 0) {
+            setWord(CELL1_VOLTAGE - i, tVoltage / mNumberOfCells);
+        }
+    }
+
+    if (Noise && mWordValid[TEMPERATURE]) {
+        mRandom = mRandom * 1103515245 + 12345;
+        setWord(TEMPERATURE, mBaseTemperature + (int) ((mRandom >> 16) % 3) - 1);
+    }
+
+    uint16_t tStatus = mWords[BATTERY_STATUS] & ~(DISCHARGING | FULLY_DISCHARGED | TERMINATE_DISCHARGE_ALARM
+            | REMAINING_CAPACITY_ALARM_FLAG);
+    if (tCurrent <= 0) {
+        tStatus |= DISCHARGING;
+    }
+    if (tRelativeSOC == 0) {
+        tStatus |= FULLY_DISCHARGED | TERMINATE_DISCHARGE_ALARM;
+    }
+    if (mWordValid[REMAINING_CAPACITY_ALARM] && tRemaining < mWords[REMAINING_CAPACITY_ALARM]) {
+        tStatus |= REMAINING_CAPACITY_ALARM_FLAG;
+    }
+    setWord(BATTERY_STATUS, tStatus);
+}
+
+/*
+ * Advance the pack state to the actual simulated time
+ */
+void SimulatedSmartBattery::update(uint64_t aNowMicros) {
+    uint64_t tNowSecond = aNowMicros / 1000000;
+    while (mLastUpdateSecond < tNowSecond) {
+        mLastUpdateSecond++;
+        if (mReplayIndex < mReplay.size()) {
+            applyReplay();
+        } else {
+            applyModel(1);
+        }
+    }
+}
+
+void SimulatedSmartBattery::insert(uint64_t aNowMicros) {
+    Inserted = true;
+    mLastUpdateSecond = aNowMicros / 1000000;
+}
+
+void SimulatedSmartBattery::startCondition(uint8_t aAddressAndDirection, bool aIsRepeatedStart) {
+    if (!aIsRepeatedStart) {
+        mPEC = 0;
+        mWriteIsValid = true;
+    }
+    mPEC = crc8Update(mPEC, aAddressAndDirection);
+    if (aAddressAndDirection & 0x01) {
+        startRead();
+    }
+}
+
+/*
+ * A wrong PEC of a word or block write is not acknowledged and the write is discarded.
+ * A data flash page command is not acknowledged if the selected subclass has no such page.
+ * ManufacturerBlockAccess is not acknowledged if the controller does not support it.
+ */
+bool SimulatedSmartBattery::writeByte(uint8_t aByte) {
+    mWriteBuffer.push_back(aByte);
+    if (mWriteBuffer.size() == 1 && !mDataFlash.empty() && aByte >= BQ20Z70_DataFlashSubClassPage1
+            && aByte <= BQ20Z70_DataFlashSubClassPage8 && !isDataFlashPageAvailable(aByte)) {
+        mWriteIsValid = false;
+        return false;
+    }
+    if (mWriteBuffer.size() == 1 && aByte == MANUFACTURER_BLOCK_ACCESS && mManufacturerAccessRecords.empty()) {
+        mWriteIsValid = false;
+        return false;
+    }
+    size_t tPECPosition = (mWriteBuffer[0] == MANUFACTURER_BLOCK_ACCESS && mWriteBuffer.size() > 1) ? 3 + mWriteBuffer[1] : 4;
+    if (PECSupported && mWriteBuffer.size() == tPECPosition && aByte != mPEC) {
+        mWriteIsValid = false;
+        return false;
+    }
+    mPEC = crc8Update(mPEC, aByte);
+    return true;
+}
+
+/*
+ * Prepare the response for the command written before the repeated start
+ */
+void SimulatedSmartBattery::startRead() {
+    mReadBuffer.clear();
+    mReadIndex = 0;
+    if (mWriteBuffer.empty()) {
+        return;
+    }
+    uint8_t tCommand = mWriteBuffer[0];
+    mWriteBuffer.clear();
+    if (mAtRateReadyMicros != 0 && hostGetMicros() >= mAtRateReadyMicros) {
+        setWord(AtRateTimeToFull, mAtRateTimeToFull);
+        setWord(AtRateTimeToEmpty, mAtRateTimeToEmpty);
+        mAtRateReadyMicros = 0;
+    }
+    if (tCommand == CURRENT && FirstCurrentReadMicros == 0) {
+        FirstCurrentReadMicros = hostGetMicros();
+    }
+
+    if (!mDataFlash.empty() && tCommand >= BQ20Z70_DataFlashSubClassPage1 && tCommand <= BQ20Z70_DataFlashSubClassPage8
+            && isDataFlashPageAvailable(tCommand)) {
+        std::string tPage = mDataFlash[mDataFlashSubclassID].substr((tCommand - BQ20Z70_DataFlashSubClassPage1) * 32, 32);
+        mReadBuffer.push_back(tPage.length());
+        mReadBuffer.insert(mReadBuffer.end(), tPage.begin(), tPage.end());
+    } else if (tCommand == MANUFACTURER_BLOCK_ACCESS && !mManufacturerAccessRecords.empty()) {
+        // the record starts with the command
+        std::string tRecord;
+        appendWord(tRecord, mManufacturerAccessCommand);
+        std::map<uint16_t, std::string>::iterator tIterator = mManufacturerAccessRecords.find(mManufacturerAccessCommand);
+        if (tIterator != mManufacturerAccessRecords.end()) {
+            tRecord += tIterator->second;
+        } else {
+            std::map<uint16_t, uint16_t>::iterator tWordIterator = mManufacturerAccessWords.find(mManufacturerAccessCommand);
+            appendWord(tRecord, (tWordIterator != mManufacturerAccessWords.end()) ? tWordIterator->second : 0xFFFF);
+        }
+        mReadBuffer.push_back(tRecord.length());
+        mReadBuffer.insert(mReadBuffer.end(), tRecord.begin(), tRecord.end());
+    } else if (!mBlocks[tCommand].empty()) {
+        mReadBuffer.push_back(mBlocks[tCommand].length());
+        mReadBuffer.insert(mReadBuffer.end(), mBlocks[tCommand].begin(), mBlocks[tCommand].end());
+    } else {
+        uint16_t tWord = mWords[tCommand];
+        if (tCommand == MANUFACTURER_ACCESS && mManufacturerAccessCommand != 0) {
+            std::map<uint16_t, uint16_t>::iterator tIterator = mManufacturerAccessWords.find(mManufacturerAccessCommand);
+            tWord = (tIterator != mManufacturerAccessWords.end()) ? tIterator->second : 0xFFFF;
+        }
+        mReadBuffer.push_back(tWord & 0xFF);
+        mReadBuffer.push_back(tWord >> 8);
+    }
+    if (PECSupported) {
+        mReadBuffer.push_back(crc8Update(mPEC, &mReadBuffer[0], mReadBuffer.size()));
+    }
+}
+
+uint8_t SimulatedSmartBattery::readByte() {
+    if (mReadIndex < mReadBuffer.size()) {
+        return mReadBuffer[mReadIndex++];
+    }
+    return 0xFF;
+}
+
+/*
+ * Process a written word
+ */
+void SimulatedSmartBattery::stop() {
+    if (mWriteBuffer.size() >= 3 && mWriteIsValid) {
+        uint8_t tCommand = mWriteBuffer[0];
+        uint16_t tValue = mWriteBuffer[1] | (mWriteBuffer[2] << 8);
+        if (tCommand == MANUFACTURER_ACCESS) {
+            mManufacturerAccessCommand = tValue;
+        } else if (tCommand == MANUFACTURER_BLOCK_ACCESS) {
+            if (mWriteBuffer.size() >= 4 && mWriteBuffer[1] == 2) {
+                mManufacturerAccessCommand = mWriteBuffer[2] | (mWriteBuffer[3] << 8);
+            }
+        } else if (tCommand == BQ20Z70_DataFlashSubClassID && !mDataFlash.empty()) {
+            mDataFlashSubclassID = tValue;
+        } else {
+            setWord(tCommand, tValue);
+            if (tCommand == AtRate) {
+                // the old results are read until the calculation is finished
+                int16_t tRate = tValue;
+                uint16_t tRemaining = mWords[REMAINING_CAPACITY];
+                mAtRateTimeToFull = tRate > 0 ? ((mWords[FULL_CHARGE_CAPACITY] - tRemaining) * 60L) / tRate : 0xFFFF;
+                mAtRateTimeToEmpty = tRate < 0 ? (tRemaining * 60L) / -tRate : 0xFFFF;
+                mAtRateReadyMicros = hostGetMicros() + AtRateCalculationMicros;
+            }
+        }
+    }
+    mWriteBuffer.clear();
+    mReadBuffer.clear();
+}
+
+/*
+ * SimulatedSMBus
+ */
+/*
+ * Probability of a bit error of a byte read from a pack above its maximum clock
+ */
+#define OVERCLOCK_BIT_ERROR_PROBABILITY 0.2
+
+/*
+ * Clock 0 means no time for the transfer
+ */
+void SimulatedSMBus::setClock(uint32_t aClockHz) {
+    mClockHz = aClockHz;
+    mBitMicrosTimes16 = (aClockHz == 0) ? 0 : (16 * 1000000UL) / aClockHz;
+}
+
+void SimulatedSMBus::attach(SimulatedSmartBattery * aBattery) {
+    mBatteries.push_back(aBattery);
+}
+
+void SimulatedSMBus::attach(SimulatedSmartBattery * aBattery, uint8_t aMuxAddress, uint8_t aMuxChannel) {
+    SimulatedMultiplexer * tMultiplexer = findMultiplexer(aMuxAddress);
+    if (tMultiplexer == NULL) {
+        SimulatedMultiplexer tNewMultiplexer;
+        tNewMultiplexer.Address = aMuxAddress;
+        tNewMultiplexer.ChannelMask = 0; // all channels disabled after power on
+        mMultiplexers.push_back(tNewMultiplexer);
+        tMultiplexer = &mMultiplexers.back();
+    }
+    tMultiplexer->Channels[aMuxChannel & 0x07].push_back(aBattery);
+}
+
+SimulatedSMBus::SimulatedMultiplexer * SimulatedSMBus::findMultiplexer(uint8_t aAddress) {
+    for (size_t i = 0; i < mMultiplexers.size(); ++i) {
+        if (mMultiplexers[i].Address == aAddress) {
+            return &mMultiplexers[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Searches the directly attached packs and then the enabled channels of all multiplexers
+ */
+SimulatedSmartBattery * SimulatedSMBus::findBattery(uint8_t aAddress) {
+    for (size_t i = 0; i < mBatteries.size(); ++i) {
+        if (mBatteries[i]->Address == aAddress && mBatteries[i]->Inserted) {
+            return mBatteries[i];
+        }
+    }
+    for (size_t i = 0; i < mMultiplexers.size(); ++i) {
+        for (uint8_t tChannel = 0; tChannel < 8; ++tChannel) {
+            if (mMultiplexers[i].ChannelMask & (1 << tChannel)) {
+                std::vector<SimulatedSmartBattery *> & tChannelBatteries = mMultiplexers[i].Channels[tChannel];
+                for (size_t j = 0; j < tChannelBatteries.size(); ++j) {
+                    if (tChannelBatteries[j]->Address == aAddress && tChannelBatteries[j]->Inserted) {
+                        return tChannelBatteries[j];
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Simple deterministic generator, results are reproducible for a given seed
+ */
+double SimulatedSMBus::random() {
+    if (mRandomState == 0) {
+        mRandomState = Seed ? Seed : 1;
+    }
+    mRandomState ^= mRandomState << 13;
+    mRandomState ^= mRandomState >> 17;
+    mRandomState ^= mRandomState << 5;
+    return (double) mRandomState / 4294967296.0;
+}
+
+void SimulatedSMBus::spendBits(uint32_t aNumberOfBits) {
+    spendMicros((aNumberOfBits * mBitMicrosTimes16) / 16);
+}
+
+void SimulatedSMBus::spendMicros(uint32_t aMicros) {
+    BusyMicros += aMicros;
+    if (DeferTime) {
+        mDeferredMicros += aMicros;
+    } else {
+        hostAdvanceMicros(aMicros);
+    }
+}
+
+void SimulatedSMBus::stretchClock() {
+    if (mActiveBattery != NULL) {
+        spendMicros(mActiveBattery->ClockStretchMicros);
+    }
+}
+
+uint32_t SimulatedSMBus::takeDeferredMicros() {
+    uint32_t tMicros = mDeferredMicros;
+    mDeferredMicros = 0;
+    return tMicros;
+}
+
+bool SimulatedSMBus::start(uint8_t aAddressAndDirection, bool aIsRepeatedStart) {
+    if (!aIsRepeatedStart) {
+        Transactions++;
+        if (TransactionLatencyMicros) {
+            spendMicros(TransactionLatencyMicros);
+        }
+    }
+    spendBits(aIsRepeatedStart ? 2 + 9 : 1 + 9);
+    BytesTransferred++;
+
+    SimulatedMultiplexer * tMultiplexer = findMultiplexer(aAddressAndDirection >> 1);
+    if (tMultiplexer != NULL) {
+        mActiveBattery = NULL;
+        if (NakProbability > 0 && random() < NakProbability) {
+            InjectedNaks++;
+            return false;
+        }
+        if (!aIsRepeatedStart) {
+            MuxTransactions++;
+        }
+        mActiveMultiplexer = tMultiplexer;
+        return true;
+    }
+    mActiveMultiplexer = NULL;
+
+    SimulatedSmartBattery * tBattery = findBattery(aAddressAndDirection >> 1);
+    if (tBattery == NULL) {
+        mActiveBattery = NULL;
+        return false;
+    }
+    if (NakProbability > 0 && random() < NakProbability) {
+        InjectedNaks++;
+        mActiveBattery = NULL;
+        return false;
+    }
+    if (tBattery->FirstAccessMicros == 0) {
+        tBattery->FirstAccessMicros = hostGetMicros();
+    }
+    if (tBattery != mActiveBattery) {
+        tBattery->update(hostGetMicros());
+    }
+    mActiveBattery = tBattery;
+    stretchClock();
+    tBattery->startCondition(aAddressAndDirection, aIsRepeatedStart);
+    return true;
+}
+
+bool SimulatedSMBus::write(uint8_t aValue) {
+    spendBits(9);
+    BytesTransferred++;
+    if (mActiveMultiplexer != NULL) {
+        mActiveMultiplexer->ChannelMask = aValue;
+        return true;
+    }
+    if (mActiveBattery == NULL) {
+        return false;
+    }
+    stretchClock();
+    return mActiveBattery->writeByte(aValue);
+}
+
+uint8_t SimulatedSMBus::read(bool aLast) {
+    (void) aLast;
+    spendBits(9);
+    BytesTransferred++;
+    if (mActiveMultiplexer != NULL) {
+        return mActiveMultiplexer->ChannelMask;
+    }
+    if (mActiveBattery == NULL) {
+        return 0xFF;
+    }
+    stretchClock();
+    uint8_t tValue = mActiveBattery->readByte();
+    double tBitErrorProbability = BitErrorProbability;
+    if (mClockHz > mActiveBattery->MaxClockHz) {
+        tBitErrorProbability += OVERCLOCK_BIT_ERROR_PROBABILITY;
+    }
+    if (tBitErrorProbability > 0 && random() < tBitErrorProbability) {
+        InjectedBitErrors++;
+        tValue ^= 1 << (uint8_t) (random() * 8);
+    }
+    return tValue;
+}
+
+void SimulatedSMBus::stop() {
+    spendBits(1);
+    mActiveMultiplexer = NULL;
+    if (mActiveBattery != NULL) {
+        mActiveBattery->stop();
+        mActiveBattery = NULL;
+    }
+}
+
+/*
+ * Emulation of the ATmega TWI peripheral in master mode.
+ * Writing TWCR with TWINT set executes the action on the simulated bus immediately,
+ * but the resulting status is visible and the interrupt is requested only after the simulated transfer time.
+ */
+HostTWIControlRegister TWCR;
+volatile uint8_t TWDR;
+volatile uint8_t TWSR = 0xF8;
+volatile uint8_t TWBR;
+
+static uint64_t sTWIEventMicros = UINT64_MAX;
+static uint8_t sTWIEventStatus;
+static uint8_t sTWIReceivedData;
+static bool sTWIIsBusOwner = false;
+static bool sTWIIsRepeatedStart;
+static bool sTWIAddressPending = false;
+static bool sTWIIsReceiving = false;
+
+static uint32_t getTWIClockHz() {
+    uint8_t tPrescalerExponent = 2 * (TWSR & (_BV(TWPS0) | _BV(TWPS1)));
+    return F_CPU / (16 + 2UL * TWBR * (1 << tPrescalerExponent));
+}
+
+HostTWIControlRegister & HostTWIControlRegister::operator =(uint8_t aValue) {
+    Value = aValue;
+    // writing a one to TWINT clears the flag and starts the next action
+    if (!(aValue & _BV(TWEN)) || !(aValue & _BV(TWINT))) {
+        return *this;
+    }
+    Value &= ~_BV(TWINT);
+    SimulatedBus.setClock(getTWIClockHz());
+    SimulatedBus.DeferTime = true;
+
+    if (aValue & _BV(TWSTO)) {
+        SimulatedBus.stop();
+        sTWIIsBusOwner = false;
+        Value &= ~_BV(TWSTO);
+    }
+    uint8_t tStatus;
+    if (aValue & _BV(TWSTA)) {
+        tStatus = sTWIIsBusOwner ? TW_REP_START : TW_START;
+        sTWIIsRepeatedStart = sTWIIsBusOwner;
+        sTWIIsBusOwner = true;
+        sTWIAddressPending = true;
+    } else if (aValue & _BV(TWSTO)) {
+        // STOP sets no TWINT, its time is added to the next action
+        SimulatedBus.DeferTime = false;
+        return *this;
+    } else if (sTWIAddressPending) {
+        sTWIAddressPending = false;
+        sTWIIsReceiving = TWDR & TW_READ;
+        bool tAck = SimulatedBus.start(TWDR, sTWIIsRepeatedStart);
+        if (sTWIIsReceiving) {
+            tStatus = tAck ? TW_MR_SLA_ACK : TW_MR_SLA_NACK;
+        } else {
+            tStatus = tAck ? TW_MT_SLA_ACK : TW_MT_SLA_NACK;
+        }
+    } else if (!sTWIIsReceiving) {
+        tStatus = SimulatedBus.write(TWDR) ? TW_MT_DATA_ACK : TW_MT_DATA_NACK;
+    } else {
+        bool tAck = aValue & _BV(TWEA);
+        sTWIReceivedData = SimulatedBus.read(!tAck);
+        tStatus = tAck ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+    }
+    SimulatedBus.DeferTime = false;
+    sTWIEventStatus = tStatus;
+    sTWIEventMicros = hostGetMicros() + SimulatedBus.takeDeferredMicros() + 1;
+    return *this;
+}
+
+uint64_t hostTWINextEventMicros(void) {
+    return sTWIEventMicros;
+}
+
+void hostTWIProcessEvent(void) {
+    sTWIEventMicros = UINT64_MAX;
+    TWSR = (TWSR & (_BV(TWPS0) | _BV(TWPS1))) | sTWIEventStatus;
+    if (sTWIEventStatus == TW_MR_DATA_ACK || sTWIEventStatus == TW_MR_DATA_NACK) {
+        TWDR = sTWIReceivedData;
+    }
+    TWCR.Value |= _BV(TWINT);
+    if (TWCR.Value & _BV(TWIE)) {
+        hostRequestTWIInterrupt();
+    }
+}
+
+SimulatedI2CPins SimulatedPins;
+
+int SimulatedI2CPins::read(uint8_t aPin) {
+    if (aPin == SDAPin) {
+        return mSDALevel;
+    }
+    if (aPin == SCLPin) {
+        return mSCLLevel;
+    }
+    return -1;
+}
+
+void SimulatedI2CPins::drive(uint8_t aPin, bool aPullLow) {
+    if (aPin == SDAPin) {
+        mMasterPullsSDALow = aPullLow;
+    } else if (aPin == SCLPin) {
+        mMasterPullsSCLLow = aPullLow;
+    } else {
+        return;
+    }
+    update();
+}
+
+/*
+ * The transfer time is already spent by the pin accesses
+ */
+void SimulatedI2CPins::startTransmitByte() {
+    SimulatedBus.DeferTime = true;
+    mByte = SimulatedBus.read(false);
+    SimulatedBus.DeferTime = false;
+    SimulatedBus.takeDeferredMicros();
+    mBitCount = 0;
+    mSlavePullsSDALow = !(mByte & 0x80);
+    mState = TRANSMIT_BYTE;
+}
+
+/*
+ * The slave samples SDA at the rising edge of SCL and changes SDA after the falling edge
+ */
+void SimulatedI2CPins::update() {
+    bool tSDALevel = !(mMasterPullsSDALow || mSlavePullsSDALow);
+    bool tSCLLevel = !mMasterPullsSCLLow;
+    bool tSDAChanged = tSDALevel != mSDALevel;
+    bool tSCLChanged = tSCLLevel != mSCLLevel;
+    mSDALevel = tSDALevel;
+    mSCLLevel = tSCLLevel;
+
+    if (tSCLLevel && !tSCLChanged && tSDAChanged) {
+        mSlavePullsSDALow = false;
+        if (!tSDALevel) {
+            // start or repeated start
+            mState = RECEIVE_BYTE;
+            mIsAddressByte = true;
+            mByte = 0;
+            mBitCount = 0;
+        } else {
+            // stop
+            if (mIsInTransaction) {
+                SimulatedBus.DeferTime = true;
+                SimulatedBus.stop();
+                SimulatedBus.DeferTime = false;
+                SimulatedBus.takeDeferredMicros();
+            }
+            mIsInTransaction = false;
+            mState = WAIT_FOR_START;
+        }
+    } else if (tSCLChanged && tSCLLevel) {
+        if (mState == RECEIVE_BYTE) {
+            mByte = (mByte << 1) | tSDALevel;
+            mBitCount++;
+        } else if (mState == RECEIVE_ACK) {
+            mMasterAcknowledged = !tSDALevel;
+        }
+    } else if (tSCLChanged) {
+        if (mState == RECEIVE_BYTE && mBitCount == 8) {
+            bool tAcknowledged;
+            SimulatedBus.DeferTime = true;
+            if (mIsAddressByte) {
+                tAcknowledged = SimulatedBus.start(mByte, mIsInTransaction);
+                mIsInTransaction = true;
+                mIsReading = mByte & 0x01;
+            } else {
+                tAcknowledged = SimulatedBus.write(mByte);
+            }
+            SimulatedBus.DeferTime = false;
+            SimulatedBus.takeDeferredMicros();
+            mSlavePullsSDALow = tAcknowledged;
+            mState = tAcknowledged ? SEND_ACK : WAIT_FOR_START;
+        } else if (mState == SEND_ACK) {
+            mSlavePullsSDALow = false;
+            if (mIsAddressByte && mIsReading) {
+                startTransmitByte();
+            } else {
+                mState = RECEIVE_BYTE;
+                mByte = 0;
+                mBitCount = 0;
+            }
+            mIsAddressByte = false;
+        } else if (mState == TRANSMIT_BYTE) {
+            mBitCount++;
+            if (mBitCount < 8) {
+                mSlavePullsSDALow = !(mByte & (0x80 >> mBitCount));
+            } else {
+                mSlavePullsSDALow = false;
+                mState = RECEIVE_ACK;
+            }
+        } else if (mState == RECEIVE_ACK) {
+            if (mMasterAcknowledged) {
+                startTransmitByte();
+            } else {
+                mState = WAIT_FOR_START;
+            }
+        }
+    }
+    // the slave may have changed SDA
+    mSDALevel = !(mMasterPullsSDALow || mSlavePullsSDALow);
+}
+
+int hostReadI2CPin(uint8_t aPin) {
+    return SimulatedPins.read(aPin);
+}
+
+void hostDriveI2CPin(uint8_t aPin, bool aPullLow) {
+    SimulatedPins.drive(aPin, aPullLow);
+}
+
+#endif // !defined(__AVR__)
@@ -0,0 +1,202 @@
+/*
+ * SBMSimulator.h
+ *
+ * Virtual Smart Battery and SMBus for running SBMInfo.cpp on a host.
+ *
+ * The register map of the virtual pack is loaded from a capture made with SBMInfo (see the .log files in extras).
+ * The values of the "CHANGED VALUES" section of the capture are replayed once per simulated second,
+ * afterwards a simple (dis)charge model continues with the current of the capture.
+ * A pack with a bq20z70 or bq20z45 device type gets a synthetic data flash, whose lifetime data subclass follows the model.
+ *
+ * The bus accounts the time of each transferred bit at the selected clock and a configurable latency per transaction
+ * and can inject NAKs and bit errors. A pack can stretch the clock after each byte and gets bit errors above its maximum clock.
+ * Packs can be attached directly or behind simulated TCA9548A I2C multiplexers, so many packs with the same address
+ * can be attached to one bus.
+ *
+ * The SoftI2CMaster replacement accesses the bus directly and spends the transfer time immediately.
+ * The emulation of the ATmega TWI peripheral accesses the bus when TWCR is written, but sets TWINT and calls the
+ * interrupt service routine only after the transfer time, so the sketch can do other things in between.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef HOST_SBMSIMULATOR_H_
+#define HOST_SBMSIMULATOR_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class SimulatedSmartBattery {
+public:
+    SimulatedSmartBattery();
+    bool loadCapture(const char * aFilename);
+    void setWord(uint8_t aCommand, uint16_t aValue);
+    uint16_t getWord(uint8_t aCommand);
+    void setBlock(uint8_t aCommand, const std::string & aContent);
+    void setManufacturerAccessWord(uint16_t aCommand, uint16_t aValue);
+
+    void update(uint64_t aNowMicros);
+    void insert(uint64_t aNowMicros); // for a pack attached later, the replay starts now
+
+    /*
+     * SMBus slave interface, called by SimulatedSMBus
+     */
+    void startCondition(uint8_t aAddressAndDirection, bool aIsRepeatedStart);
+    bool writeByte(uint8_t aByte);
+    uint8_t readByte();
+    void stop();
+
+    uint8_t Address = 0x0B;
+    bool PECSupported = false; // a PEC byte is appended to each read and checked for each word write
+    bool Noise = false; // add jitter to current and temperature after replay has finished
+    int LoadCurrentOverride = 0; // if != 0 replaces the current of the capture after replay has finished
+    uint32_t NoiseSeed = 4711; // different seeds give different noise for multiple packs
+    bool Inserted = true; // a removed pack does not answer
+    uint32_t MaxClockHz = 100000; // above this clock, bytes read from the pack get bit errors
+    uint32_t ClockStretchMicros = 0; // the pack holds the clock low after each byte
+    uint32_t AtRateCalculationMicros = 5000; // the results for a written AtRate are available after this time, like the bq2085
+    std::string Name;
+
+    // statistics for hot swap
+    uint64_t FirstAccessMicros = 0; // first transaction addressing the pack
+    uint64_t FirstCurrentReadMicros = 0; // first read of the current
+
+private:
+    void applyModel(uint32_t aSeconds);
+    void applyReplay();
+    void initDataFlash();
+    void initManufacturerRecords();
+    void updateLifetimeData(uint16_t aVoltage, int16_t aCurrent);
+    bool isDataFlashPageAvailable(uint8_t aCommand);
+    void startRead();
+    bool parseCaptureLine(const std::string & aLine, bool aIsReplay);
+
+    uint16_t mWords[256];
+    bool mWordValid[256];
+    std::string mBlocks[256];
+    std::map<uint16_t, uint16_t> mManufacturerAccessWords;
+    uint16_t mManufacturerAccessCommand = 0;
+    std::map<uint16_t, std::string> mManufacturerAccessRecords; // command -> record, empty if ManufacturerBlockAccess is not supported
+    uint64_t mAtRateReadyMicros = 0; // != 0 while the results for a written AtRate are calculated
+    uint16_t mAtRateTimeToFull = 0;
+    uint16_t mAtRateTimeToEmpty = 0;
+    std::map<uint8_t, std::string> mDataFlash; // subclass ID -> content, empty if the data flash can not be read
+    uint8_t mDataFlashSubclassID = 0;
+
+    std::vector<std::pair<uint8_t, uint16_t> > mReplay;
+    size_t mReplayIndex = 0;
+    uint64_t mLastUpdateSecond = 0;
+    double mRemainingCapacityMilliAmpereSeconds = 0;
+    bool mModelInitialized = false;
+    int mVoltageOffset = 0;
+    int16_t mBaseCurrent = 0;
+    uint16_t mBaseTemperature = 0;
+    uint8_t mNumberOfCells = 3;
+    uint32_t mRandom = 4711;
+
+    // transaction state
+    uint8_t mPEC = 0;
+    bool mWriteIsValid = true;
+    std::vector<uint8_t> mWriteBuffer;
+    std::vector<uint8_t> mReadBuffer;
+    size_t mReadIndex = 0;
+};
+
+class SimulatedSMBus {
+public:
+    void setClock(uint32_t aClockHz);
+    void attach(SimulatedSmartBattery * aBattery);
+    void attach(SimulatedSmartBattery * aBattery, uint8_t aMuxAddress, uint8_t aMuxChannel); // behind a TCA9548A multiplexer
+
+    bool start(uint8_t aAddressAndDirection, bool aIsRepeatedStart);
+    bool write(uint8_t aValue);
+    uint8_t read(bool aLast);
+    void stop();
+
+    // configuration
+    uint32_t TransactionLatencyMicros = 0; // added to each start condition, e.g. for clock stretching of the slave
+    double NakProbability = 0; // for address byte
+    double BitErrorProbability = 0; // for each byte read
+    uint32_t Seed = 1;
+    bool DeferTime = false; // used by the TWI emulation, the time of the transfer is accumulated instead of spent immediately
+
+    uint32_t takeDeferredMicros();
+
+    // statistics
+    uint32_t Transactions = 0;
+    uint32_t MuxTransactions = 0; // transactions addressing a multiplexer, included in Transactions
+    uint32_t BytesTransferred = 0;
+    uint32_t InjectedNaks = 0;
+    uint32_t InjectedBitErrors = 0;
+    uint64_t BusyMicros = 0;
+
+private:
+    void spendBits(uint32_t aNumberOfBits);
+    void spendMicros(uint32_t aMicros);
+    void stretchClock();
+    double random();
+    SimulatedSmartBattery * findBattery(uint8_t aAddress);
+
+    /*
+     * A write to a TCA9548A sets the mask of the enabled channels, a read returns it
+     */
+    struct SimulatedMultiplexer {
+        uint8_t Address;
+        uint8_t ChannelMask;
+        std::vector<SimulatedSmartBattery *> Channels[8];
+    };
+    SimulatedMultiplexer * findMultiplexer(uint8_t aAddress);
+
+    std::vector<SimulatedSmartBattery *> mBatteries;
+    std::vector<SimulatedMultiplexer> mMultiplexers;
+    SimulatedSmartBattery * mActiveBattery = NULL;
+    SimulatedMultiplexer * mActiveMultiplexer = NULL;
+    uint32_t mBitMicrosTimes16 = 16 * 10; // 100 kHz
+    uint32_t mClockHz = 100000;
+    uint32_t mRandomState = 0;
+    uint32_t mDeferredMicros = 0;
+};
+
+extern SimulatedSMBus SimulatedBus;
+
+/*
+ * Slave side of the simulated bus for a master which drives the lines with two digital pins, see DigitalPinI2CTransport.h.
+ * A line is low if the master or the slave pulls it low, otherwise its pull-up makes it high.
+ * The start and stop conditions and the bytes decoded from the line levels are passed to SimulatedBus.
+ * The time of the transfer is given by the pin accesses of the master, not by the clock of SimulatedBus.
+ */
+class SimulatedI2CPins {
+public:
+    int read(uint8_t aPin);
+    void drive(uint8_t aPin, bool aPullLow);
+
+    // configuration, the pins of the hardware TWI of an Uno
+    uint8_t SDAPin = 18;
+    uint8_t SCLPin = 19;
+
+private:
+    void update();
+    void startTransmitByte();
+
+    enum {
+        WAIT_FOR_START, RECEIVE_BYTE, SEND_ACK, TRANSMIT_BYTE, RECEIVE_ACK
+    } mState = WAIT_FOR_START;
+    bool mMasterPullsSDALow = false;
+    bool mMasterPullsSCLLow = false;
+    bool mSlavePullsSDALow = false;
+    bool mSDALevel = true;
+    bool mSCLLevel = true;
+    bool mIsInTransaction = false; // between start and stop, so the next start is a repeated start
+    bool mIsAddressByte = false;
+    bool mIsReading = false;
+    bool mMasterAcknowledged = false;
+    uint8_t mByte = 0;
+    uint8_t mBitCount = 0;
+};
+
+extern SimulatedI2CPins SimulatedPins;
+
+#endif /* HOST_SBMSIMULATOR_H_ */
@@ -0,0 +1,174 @@
+/*
+ * SBMTelemetryDecoder.cpp
+ *
+ * Converts the output of SBMInfo compiled with USE_BINARY_TELEMETRY back to the text report.
+ * The text printed by setup() is copied, the binary frames after TELEMETRY_START_LINE are printed
+ * with the value formatters of SBMInfo.cpp, so the report is the same as without USE_BINARY_TELEMETRY.
+ * A data flash image (see DataFlashImage.h) within the text is printed as one line of hex bytes per page.
+ *
+ * Build from the repository root with:
+ *   g++ -O2 -DUSE_BINARY_TELEMETRY -Iextras/host -Isrc src/SBMInfo.cpp extras/host/ArduinoHost.cpp extras/host/SBMSimulator.cpp extras/host/SBMTelemetryDecoder.cpp -o SBMTelemetryDecoder
+ *
+ * Usage:
+ *   ./SBMTelemetryDecoder [<file>]
+ *   ./SBMInfoHost -t 600 | ./SBMTelemetryDecoder
+ *   Reads from stdin if no file is given, e.g. a serial port. Statistics are printed to stderr.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+#if !defined(__AVR__)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Arduino.h"
+#include "SBMInfo.h"
+#include "BinaryTelemetry.h"
+#include "DataFlashImage.h"
+
+void printTelemetryValue(uint8_t aPackIndex, uint8_t aFunctionCode, uint16_t aValue, bool aOnlyStore);
+
+/*
+ * Reads the records up to the end record
+ * @return false if a record is invalid
+ */
+bool decodeDataFlashImage(FILE * aInput) {
+    uint8_t tBuffer[DATA_FLASH_MAX_RECORD_LENGTH];
+    uint8_t tLength = 0;
+    int tByte;
+    uint16_t tNumberOfPages = 0;
+    while ((tByte = fgetc(aInput)) != EOF) {
+        tBuffer[tLength++] = tByte;
+        uint8_t tSubclassID;
+        uint8_t tPage;
+        uint8_t tDataLength;
+        int tRecordLength = decodeDataFlashRecord(tBuffer, tLength, &tSubclassID, &tPage, &tDataLength);
+        if (tRecordLength < 0) {
+            printf("Invalid data flash record after %u pages\n", tNumberOfPages);
+            return false;
+        }
+        if (tRecordLength > 0) {
+            if (tSubclassID == DATA_FLASH_END_OF_IMAGE) {
+                printf("%u pages\n", tNumberOfPages);
+                return true;
+            }
+            printf("Subclass %u page %u: 0x", tSubclassID, tPage);
+            for (uint8_t i = 0; i < tDataLength; ++i) {
+                printf(i == 0 ? "%02X" : " %02X", tBuffer[4 + i]);
+            }
+            printf("\n");
+            tNumberOfPages++;
+            tLength = 0;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char * argv[]) {
+    FILE * tInput = stdin;
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        fprintf(stderr, "Usage: %s [<file>]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        tInput = fopen(argv[1], "rb");
+        if (tInput == NULL) {
+            fprintf(stderr, "Cannot open %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    /*
+     * Copy text until the start of the binary frames
+     */
+    char * tLine = NULL;
+    size_t tLineBufferSize = 0;
+    ssize_t tLineLength;
+    bool tBinaryStarted = false;
+    bool tDataFlashImageFound = false;
+    while ((tLineLength = getline(&tLine, &tLineBufferSize, tInput)) > 0) {
+        if (strncmp(tLine, TELEMETRY_START_LINE, strlen(TELEMETRY_START_LINE)) == 0) {
+            tBinaryStarted = true;
+            break;
+        }
+        if (strncmp(tLine, DATA_FLASH_START_LINE, strlen(DATA_FLASH_START_LINE)) == 0) {
+            printf("%s\n", DATA_FLASH_START_LINE);
+            decodeDataFlashImage(tInput);
+            tDataFlashImageFound = true;
+            continue;
+        }
+        // the line may contain raw data bytes, carriage returns are removed like by the serial output of SBMInfoHost
+        for (ssize_t i = 0; i < tLineLength; ++i) {
+            if (tLine[i] != '\r') {
+                putchar(tLine[i]);
+            }
+        }
+    }
+    free(tLine);
+    fflush(stdout);
+    if (!tBinaryStarted) {
+        if (tDataFlashImageFound) {
+            return 0;
+        }
+        fprintf(stderr, "No binary telemetry found\n");
+        return 1;
+    }
+
+    uint8_t tBuffer[TELEMETRY_MAX_FRAME_LENGTH];
+    uint8_t tLength = 0;
+    bool tOnlyStore = true;
+    uint64_t tMillis = 0;
+    uint32_t tFrames = 0;
+    uint32_t tInvalidFrames = 0;
+    uint32_t tSkippedBytes = 0;
+    uint32_t tBytes = 0;
+    int tByte;
+    while ((tByte = fgetc(tInput)) != EOF) {
+        tBytes++;
+        if (tLength == 0 && tByte != TELEMETRY_FRAME_START) {
+            tSkippedBytes++;
+            continue;
+        }
+        tBuffer[tLength++] = tByte;
+
+        while (tLength > 0) {
+            struct TelemetryFrameStruct tFrame;
+            int tFrameLength = decodeTelemetryFrame(tBuffer, tLength, &tFrame);
+            if (tFrameLength == 0 && tLength < TELEMETRY_MAX_FRAME_LENGTH) {
+                break; // wait for more bytes
+            }
+            uint8_t tConsumed;
+            if (tFrameLength <= 0) {
+                // resynchronize at the next frame start after the invalid start byte
+                tInvalidFrames++;
+                tConsumed = 1;
+                while (tConsumed < tLength && tBuffer[tConsumed] != TELEMETRY_FRAME_START) {
+                    tConsumed++;
+                }
+                tSkippedBytes += tConsumed;
+            } else {
+                tConsumed = tFrameLength;
+                tFrames++;
+                tMillis += tFrame.DeltaMillis;
+                if (tFrame.FunctionCode == TELEMETRY_END_OF_INITIAL_VALUES) {
+                    tOnlyStore = false;
+                } else {
+                    printTelemetryValue(tFrame.PackIndex, tFrame.FunctionCode, tFrame.Value, tOnlyStore);
+                }
+            }
+            tLength -= tConsumed;
+            memmove(tBuffer, &tBuffer[tConsumed], tLength);
+        }
+    }
+    fflush(stdout);
+
+    fprintf(stderr, "\nBinary bytes:             %u\n", tBytes);
+    fprintf(stderr, "Frames:                   %u, %.1f bytes per frame\n", tFrames, tFrames ? (double) tBytes / tFrames : 0);
+    fprintf(stderr, "Invalid frames:           %u, %u bytes skipped\n", tInvalidFrames, tSkippedBytes);
+    fprintf(stderr, "Duration:                 %.3f s\n", tMillis / 1000.0);
+    return 0;
+}
+
+#endif // !defined(__AVR__)
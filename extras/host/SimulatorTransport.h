@@ -0,0 +1,45 @@
+/*
+ * SimulatorTransport.h
+ *
+ * SMBus transport which accesses the simulated batteries of SBMSimulator.cpp directly, without the time of the bus transfer
+ * and without disabling interrupts. Gives the upper bound for the throughput of the sketch. See SMBus.h.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef HOST_SIMULATORTRANSPORT_H_
+#define HOST_SIMULATORTRANSPORT_H_
+
+#include "ByteLevelTransport.h"
+#include "SBMSimulator.h"
+
+class SimulatedBusAccess {
+public:
+    static bool start(uint8_t aAddressAndDirection) {
+        return SimulatedBus.start(aAddressAndDirection, false);
+    }
+    static bool repeatedStart(uint8_t aAddressAndDirection) {
+        return SimulatedBus.start(aAddressAndDirection, true);
+    }
+    static bool write(uint8_t aValue) {
+        return SimulatedBus.write(aValue);
+    }
+    static uint8_t read(bool aLast) {
+        return SimulatedBus.read(aLast);
+    }
+    static void stop() {
+        SimulatedBus.stop();
+    }
+};
+
+class SimulatorTransport: public ByteLevelTransport<SimulatedBusAccess> {
+public:
+    static bool init() {
+        // 0 = no transfer time
+        SimulatedBus.setClock(0);
+        return true;
+    }
+};
+
+#endif /* HOST_SIMULATORTRANSPORT_H_ */
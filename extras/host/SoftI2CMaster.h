@@ -0,0 +1,67 @@
+/*
+ * SoftI2CMaster.h
+ *
+ * Host replacement for the SoftI2CMaster library.
+ * Has the same API and honors the same configuration macros (I2C_SLOWMODE, I2C_FASTMODE, I2C_NOINTERRUPT),
+ * but routes all transfers to the simulated SMBus in SBMSimulator.cpp.
+ * Like the original, it must be included after the configuration macros.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef HOST_SOFTI2CMASTER_H_
+#define HOST_SOFTI2CMASTER_H_
+
+#include "Arduino.h"
+#include "SBMSimulator.h"
+
+#define I2C_READ 1
+#define I2C_WRITE 0
+
+#if defined(I2C_FASTMODE) && I2C_FASTMODE
+#define I2C_HOST_CLOCK_HZ 400000L
+#elif defined(I2C_SLOWMODE) && I2C_SLOWMODE
+#define I2C_HOST_CLOCK_HZ 25000L
+#else
+#define I2C_HOST_CLOCK_HZ 100000L
+#endif
+
+inline bool i2c_init(void) {
+    SimulatedBus.setClock(I2C_HOST_CLOCK_HZ);
+    return true;
+}
+
+inline bool i2c_start(uint8_t aAddressAndDirection) {
+#if defined(I2C_NOINTERRUPT) && I2C_NOINTERRUPT
+    cli();
+#endif
+    return SimulatedBus.start(aAddressAndDirection, false);
+}
+
+inline bool i2c_rep_start(uint8_t aAddressAndDirection) {
+    return SimulatedBus.start(aAddressAndDirection, true);
+}
+
+inline bool i2c_write(uint8_t aValue) {
+    return SimulatedBus.write(aValue);
+}
+
+inline uint8_t i2c_read(bool aLast) {
+    return SimulatedBus.read(aLast);
+}
+
+inline void i2c_stop(void) {
+    SimulatedBus.stop();
+#if defined(I2C_NOINTERRUPT) && I2C_NOINTERRUPT
+    sei();
+#endif
+}
+
+inline void i2c_start_wait(uint8_t aAddressAndDirection) {
+    while (!i2c_start(aAddressAndDirection)) {
+        i2c_stop();
+    }
+}
+
+#endif /* HOST_SOFTI2CMASTER_H_ */
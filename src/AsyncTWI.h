@@ -0,0 +1,452 @@
+/*
+ * AsyncTWI.h
+ *
+ * Interrupt driven SMBus master for the hardware TWI of the ATmega.
+ * Transactions are submitted to a queue and processed by the TWI interrupt, so the CPU is free
+ * for serial and LCD output during the bus transfer. On completion, the status of the transaction is set
+ * and the optional callback is called in interrupt context.
+ *
+ * Supported transactions are read word, write word, read block, quick command (address only, to check for a device)
+ * and read of a ManufacturerAccess word, which is a write word of the command to 0x00 followed by a read word from 0x00.
+ * A ManufacturerBlockAccess read is a block write of the command to 0x44 followed by a block read of the record from 0x44.
+ * If UsePEC of the transaction is true, PEC is appended to each write and read and checked.
+ * HardwareTWITransport at the end of this file is the SMBus transport for SMBus.h.
+ *
+ * Contains the interrupt service routine, so it must be included only once.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_ASYNCTWI_H_
+#define SRC_ASYNCTWI_H_
+
+#include <Arduino.h>
+#include <util/twi.h>
+#include "SBMInfo.h"
+#include "SMBus.h"
+#include "SMBusPEC.h"
+
+#if !defined(TWI_CLOCK_HZ)
+#define TWI_CLOCK_HZ 25000L // same as I2C_SLOWMODE of SoftI2CMaster
+#endif
+#if !defined(TWI_QUEUE_SIZE)
+#define TWI_QUEUE_SIZE 4
+#endif
+
+#define TWI_READ_WORD       0
+#define TWI_WRITE_WORD      1
+#define TWI_READ_BLOCK      2
+#define TWI_READ_MAC_WORD   3
+#define TWI_QUICK_COMMAND   4
+#define TWI_SEND_BYTE       5 // Command is the byte to send
+#define TWI_READ_MAC_BLOCK  6
+
+#define TWI_STATUS_PENDING      SMBUS_STATUS_PENDING
+#define TWI_STATUS_OK           SMBUS_STATUS_OK
+#define TWI_STATUS_NAK          SMBUS_STATUS_NAK // address or data not acknowledged
+#define TWI_STATUS_PEC_ERROR    SMBUS_STATUS_PEC_ERROR
+#define TWI_STATUS_BUS_ERROR    SMBUS_STATUS_BUS_ERROR
+
+struct TWITransactionStruct;
+typedef void (*TWICompletionCallback)(struct TWITransactionStruct * aTransaction);
+
+struct TWITransactionStruct {
+    uint8_t Type;
+    uint8_t Address;
+    uint8_t Command;
+    uint16_t Value; // value for write word, ManufacturerAccess command for read MAC word or block and result for read word
+    uint8_t * DataBuffer; // for read block and read MAC block
+    uint8_t DataBufferLength;
+    uint8_t LengthOfData; // result of read block, clipped to DataBufferLength
+    bool UsePEC;
+    volatile uint8_t Status;
+    TWICompletionCallback Callback; // if not NULL, called in interrupt context after completion
+};
+
+/*
+ * Queue of submitted transactions, the first one is the active one
+ */
+struct TWITransactionStruct * volatile sTWIQueue[TWI_QUEUE_SIZE];
+volatile uint8_t sTWIQueueHead; // index of active transaction
+volatile uint8_t sTWIQueueCount;
+
+/*
+ * State of the active transaction
+ */
+uint8_t sTWIWriteBuffer[4]; // command and up to 3 data bytes, PEC is sent after them
+uint8_t sTWIWriteLength;
+uint8_t sTWIWriteIndex;
+uint8_t sTWIReadBuffer[3]; // word and PEC
+uint8_t sTWIReadLength; // number of bytes to read including length and PEC byte
+uint8_t sTWIReadIndex;
+bool sTWIIsReadPhase;
+bool sTWIIsMACWritePhase; // first part of TWI_READ_MAC_WORD and TWI_READ_MAC_BLOCK
+bool sTWIUsePEC;
+uint8_t sTWIPEC;
+
+#define TWCR_CONTINUE   (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+#define TWCR_START      (_BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA))
+#define TWCR_STOP       (_BV(TWINT) | _BV(TWEN) | _BV(TWSTO))
+
+/*
+ * Must not be called while a transaction is active
+ */
+void twiSetClock(uint32_t aClockHz) {
+    uint16_t tBitRate = ((F_CPU / aClockHz) - 16) / 2;
+    if (tBitRate > 255) {
+        // prescaler 4
+        TWSR = _BV(TWPS0);
+        TWBR = tBitRate / 4;
+    } else {
+        TWSR = 0;
+        TWBR = tBitRate;
+    }
+}
+
+/*
+ * @return false if pullups are missing
+ */
+bool twiInit(void) {
+    // enable TWI (it may be powered down by PRR) and internal pullups
+#if defined(PRR)
+    PRR &= ~_BV(PRTWI);
+#endif
+    digitalWrite(SDA, HIGH);
+    digitalWrite(SCL, HIGH);
+    twiSetClock(TWI_CLOCK_HZ);
+    TWCR = _BV(TWEN);
+    sTWIQueueCount = 0;
+    return digitalRead(SDA) == HIGH && digitalRead(SCL) == HIGH;
+}
+
+void twiSetTransaction(struct TWITransactionStruct * aTransaction, uint8_t aType, uint8_t aAddress, uint8_t aCommand,
+        uint16_t aValue, bool aUsePEC) {
+    aTransaction->Type = aType;
+    aTransaction->Address = aAddress;
+    aTransaction->Command = aCommand;
+    aTransaction->Value = aValue;
+    aTransaction->DataBuffer = NULL;
+    aTransaction->DataBufferLength = 0;
+    aTransaction->LengthOfData = 0;
+    aTransaction->UsePEC = aUsePEC;
+    aTransaction->Callback = NULL;
+}
+
+/*
+ * Prepare the write buffer for the active transaction and generate the start condition
+ */
+void twiStartTransaction(struct TWITransactionStruct * aTransaction) {
+    sTWIIsReadPhase = false;
+    sTWIWriteIndex = 0;
+    sTWIReadIndex = 0;
+    sTWIUsePEC = aTransaction->UsePEC;
+    sTWIIsMACWritePhase = (aTransaction->Type == TWI_READ_MAC_WORD || aTransaction->Type == TWI_READ_MAC_BLOCK);
+    if (aTransaction->Type == TWI_READ_MAC_BLOCK) {
+        sTWIWriteBuffer[0] = MANUFACTURER_BLOCK_ACCESS;
+        sTWIWriteBuffer[1] = 2; // block length
+        sTWIWriteBuffer[2] = aTransaction->Value;
+        sTWIWriteBuffer[3] = aTransaction->Value >> 8;
+        sTWIWriteLength = 4;
+        sTWIReadLength = 0;
+    } else if (aTransaction->Type == TWI_WRITE_WORD || sTWIIsMACWritePhase) {
+        sTWIWriteBuffer[0] = sTWIIsMACWritePhase ? MANUFACTURER_ACCESS : aTransaction->Command;
+        sTWIWriteBuffer[1] = aTransaction->Value;
+        sTWIWriteBuffer[2] = aTransaction->Value >> 8;
+        sTWIWriteLength = 3;
+        sTWIReadLength = 0;
+    } else if (aTransaction->Type == TWI_QUICK_COMMAND) {
+        sTWIWriteLength = 0;
+        sTWIReadLength = 0;
+    } else if (aTransaction->Type == TWI_SEND_BYTE) {
+        sTWIWriteBuffer[0] = aTransaction->Command;
+        sTWIWriteLength = 1;
+        sTWIReadLength = 0;
+    } else {
+        sTWIWriteBuffer[0] = aTransaction->Command;
+        sTWIWriteLength = 1;
+        // length of block is not known yet, it is set after reading the first byte which must be acknowledged
+        sTWIReadLength = 2;
+        if (sTWIUsePEC) {
+            sTWIReadLength++;
+        }
+    }
+    TWCR = TWCR_START;
+}
+
+/*
+ * Called with interrupts disabled
+ */
+void twiCompleteTransaction(uint8_t aStatus) {
+    struct TWITransactionStruct * tTransaction = sTWIQueue[sTWIQueueHead];
+    TWCR = TWCR_STOP;
+    // STOP condition is executed within some microseconds
+    while (TWCR & _BV(TWSTO)) {
+        ;
+    }
+    if (aStatus == TWI_STATUS_OK && sTWIIsMACWritePhase) {
+        // now read the result word from ManufacturerAccess or the record from ManufacturerBlockAccess
+        sTWIIsMACWritePhase = false;
+        sTWIIsReadPhase = false;
+        sTWIWriteBuffer[0] = (tTransaction->Type == TWI_READ_MAC_BLOCK) ? MANUFACTURER_BLOCK_ACCESS : MANUFACTURER_ACCESS;
+        sTWIWriteLength = 1;
+        sTWIWriteIndex = 0;
+        sTWIReadLength = sTWIUsePEC ? 3 : 2; // for a block, it is set after reading the length byte
+        sTWIReadIndex = 0;
+        TWCR = TWCR_START;
+        return;
+    }
+
+    if (aStatus == TWI_STATUS_OK && tTransaction->Type != TWI_WRITE_WORD && tTransaction->Type != TWI_QUICK_COMMAND
+            && tTransaction->Type != TWI_SEND_BYTE) {
+        if (tTransaction->Type == TWI_READ_BLOCK || tTransaction->Type == TWI_READ_MAC_BLOCK) {
+            tTransaction->LengthOfData = (sTWIReadBuffer[0] > tTransaction->DataBufferLength) ?
+                    tTransaction->DataBufferLength : sTWIReadBuffer[0];
+        } else {
+            tTransaction->Value = sTWIReadBuffer[0] | (sTWIReadBuffer[1] << 8);
+        }
+    }
+
+    tTransaction->Status = aStatus;
+    if (tTransaction->Callback != NULL) {
+        tTransaction->Callback(tTransaction);
+    }
+    sTWIQueueHead = (sTWIQueueHead + 1) % TWI_QUEUE_SIZE;
+    sTWIQueueCount--;
+    if (sTWIQueueCount > 0) {
+        twiStartTransaction(sTWIQueue[sTWIQueueHead]);
+    }
+}
+
+/*
+ * Store a received byte. The first byte of a block read determines the number of bytes to read.
+ */
+void twiStoreReceivedByte(struct TWITransactionStruct * aTransaction, uint8_t aData) {
+    sTWIPEC = crc8Update(sTWIPEC, aData);
+    if (aTransaction->Type == TWI_READ_BLOCK || aTransaction->Type == TWI_READ_MAC_BLOCK) {
+        if (sTWIReadIndex == 0) {
+            sTWIReadBuffer[0] = aData;
+            sTWIReadLength = 1 + aData + (sTWIUsePEC ? 1 : 0);
+        } else if (sTWIReadIndex <= aTransaction->DataBufferLength) {
+            aTransaction->DataBuffer[sTWIReadIndex - 1] = aData;
+        }
+    } else if (sTWIReadIndex < sizeof(sTWIReadBuffer)) {
+        sTWIReadBuffer[sTWIReadIndex] = aData;
+    }
+    sTWIReadIndex++;
+}
+
+ISR(TWI_vect) {
+    struct TWITransactionStruct * tTransaction = sTWIQueue[sTWIQueueHead];
+    switch (TW_STATUS) {
+    case TW_START:
+        sTWIPEC = 0;
+        // falls through
+    case TW_REP_START:
+        TWDR = (tTransaction->Address << 1) | (sTWIIsReadPhase ? TW_READ : TW_WRITE);
+        sTWIPEC = crc8Update(sTWIPEC, TWDR);
+        TWCR = TWCR_CONTINUE;
+        break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+        if (sTWIWriteIndex < sTWIWriteLength) {
+            TWDR = sTWIWriteBuffer[sTWIWriteIndex++];
+            sTWIPEC = crc8Update(sTWIPEC, TWDR);
+            TWCR = TWCR_CONTINUE;
+        } else if (sTWIWriteIndex == sTWIWriteLength && sTWIWriteLength > 0 && sTWIReadLength == 0 && sTWIUsePEC) {
+            sTWIWriteIndex++;
+            TWDR = sTWIPEC;
+            TWCR = TWCR_CONTINUE;
+        } else if (sTWIReadLength > 0) {
+            sTWIIsReadPhase = true;
+            TWCR = TWCR_START; // repeated start
+        } else {
+            twiCompleteTransaction(TWI_STATUS_OK);
+        }
+        break;
+
+    case TW_MR_SLA_ACK:
+        // acknowledge all but the last byte
+        TWCR = (sTWIReadLength > 1) ? (TWCR_CONTINUE | _BV(TWEA)) : TWCR_CONTINUE;
+        break;
+
+    case TW_MR_DATA_ACK:
+    case TW_MR_DATA_NACK: {
+        uint8_t tData = TWDR;
+        bool tIsPECByte = sTWIUsePEC && sTWIReadIndex == sTWIReadLength - 1;
+        if (tIsPECByte) {
+            sTWIReadIndex++;
+            if (tData != sTWIPEC) {
+                twiCompleteTransaction(TWI_STATUS_PEC_ERROR);
+                break;
+            }
+        } else {
+            twiStoreReceivedByte(tTransaction, tData);
+        }
+        if (sTWIReadIndex < sTWIReadLength && TW_STATUS == TW_MR_DATA_ACK) {
+            TWCR = (sTWIReadLength - sTWIReadIndex > 1) ? (TWCR_CONTINUE | _BV(TWEA)) : TWCR_CONTINUE;
+        } else {
+            twiCompleteTransaction(TWI_STATUS_OK);
+        }
+        break;
+    }
+
+    case TW_MT_DATA_NACK:
+        // a wrong PEC of a write is not acknowledged
+        twiCompleteTransaction((sTWIUsePEC && sTWIWriteIndex > sTWIWriteLength) ? TWI_STATUS_PEC_ERROR : TWI_STATUS_NAK);
+        break;
+
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+        twiCompleteTransaction(TWI_STATUS_NAK);
+        break;
+
+    default:
+        // arbitration lost or bus error
+        twiCompleteTransaction(TWI_STATUS_BUS_ERROR);
+        break;
+    }
+}
+
+/*
+ * Appends transaction to queue and starts it if bus is idle.
+ * @return false if queue is full
+ */
+bool twiSubmit(struct TWITransactionStruct * aTransaction) {
+    aTransaction->Status = TWI_STATUS_PENDING;
+    uint8_t tOldSREG = SREG;
+    cli();
+    if (sTWIQueueCount >= TWI_QUEUE_SIZE) {
+        SREG = tOldSREG;
+        return false;
+    }
+    sTWIQueue[(sTWIQueueHead + sTWIQueueCount) % TWI_QUEUE_SIZE] = aTransaction;
+    sTWIQueueCount++;
+    if (sTWIQueueCount == 1) {
+        twiStartTransaction(aTransaction);
+    }
+    SREG = tOldSREG;
+    return true;
+}
+
+bool twiIsIdle(void) {
+    return sTWIQueueCount == 0;
+}
+
+/*
+ * Synchronous transfer
+ */
+uint8_t twiSubmitAndWait(struct TWITransactionStruct * aTransaction) {
+    while (!twiSubmit(aTransaction)) {
+        yield();
+    }
+    while (aTransaction->Status == TWI_STATUS_PENDING) {
+        yield();
+    }
+    return aTransaction->Status;
+}
+
+/*
+ * SMBus transport for SMBus.h. All functions except startReadWord() wait for completion.
+ */
+struct TWITransactionStruct sTWIStartedReadTransaction;
+
+class HardwareTWITransport {
+public:
+    static bool init() {
+        return twiInit();
+    }
+
+    /*
+     * Waits until a started read is finished
+     */
+    static void setClock(uint32_t aClockHz) {
+        while (!twiIsIdle()) {
+            yield();
+        }
+        twiSetClock(aClockHz);
+    }
+
+    static uint8_t quickCommand(uint8_t aAddress) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_QUICK_COMMAND, aAddress, 0, 0, false);
+        return twiSubmitAndWait(&tTransaction);
+    }
+
+    static uint8_t sendByte(uint8_t aAddress, uint8_t aValue) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_SEND_BYTE, aAddress, aValue, 0, false);
+        return twiSubmitAndWait(&tTransaction);
+    }
+
+    static uint8_t readWord(uint8_t aAddress, uint8_t aCommand, uint16_t * aValue, bool aUsePEC) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_READ_WORD, aAddress, aCommand, 0, aUsePEC);
+        uint8_t tStatus = twiSubmitAndWait(&tTransaction);
+        // like SoftI2CMaster, return 0xFFFF if pack does not respond
+        *aValue = (tStatus == TWI_STATUS_OK) ? tTransaction.Value : 0xFFFF;
+        return tStatus;
+    }
+
+    static uint8_t writeWord(uint8_t aAddress, uint8_t aCommand, uint16_t aValue, bool aUsePEC) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_WRITE_WORD, aAddress, aCommand, aValue, aUsePEC);
+        return twiSubmitAndWait(&tTransaction);
+    }
+
+    /*
+     * Write and read are queued as one transaction
+     */
+    static uint8_t readManufacturerAccessWord(uint8_t aAddress, uint16_t aCommand, uint16_t * aValue, bool aUsePEC) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_READ_MAC_WORD, aAddress, MANUFACTURER_ACCESS, aCommand, aUsePEC);
+        uint8_t tStatus = twiSubmitAndWait(&tTransaction);
+        *aValue = (tStatus == TWI_STATUS_OK) ? tTransaction.Value : 0xFFFF;
+        return tStatus;
+    }
+
+    static uint8_t readBlock(uint8_t aAddress, uint8_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength,
+            uint8_t * aLengthOfData, bool aUsePEC) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_READ_BLOCK, aAddress, aCommand, 0, aUsePEC);
+        tTransaction.DataBuffer = aDataBuffer;
+        tTransaction.DataBufferLength = aDataBufferLength;
+        uint8_t tStatus = twiSubmitAndWait(&tTransaction);
+        *aLengthOfData = (tStatus == TWI_STATUS_OK) ? tTransaction.LengthOfData : 0;
+        return tStatus;
+    }
+
+    /*
+     * Write and read are queued as one transaction
+     */
+    static uint8_t readManufacturerAccessBlock(uint8_t aAddress, uint16_t aCommand, uint8_t * aDataBuffer,
+            uint8_t aDataBufferLength, uint8_t * aLengthOfData, bool aUsePEC) {
+        struct TWITransactionStruct tTransaction;
+        twiSetTransaction(&tTransaction, TWI_READ_MAC_BLOCK, aAddress, MANUFACTURER_BLOCK_ACCESS, aCommand, aUsePEC);
+        tTransaction.DataBuffer = aDataBuffer;
+        tTransaction.DataBufferLength = aDataBufferLength;
+        uint8_t tStatus = twiSubmitAndWait(&tTransaction);
+        *aLengthOfData = (tStatus == TWI_STATUS_OK) ? tTransaction.LengthOfData : 0;
+        return tStatus;
+    }
+
+    /*
+     * The transfer runs in the background
+     */
+    static bool startReadWord(uint8_t aAddress, uint8_t aCommand, bool aUsePEC) {
+        if (sTWIStartedReadTransaction.Status == TWI_STATUS_PENDING && !twiIsIdle()) {
+            return false;
+        }
+        twiSetTransaction(&sTWIStartedReadTransaction, TWI_READ_WORD, aAddress, aCommand, 0, aUsePEC);
+        return twiSubmit(&sTWIStartedReadTransaction);
+    }
+
+    static uint8_t getStartedReadWordResult(uint16_t * aValue) {
+        uint8_t tStatus = sTWIStartedReadTransaction.Status;
+        *aValue = (tStatus == TWI_STATUS_OK) ? sTWIStartedReadTransaction.Value : 0xFFFF;
+        return tStatus;
+    }
+};
+
+#endif /* SRC_ASYNCTWI_H_ */
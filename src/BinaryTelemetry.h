@@ -0,0 +1,145 @@
+/*
+ * BinaryTelemetry.h
+ *
+ * Compact binary frames for the changed register values instead of formatted text.
+ *
+ * Frame:
+ *   TELEMETRY_FRAME_START
+ *   varint milliseconds since the previous frame
+ *   function code, bit 7 set if the pack index follows
+ *   [pack index]
+ *   varint raw register value
+ *   CRC-8 over all bytes after TELEMETRY_FRAME_START, same polynomial as the SMBus PEC
+ *
+ * A varint stores 7 bits per byte, least significant group first, bit 7 set if more bytes follow.
+ * A typical frame has 6 bytes instead of the 20 to 50 bytes of the text line.
+ * The receiver searches for TELEMETRY_FRAME_START and discards frames with wrong CRC.
+ * See extras/host/SBMTelemetryDecoder.cpp for the decoder.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_BINARYTELEMETRY_H_
+#define SRC_BINARYTELEMETRY_H_
+
+#include <stdint.h>
+#include "SMBusPEC.h"
+
+#define TELEMETRY_FRAME_START           0x7E
+#define TELEMETRY_PACK_INDEX_FOLLOWS    0x80
+#define TELEMETRY_NO_PACK_INDEX         0xFF
+#define TELEMETRY_MAX_FRAME_LENGTH      (1 + 5 + 1 + 1 + 3 + 1)
+
+/*
+ * Marker line after which the binary frames start
+ */
+#define TELEMETRY_START_LINE "*** BINARY TELEMETRY ***"
+
+/*
+ * The frames before this function code contain the design voltage, the capacity mode
+ * and the initial values of the polled registers. They are not printed by the decoder.
+ */
+#define TELEMETRY_END_OF_INITIAL_VALUES 0x7F
+
+/*
+ * @return number of bytes written
+ */
+inline uint8_t writeVarint(uint8_t * aBuffer, uint32_t aValue) {
+    uint8_t tLength = 0;
+    while (aValue >= 0x80) {
+        aBuffer[tLength++] = (aValue & 0x7F) | 0x80;
+        aValue >>= 7;
+    }
+    aBuffer[tLength++] = aValue;
+    return tLength;
+}
+
+/*
+ * @return number of bytes read or 0 if aLength is too short or the varint is longer than 5 bytes
+ */
+inline uint8_t readVarint(const uint8_t * aBuffer, uint8_t aLength, uint32_t * aValue) {
+    uint32_t tValue = 0;
+    for (uint8_t i = 0; i < aLength && i < 5; ++i) {
+        tValue |= (uint32_t) (aBuffer[i] & 0x7F) << (7 * i);
+        if ((aBuffer[i] & 0x80) == 0) {
+            *aValue = tValue;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * @param aPackIndex - TELEMETRY_NO_PACK_INDEX if only one pack is monitored
+ * @return length of frame
+ */
+inline uint8_t encodeTelemetryFrame(uint8_t * aBuffer, uint32_t aDeltaMillis, uint8_t aPackIndex, uint8_t aFunctionCode,
+        uint16_t aValue) {
+    uint8_t tLength = 0;
+    aBuffer[tLength++] = TELEMETRY_FRAME_START;
+    tLength += writeVarint(&aBuffer[tLength], aDeltaMillis);
+    if (aPackIndex == TELEMETRY_NO_PACK_INDEX) {
+        aBuffer[tLength++] = aFunctionCode;
+    } else {
+        aBuffer[tLength++] = aFunctionCode | TELEMETRY_PACK_INDEX_FOLLOWS;
+        aBuffer[tLength++] = aPackIndex;
+    }
+    tLength += writeVarint(&aBuffer[tLength], aValue);
+    aBuffer[tLength] = crc8Update(0, &aBuffer[1], tLength - 1);
+    return tLength + 1;
+}
+
+struct TelemetryFrameStruct {
+    uint32_t DeltaMillis;
+    uint8_t PackIndex; // TELEMETRY_NO_PACK_INDEX if not contained in frame
+    uint8_t FunctionCode;
+    uint16_t Value;
+};
+
+/*
+ * @param aBuffer - starts with TELEMETRY_FRAME_START
+ * @return length of the decoded frame, 0 if more bytes are required, -1 if frame is invalid
+ */
+inline int decodeTelemetryFrame(const uint8_t * aBuffer, uint8_t aLength, struct TelemetryFrameStruct * aFrame) {
+    uint8_t tIndex = 1;
+    uint32_t tValue;
+    uint8_t tVarintLength = readVarint(&aBuffer[tIndex], aLength - tIndex, &tValue);
+    if (tVarintLength == 0) {
+        return (aLength - tIndex >= 5) ? -1 : 0;
+    }
+    aFrame->DeltaMillis = tValue;
+    tIndex += tVarintLength;
+
+    if (tIndex >= aLength) {
+        return 0;
+    }
+    aFrame->FunctionCode = aBuffer[tIndex] & ~TELEMETRY_PACK_INDEX_FOLLOWS;
+    aFrame->PackIndex = TELEMETRY_NO_PACK_INDEX;
+    if (aBuffer[tIndex++] & TELEMETRY_PACK_INDEX_FOLLOWS) {
+        if (tIndex >= aLength) {
+            return 0;
+        }
+        aFrame->PackIndex = aBuffer[tIndex++];
+    }
+
+    tVarintLength = readVarint(&aBuffer[tIndex], aLength - tIndex, &tValue);
+    if (tVarintLength == 0) {
+        return (aLength - tIndex >= 5) ? -1 : 0;
+    }
+    if (tValue > 0xFFFF) {
+        return -1;
+    }
+    aFrame->Value = tValue;
+    tIndex += tVarintLength;
+
+    if (tIndex >= aLength) {
+        return 0;
+    }
+    if (aBuffer[tIndex] != crc8Update(0, &aBuffer[1], tIndex - 1)) {
+        return -1;
+    }
+    return tIndex + 1;
+}
+
+#endif /* SRC_BINARYTELEMETRY_H_ */
@@ -0,0 +1,212 @@
+/*
+ * ByteLevelTransport.h
+ *
+ * SMBus transport for masters which are controlled byte by byte like SoftI2CMaster. See SMBus.h.
+ * Bus is a class with the static functions start(), repeatedStart(), write(), read() and stop()
+ * with the semantics of the corresponding SoftI2CMaster functions.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_BYTELEVELTRANSPORT_H_
+#define SRC_BYTELEVELTRANSPORT_H_
+
+#include "SBMInfo.h"
+#include "SMBus.h"
+#include "SMBusPEC.h"
+
+template<class Bus>
+class ByteLevelTransport {
+public:
+    static uint8_t quickCommand(uint8_t aAddress) {
+        bool tOK = Bus::start((aAddress << 1) | SMBUS_WRITE);
+        Bus::stop();
+        return tOK ? SMBUS_STATUS_OK : SMBUS_STATUS_NAK;
+    }
+
+    static uint8_t sendByte(uint8_t aAddress, uint8_t aValue) {
+        if (!Bus::start((aAddress << 1) | SMBUS_WRITE)) {
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+        bool tOK = Bus::write(aValue);
+        Bus::stop();
+        return tOK ? SMBUS_STATUS_OK : SMBUS_STATUS_NAK;
+    }
+
+    static uint8_t readWord(uint8_t aAddress, uint8_t aCommand, uint16_t * aValue, bool aUsePEC) {
+        if (!Bus::start((aAddress << 1) | SMBUS_WRITE)) {
+            Bus::stop();
+            *aValue = 0xFFFF;
+            return SMBUS_STATUS_NAK;
+        }
+        if (!Bus::write(aCommand) || !Bus::repeatedStart((aAddress << 1) | SMBUS_READ)) {
+            Bus::stop();
+            *aValue = 0xFFFF;
+            return SMBUS_STATUS_NAK;
+        }
+        uint8_t tLSB = Bus::read(false);
+        uint8_t tMSB = Bus::read(!aUsePEC);
+        *aValue = tLSB | (tMSB << 8);
+        if (aUsePEC) {
+            uint8_t tPEC = Bus::read(true);
+            Bus::stop();
+            return (tPEC == crc8Update(crc8Update(getPECOfCommand(aAddress, aCommand, true), tLSB), tMSB)) ?
+                    SMBUS_STATUS_OK : SMBUS_STATUS_PEC_ERROR;
+        }
+        Bus::stop();
+        return SMBUS_STATUS_OK;
+    }
+
+    static uint8_t writeWord(uint8_t aAddress, uint8_t aCommand, uint16_t aValue, bool aUsePEC) {
+        if (aUsePEC) {
+            // Standard SMBus write word protocol, since a repeated start address byte would become part of the PEC of the pack.
+            if (!Bus::start((aAddress << 1) | SMBUS_WRITE) || !Bus::write(aCommand)) {
+                Bus::stop();
+                return SMBUS_STATUS_NAK;
+            }
+            Bus::write(aValue & 0xFF);
+            Bus::write((aValue >> 8) & 0xFF);
+            // pack does not acknowledge a wrong PEC
+            bool tPECAcknowledged = Bus::write(
+                    crc8Update(crc8Update(getPECOfCommand(aAddress, aCommand, false), aValue), aValue >> 8));
+            Bus::stop();
+            return tPECAcknowledged ? SMBUS_STATUS_OK : SMBUS_STATUS_PEC_ERROR;
+        }
+        if (!Bus::start((aAddress << 1) | SMBUS_WRITE) || !Bus::write(aCommand)
+                || !Bus::repeatedStart((aAddress << 1) | SMBUS_WRITE)) {
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+        Bus::write(aValue & 0xFF);
+        Bus::write((aValue >> 8) & 0xFF);
+        Bus::stop();
+        return SMBUS_STATUS_OK;
+    }
+
+    static uint8_t readManufacturerAccessWord(uint8_t aAddress, uint16_t aCommand, uint16_t * aValue, bool aUsePEC) {
+        uint8_t tStatus = writeWord(aAddress, MANUFACTURER_ACCESS, aCommand, aUsePEC);
+        if (tStatus != SMBUS_STATUS_OK) {
+            *aValue = 0xFFFF;
+            return tStatus;
+        }
+        return readWord(aAddress, MANUFACTURER_ACCESS, aValue, aUsePEC);
+    }
+
+    static uint8_t writeBlock(uint8_t aAddress, uint8_t aCommand, const uint8_t * aData, uint8_t aLength, bool aUsePEC) {
+        if (!Bus::start((aAddress << 1) | SMBUS_WRITE)) {
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+        if (!Bus::write(aCommand)) {
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+        Bus::write(aLength);
+        uint8_t tPEC = crc8Update(getPECOfCommand(aAddress, aCommand, false), aLength);
+        for (uint8_t i = 0; i < aLength; ++i) {
+            Bus::write(aData[i]);
+            tPEC = crc8Update(tPEC, aData[i]);
+        }
+        if (aUsePEC && !Bus::write(tPEC)) {
+            // pack does not acknowledge a wrong PEC
+            Bus::stop();
+            return SMBUS_STATUS_PEC_ERROR;
+        }
+        Bus::stop();
+        return SMBUS_STATUS_OK;
+    }
+
+    /*
+     * Block write of the command to ManufacturerBlockAccess followed by a block read of the record from it
+     */
+    static uint8_t readManufacturerAccessBlock(uint8_t aAddress, uint16_t aCommand, uint8_t * aDataBuffer,
+            uint8_t aDataBufferLength, uint8_t * aLengthOfData, bool aUsePEC) {
+        uint8_t tCommand[2] = { (uint8_t) aCommand, (uint8_t) (aCommand >> 8) };
+        uint8_t tStatus = writeBlock(aAddress, MANUFACTURER_BLOCK_ACCESS, tCommand, sizeof(tCommand), aUsePEC);
+        if (tStatus != SMBUS_STATUS_OK) {
+            *aLengthOfData = 0;
+            return tStatus;
+        }
+        return readBlock(aAddress, MANUFACTURER_BLOCK_ACCESS, aDataBuffer, aDataBufferLength, aLengthOfData, aUsePEC);
+    }
+
+    /*
+     * Without PEC only the bytes fitting into the buffer are read.
+     */
+    static uint8_t readBlock(uint8_t aAddress, uint8_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength,
+            uint8_t * aLengthOfData, bool aUsePEC) {
+        *aLengthOfData = 0;
+        if (!Bus::start((aAddress << 1) | SMBUS_WRITE)) {
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+        if (!Bus::write(aCommand)) {
+            // e.g. a data flash page which does not exist, otherwise 255 bytes of 0xFF would be read
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+        if (!Bus::repeatedStart((aAddress << 1) | SMBUS_READ)) {
+            Bus::stop();
+            return SMBUS_STATUS_NAK;
+        }
+
+        // First read length of data
+        uint8_t tLengthOfData = Bus::read(false);
+
+        if (aUsePEC) {
+            // PEC is sent after all data, so read all data
+            uint8_t tPEC = crc8Update(getPECOfCommand(aAddress, aCommand, true), tLengthOfData);
+            for (uint8_t tIndex = 0; tIndex < tLengthOfData; tIndex++) {
+                uint8_t tData = Bus::read(false);
+                tPEC = crc8Update(tPEC, tData);
+                if (tIndex < aDataBufferLength) {
+                    aDataBuffer[tIndex] = tData;
+                }
+            }
+            bool tPECIsValid = (Bus::read(true) == tPEC);
+            Bus::stop();
+            *aLengthOfData = (tLengthOfData > aDataBufferLength) ? aDataBufferLength : tLengthOfData;
+            return tPECIsValid ? SMBUS_STATUS_OK : SMBUS_STATUS_PEC_ERROR;
+        }
+
+        if (tLengthOfData > aDataBufferLength) {
+            tLengthOfData = aDataBufferLength;
+        }
+
+        // then read data
+        uint8_t tIndex;
+        for (tIndex = 0; tIndex < tLengthOfData - 1; tIndex++) {
+            aDataBuffer[tIndex] = Bus::read(false);
+        }
+        // Read last byte with "true"
+        aDataBuffer[tIndex++] = Bus::read(true);
+
+        Bus::stop();
+        *aLengthOfData = tLengthOfData;
+        return SMBUS_STATUS_OK;
+    }
+
+    /*
+     * Synchronous, the result is available immediately
+     */
+    static bool startReadWord(uint8_t aAddress, uint8_t aCommand, bool aUsePEC) {
+        sStartedReadStatus = readWord(aAddress, aCommand, &sStartedReadValue, aUsePEC);
+        return true;
+    }
+
+    static uint8_t getStartedReadWordResult(uint16_t * aValue) {
+        *aValue = sStartedReadValue;
+        return sStartedReadStatus;
+    }
+
+private:
+    static uint8_t sStartedReadStatus;
+    static uint16_t sStartedReadValue;
+};
+
+template<class Bus> uint8_t ByteLevelTransport<Bus>::sStartedReadStatus;
+template<class Bus> uint16_t ByteLevelTransport<Bus>::sStartedReadValue;
+
+#endif /* SRC_BYTELEVELTRANSPORT_H_ */
@@ -0,0 +1,138 @@
+/*
+ * CurveLog.h
+ *
+ * Compact encoding of the charge and discharge curve for the logger in SBMInfo.cpp.
+ * The log consists of blocks of CURVE_LOG_BLOCK_SIZE bytes, which are overwritten as a ring, oldest first.
+ *
+ * Block:
+ *   sequence number 0 to 254, CURVE_LOG_EMPTY_BLOCK if the block is erased or being rewritten
+ *   keyframe: varint milliseconds, varint sample period, varint absolute value of each field
+ *   records: one per sample period
+ *   CURVE_LOG_END_MARKER or end of block
+ *
+ * Record:
+ *   bit mask of the changed fields, bit 0 for the first field
+ *   varint of the zigzag encoded difference to the previous value of each changed field
+ *
+ * Zigzag maps small positive and negative differences to small numbers 0, -1, 1, -2 -> 0, 1, 2, 3,
+ * so a change of up to +/-63 needs only one byte. An unchanged sample needs only the mask byte.
+ * All fields changed (mask 0xFF) would be read as end marker, therefore a new block is started in this case.
+ * See BinaryTelemetry.h for the varint format.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_CURVELOG_H_
+#define SRC_CURVELOG_H_
+
+#include <stdint.h>
+#include "BinaryTelemetry.h"
+
+#define CURVE_LOG_NUMBER_OF_FIELDS  8
+#define CURVE_LOG_BLOCK_SIZE        128
+#define CURVE_LOG_EMPTY_BLOCK       0xFF
+#define CURVE_LOG_END_MARKER        0xFF
+#define CURVE_LOG_MAX_SEQUENCE      254
+#define CURVE_LOG_MAX_RECORD_LENGTH (1 + CURVE_LOG_NUMBER_OF_FIELDS * 3)
+#define CURVE_LOG_MAX_KEYFRAME_LENGTH (1 + 5 + 3 + CURVE_LOG_NUMBER_OF_FIELDS * 3)
+
+inline uint16_t encodeZigzag(int16_t aValue) {
+    return ((uint16_t) aValue << 1) ^ (uint16_t) (aValue >> 15);
+}
+
+inline int16_t decodeZigzag(uint16_t aValue) {
+    return (int16_t) (aValue >> 1) ^ -(int16_t) (aValue & 1);
+}
+
+inline uint8_t getNextCurveLogSequence(uint8_t aSequence) {
+    return (aSequence >= CURVE_LOG_MAX_SEQUENCE) ? 0 : aSequence + 1;
+}
+
+/*
+ * @return length of keyframe including the sequence number
+ */
+inline uint8_t encodeCurveLogKeyframe(uint8_t * aBuffer, uint8_t aSequence, uint32_t aMillis, uint16_t aPeriodMillis,
+        const uint16_t * aValues) {
+    uint8_t tLength = 0;
+    aBuffer[tLength++] = aSequence;
+    tLength += writeVarint(&aBuffer[tLength], aMillis);
+    tLength += writeVarint(&aBuffer[tLength], aPeriodMillis);
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_FIELDS; ++i) {
+        tLength += writeVarint(&aBuffer[tLength], aValues[i]);
+    }
+    return tLength;
+}
+
+/*
+ * @return length of record or 0 if all fields changed and a keyframe must be written instead
+ */
+inline uint8_t encodeCurveLogRecord(uint8_t * aBuffer, const uint16_t * aValues, const uint16_t * aLastValues) {
+    uint8_t tLength = 1;
+    uint8_t tMask = 0;
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_FIELDS; ++i) {
+        if (aValues[i] != aLastValues[i]) {
+            tMask |= 1 << i;
+            tLength += writeVarint(&aBuffer[tLength], encodeZigzag(aValues[i] - aLastValues[i]));
+        }
+    }
+    if (tMask == CURVE_LOG_END_MARKER) {
+        return 0;
+    }
+    aBuffer[0] = tMask;
+    return tLength;
+}
+
+/*
+ * @param aBuffer - starts behind the sequence number
+ * @return length of the keyframe without the sequence number or 0 if invalid
+ */
+inline uint8_t decodeCurveLogKeyframe(const uint8_t * aBuffer, uint8_t aLength, uint32_t * aMillis, uint16_t * aPeriodMillis,
+        uint16_t * aValues) {
+    uint32_t tValue;
+    uint8_t tIndex = readVarint(aBuffer, aLength, aMillis);
+    if (tIndex == 0) {
+        return 0;
+    }
+    uint8_t tVarintLength = readVarint(&aBuffer[tIndex], aLength - tIndex, &tValue);
+    if (tVarintLength == 0) {
+        return 0;
+    }
+    *aPeriodMillis = tValue;
+    tIndex += tVarintLength;
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_FIELDS; ++i) {
+        tVarintLength = readVarint(&aBuffer[tIndex], aLength - tIndex, &tValue);
+        if (tVarintLength == 0) {
+            return 0;
+        }
+        aValues[i] = tValue;
+        tIndex += tVarintLength;
+    }
+    return tIndex;
+}
+
+/*
+ * Applies the differences of the record to aValues
+ * @return length of the record or 0 if end marker or invalid
+ */
+inline uint8_t decodeCurveLogRecord(const uint8_t * aBuffer, uint8_t aLength, uint16_t * aValues) {
+    if (aLength == 0 || aBuffer[0] == CURVE_LOG_END_MARKER) {
+        return 0;
+    }
+    uint8_t tMask = aBuffer[0];
+    uint8_t tIndex = 1;
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_FIELDS; ++i) {
+        if (tMask & (1 << i)) {
+            uint32_t tValue;
+            uint8_t tVarintLength = readVarint(&aBuffer[tIndex], aLength - tIndex, &tValue);
+            if (tVarintLength == 0) {
+                return 0;
+            }
+            aValues[i] += decodeZigzag(tValue);
+            tIndex += tVarintLength;
+        }
+    }
+    return tIndex;
+}
+
+#endif /* SRC_CURVELOG_H_ */
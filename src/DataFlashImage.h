@@ -0,0 +1,108 @@
+/*
+ * DataFlashImage.h
+ *
+ * Compact binary image of the data flash pages of a controller, sent by the data flash dump of SBMInfo.cpp.
+ *
+ * Image:
+ *   DATA_FLASH_START_LINE
+ *   one record for each sent page
+ *   end record
+ *
+ * Record:
+ *   DATA_FLASH_RECORD_START
+ *   subclass ID, DATA_FLASH_END_OF_IMAGE for the end record, which has only the CRC after it
+ *   page number, 1 for the first 32 bytes of the subclass
+ *   length of data
+ *   data
+ *   CRC-8 over all bytes after DATA_FLASH_RECORD_START, same polynomial as the SMBus PEC
+ *
+ * A page of 32 bytes requires 37 bytes (DATA_FLASH_MAX_RECORD_LENGTH) instead of the around 100 characters of a line of a hex dump.
+ * See extras/host/SBMTelemetryDecoder.cpp for the decoder.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_DATAFLASHIMAGE_H_
+#define SRC_DATAFLASHIMAGE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "SMBusPEC.h"
+
+#define DATA_FLASH_START_LINE           "*** DATA FLASH IMAGE ***"
+#define DATA_FLASH_RECORD_START         0x7E
+#define DATA_FLASH_END_OF_IMAGE         0xFF
+#define DATA_FLASH_PAGE_SIZE            32
+#define DATA_FLASH_MAX_RECORD_LENGTH    (1 + 3 + DATA_FLASH_PAGE_SIZE + 1)
+
+/*
+ * @return length of the record
+ */
+inline uint8_t encodeDataFlashRecord(uint8_t * aBuffer, uint8_t aSubclassID, uint8_t aPage, const uint8_t * aData,
+        uint8_t aLength) {
+    aBuffer[0] = DATA_FLASH_RECORD_START;
+    aBuffer[1] = aSubclassID;
+    aBuffer[2] = aPage;
+    aBuffer[3] = aLength;
+    memcpy(&aBuffer[4], aData, aLength);
+    aBuffer[4 + aLength] = crc8Update(0, &aBuffer[1], 3 + aLength);
+    return 5 + aLength;
+}
+
+inline uint8_t encodeDataFlashEndRecord(uint8_t * aBuffer) {
+    aBuffer[0] = DATA_FLASH_RECORD_START;
+    aBuffer[1] = DATA_FLASH_END_OF_IMAGE;
+    aBuffer[2] = crc8Update(0, &aBuffer[1], 1);
+    return 3;
+}
+
+/*
+ * The data of the record starts at aBuffer + 4
+ * @return length of the record, 0 if aLength is too short for the record or -1 if the record is invalid
+ */
+inline int decodeDataFlashRecord(const uint8_t * aBuffer, uint8_t aLength, uint8_t * aSubclassID, uint8_t * aPage,
+        uint8_t * aDataLength) {
+    if (aLength < 3) {
+        return 0;
+    }
+    if (aBuffer[0] != DATA_FLASH_RECORD_START) {
+        return -1;
+    }
+    *aSubclassID = aBuffer[1];
+    if (aBuffer[1] == DATA_FLASH_END_OF_IMAGE) {
+        return (crc8Update(0, &aBuffer[1], 1) == aBuffer[2]) ? 3 : -1;
+    }
+    if (aLength < 4) {
+        return 0;
+    }
+    if (aBuffer[3] > DATA_FLASH_PAGE_SIZE) {
+        return -1;
+    }
+    uint8_t tRecordLength = 5 + aBuffer[3];
+    if (aLength < tRecordLength) {
+        return 0;
+    }
+    if (crc8Update(0, &aBuffer[1], tRecordLength - 2) != aBuffer[tRecordLength - 1]) {
+        return -1;
+    }
+    *aPage = aBuffer[2];
+    *aDataLength = aBuffer[3];
+    return tRecordLength;
+}
+
+/*
+ * Signature of a page for the comparison with the reference dump, CRC-16-CCITT
+ */
+inline uint16_t getDataFlashPageSignature(const uint8_t * aData, uint8_t aLength) {
+    uint16_t tCRC = 0xFFFF;
+    for (uint8_t i = 0; i < aLength; ++i) {
+        tCRC ^= (uint16_t) aData[i] << 8;
+        for (uint8_t j = 0; j < 8; ++j) {
+            tCRC = (tCRC & 0x8000) ? (tCRC << 1) ^ 0x1021 : tCRC << 1;
+        }
+    }
+    return tCRC;
+}
+
+#endif /* SRC_DATAFLASHIMAGE_H_ */
@@ -0,0 +1,186 @@
+/*
+ * DigitalPinI2CTransport.h
+ *
+ * SMBus transport for a bit banged I2C master on two arbitrary digital pins, which can be changed at runtime.
+ * Used for the discovery of the SDA and SCL pins of a pack, see USE_PIN_DISCOVERY in SBMInfo.cpp.
+ * SoftI2CMaster can not be used for this, since its pins are compile time constants.
+ *
+ * The lines are driven open drain. A line is pulled low by switching the pin to output low
+ * and released by switching it to input with internal pull-up, so every pin idles high even without external pull-ups.
+ * The slave may stretch the clock for at most DIGITAL_PIN_I2C_STRETCH_TIMEOUT_MICROS, then the transaction fails,
+ * so a probe of a pin pair with a line held low is bounded.
+ * The clock can be changed with setClock(), see TUNE_BUS_CLOCK in SBMInfo.cpp.
+ *
+ * Contains the pin variables, so it must be included only once.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_DIGITALPINI2CTRANSPORT_H_
+#define SRC_DIGITALPINI2CTRANSPORT_H_
+
+#include <Arduino.h>
+#include "ByteLevelTransport.h"
+
+#if !defined(DIGITAL_PIN_I2C_HALF_BIT_MICROS)
+// together with the time of the pin functions about 25 kHz, the same as I2C_SLOWMODE of SoftI2CMaster
+#define DIGITAL_PIN_I2C_HALF_BIT_MICROS 10
+#endif
+#define DIGITAL_PIN_I2C_HALF_BIT_OVERHEAD_MICROS 10 // pin functions of the Arduino core, so the maximum clock is around 40 kHz
+#if !defined(DIGITAL_PIN_I2C_STRETCH_TIMEOUT_MICROS)
+#define DIGITAL_PIN_I2C_STRETCH_TIMEOUT_MICROS 10000 // below the 25 ms SMBus timeout after which the slave resets
+#endif
+
+uint8_t sDigitalPinI2CSDAPin = SDA;
+uint8_t sDigitalPinI2CSCLPin = SCL;
+uint8_t sDigitalPinI2CHalfBitMicros = DIGITAL_PIN_I2C_HALF_BIT_MICROS;
+bool sDigitalPinI2CTimeout; // set if the slave stretched the clock too long, the rest of the transaction is skipped
+
+class DigitalPinI2CBus {
+public:
+    static void setPins(uint8_t aSDAPin, uint8_t aSCLPin) {
+        sDigitalPinI2CSDAPin = aSDAPin;
+        sDigitalPinI2CSCLPin = aSCLPin;
+        releaseLine(aSDAPin);
+        releaseLine(aSCLPin);
+    }
+
+    /*
+     * @return true if both lines are high, i.e. no other device holds them low
+     */
+    static bool isIdle() {
+        return digitalRead(sDigitalPinI2CSDAPin) == HIGH && digitalRead(sDigitalPinI2CSCLPin) == HIGH;
+    }
+
+    static bool start(uint8_t aAddressAndDirection) {
+        sDigitalPinI2CTimeout = false;
+        if (!isIdle()) {
+            return false;
+        }
+        pullLineLow(sDigitalPinI2CSDAPin);
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        pullLineLow(sDigitalPinI2CSCLPin);
+        return write(aAddressAndDirection);
+    }
+
+    static bool repeatedStart(uint8_t aAddressAndDirection) {
+        releaseLine(sDigitalPinI2CSDAPin);
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        if (!releaseClock()) {
+            return false;
+        }
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        pullLineLow(sDigitalPinI2CSDAPin);
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        pullLineLow(sDigitalPinI2CSCLPin);
+        return write(aAddressAndDirection);
+    }
+
+    /*
+     * @return true if the slave acknowledged the byte
+     */
+    static bool write(uint8_t aValue) {
+        for (uint8_t i = 0; i < 8; ++i) {
+            if (aValue & 0x80) {
+                releaseLine(sDigitalPinI2CSDAPin);
+            } else {
+                pullLineLow(sDigitalPinI2CSDAPin);
+            }
+            aValue <<= 1;
+            clockBit();
+        }
+        releaseLine(sDigitalPinI2CSDAPin);
+        return !clockBit();
+    }
+
+    static uint8_t read(bool aLast) {
+        uint8_t tValue = 0;
+        releaseLine(sDigitalPinI2CSDAPin);
+        for (uint8_t i = 0; i < 8; ++i) {
+            tValue = (tValue << 1) | clockBit();
+        }
+        if (!aLast) {
+            pullLineLow(sDigitalPinI2CSDAPin);
+        }
+        clockBit();
+        releaseLine(sDigitalPinI2CSDAPin);
+        return tValue;
+    }
+
+    static void stop() {
+        pullLineLow(sDigitalPinI2CSDAPin);
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        releaseClock();
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        releaseLine(sDigitalPinI2CSDAPin);
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+    }
+
+private:
+    static void releaseLine(uint8_t aPin) {
+        pinMode(aPin, INPUT_PULLUP);
+    }
+
+    static void pullLineLow(uint8_t aPin) {
+        // disables the pull-up before the pin becomes an output, so the line is never driven high
+        digitalWrite(aPin, LOW);
+        pinMode(aPin, OUTPUT);
+    }
+
+    /*
+     * @return false if the slave holds the clock low longer than the timeout
+     */
+    static bool releaseClock() {
+        if (sDigitalPinI2CTimeout) {
+            return false;
+        }
+        releaseLine(sDigitalPinI2CSCLPin);
+        uint32_t tStartMicros = micros();
+        while (digitalRead(sDigitalPinI2CSCLPin) == LOW) {
+            if (micros() - tStartMicros > DIGITAL_PIN_I2C_STRETCH_TIMEOUT_MICROS) {
+                sDigitalPinI2CTimeout = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Sends the data bit already set on SDA and returns the level of SDA while the clock is high
+     * @return 1 if SDA was high or the clock timed out
+     */
+    static uint8_t clockBit() {
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        if (!releaseClock()) {
+            return 1;
+        }
+        delayMicroseconds(sDigitalPinI2CHalfBitMicros);
+        uint8_t tBit = digitalRead(sDigitalPinI2CSDAPin);
+        pullLineLow(sDigitalPinI2CSCLPin);
+        return tBit;
+    }
+};
+
+class DigitalPinI2CTransport: public ByteLevelTransport<DigitalPinI2CBus> {
+public:
+    /*
+     * @return false if a line is held low, e.g. because the pins are not connected to a bus
+     */
+    static bool init() {
+        DigitalPinI2CBus::setPins(sDigitalPinI2CSDAPin, sDigitalPinI2CSCLPin);
+        return DigitalPinI2CBus::isIdle();
+    }
+
+    static void setPins(uint8_t aSDAPin, uint8_t aSCLPin) {
+        DigitalPinI2CBus::setPins(aSDAPin, aSCLPin);
+    }
+
+    static void setClock(uint32_t aClockHz) {
+        uint16_t tHalfBitMicros = 500000 / aClockHz;
+        sDigitalPinI2CHalfBitMicros =
+                (tHalfBitMicros > DIGITAL_PIN_I2C_HALF_BIT_OVERHEAD_MICROS) ? tHalfBitMicros - DIGITAL_PIN_I2C_HALF_BIT_OVERHEAD_MICROS : 0;
+    }
+};
+
+#endif /* SRC_DIGITALPINI2CTRANSPORT_H_ */
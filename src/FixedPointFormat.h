@@ -0,0 +1,91 @@
+/*
+ * FixedPointFormat.h
+ *
+ * Integer only formatting of the register values, to avoid the software floating point of the AVR.
+ * The results are the same as printing the float values with Print::print(float, digits),
+ * which rounds by adding half of the last digit and then truncates.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_FIXEDPOINTFORMAT_H_
+#define SRC_FIXEDPOINTFORMAT_H_
+
+#include <stdint.h>
+
+#define FIXED_POINT_BUFFER_SIZE 9 // sign, 5 digits, decimal point, 1 additional digit for temperature, NUL
+
+/*
+ * Writes aValue / 10^aDecimals with aDecimals digits after the decimal point, e.g. 12212, 3 -> "12.212"
+ * @return pointer to the terminating NUL
+ */
+inline char * formatFixedPoint(char * aBuffer, uint16_t aValue, uint8_t aDecimals) {
+    char tDigits[5];
+    uint8_t tNumberOfDigits = 0;
+    do {
+        tDigits[tNumberOfDigits++] = '0' + (aValue % 10);
+        aValue /= 10;
+    } while (aValue != 0);
+    // leading zeros for the fraction and the integer part
+    while (tNumberOfDigits <= aDecimals) {
+        tDigits[tNumberOfDigits++] = '0';
+    }
+    while (tNumberOfDigits > 0) {
+        if (tNumberOfDigits == aDecimals) {
+            *aBuffer++ = '.';
+        }
+        *aBuffer++ = tDigits[--tNumberOfDigits];
+    }
+    *aBuffer = '\0';
+    return aBuffer;
+}
+
+/*
+ * mV -> "V.mmm"
+ */
+inline char * formatMillivolt(char * aBuffer, uint16_t aMillivolt) {
+    return formatFixedPoint(aBuffer, aMillivolt, 3);
+}
+
+/*
+ * The temperature registers have a resolution of 0.1 K, so the value in 0.01 degree Celsius always ends with 5.
+ * Split into 0.1 degree Celsius and the sign, to stay within 16 bit.
+ */
+constexpr bool isBelowZeroCelsius(uint16_t aDeciKelvin) {
+    return aDeciKelvin <= 2731;
+}
+constexpr uint16_t getDeciCelsiusMagnitude(uint16_t aDeciKelvin) {
+    return isBelowZeroCelsius(aDeciKelvin) ? 2731 - aDeciKelvin : aDeciKelvin - 2732;
+}
+static_assert(getDeciCelsiusMagnitude(2991) * 10 + 5 == (int32_t) (((2991 / 10.0) - 273.15) * 100 + 0.5),
+        "Wrong temperature conversion");
+static_assert(getDeciCelsiusMagnitude(2732) * 10 + 5 == (int32_t) (((2732 / 10.0) - 273.15) * 100 + 0.5),
+        "Wrong temperature conversion");
+static_assert(getDeciCelsiusMagnitude(2731) * 10 + 5 == (int32_t) ((273.15 - (2731 / 10.0)) * 100 + 0.5),
+        "Wrong temperature conversion");
+static_assert(getDeciCelsiusMagnitude(2500) * 10 + 5 == (int32_t) ((273.15 - (2500 / 10.0)) * 100 + 0.5),
+        "Wrong temperature conversion");
+
+/*
+ * 0.1 K -> "C.cc", e.g. 2991 -> "25.95", 2731 -> "-0.05"
+ */
+inline char * formatDeciKelvinAsCelsius(char * aBuffer, uint16_t aDeciKelvin) {
+    if (isBelowZeroCelsius(aDeciKelvin)) {
+        *aBuffer++ = '-';
+    }
+    aBuffer = formatFixedPoint(aBuffer, getDeciCelsiusMagnitude(aDeciKelvin), 1);
+    *aBuffer++ = '5';
+    *aBuffer = '\0';
+    return aBuffer;
+}
+
+/*
+ * Capacity or power in 10 mWh or 10 mW -> mAh or mA
+ */
+constexpr uint16_t convertCentiWattToMilliampere(uint16_t aCentiWatt, uint16_t aDesignVoltageMillivolt) {
+    return ((uint32_t) aCentiWatt * 10000) / aDesignVoltageMillivolt;
+}
+static_assert(convertCentiWattToMilliampere(100, 11100) == (uint16_t) (100 * 10000L / 11100), "Wrong power conversion");
+
+#endif /* SRC_FIXEDPOINTFORMAT_H_ */
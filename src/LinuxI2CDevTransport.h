@@ -0,0 +1,161 @@
+/*
+ * LinuxI2CDevTransport.h
+ *
+ * SMBus transport for the Linux i2c-dev interface, e.g. on a Raspberry Pi or with an USB to I2C adapter. See SMBus.h.
+ * Only for the host build in extras/host. The device is taken from the environment variable SBM_I2C_DEVICE,
+ * if it is not set from the compile time macro LINUX_I2C_DEVICE. PEC is computed and checked by the kernel.
+ * Block reads require an adapter supporting I2C_FUNC_SMBUS_READ_BLOCK_DATA, ManufacturerBlockAccess also the block write.
+ *
+ * Must be included only once.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_LINUXI2CDEVTRANSPORT_H_
+#define SRC_LINUXI2CDEVTRANSPORT_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "SBMInfo.h"
+#include "SMBus.h"
+
+#if !defined(LINUX_I2C_DEVICE)
+#define LINUX_I2C_DEVICE "/dev/i2c-1"
+#endif
+
+int sLinuxI2CFile = -1;
+int sLinuxI2CSelectedAddress = -1;
+int sLinuxI2CSelectedPEC = -1;
+uint8_t sLinuxI2CStartedReadStatus;
+uint16_t sLinuxI2CStartedReadValue;
+
+class LinuxI2CDevTransport {
+public:
+    static bool init() {
+        const char * tDevice = getenv("SBM_I2C_DEVICE");
+        if (tDevice == NULL) {
+            tDevice = LINUX_I2C_DEVICE;
+        }
+        sLinuxI2CFile = open(tDevice, O_RDWR);
+        if (sLinuxI2CFile < 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", tDevice, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    static uint8_t quickCommand(uint8_t aAddress) {
+        return access(aAddress, false, I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK, NULL);
+    }
+
+    static uint8_t sendByte(uint8_t aAddress, uint8_t aValue) {
+        return access(aAddress, false, I2C_SMBUS_WRITE, aValue, I2C_SMBUS_BYTE, NULL);
+    }
+
+    static uint8_t readWord(uint8_t aAddress, uint8_t aCommand, uint16_t * aValue, bool aUsePEC) {
+        union i2c_smbus_data tData;
+        uint8_t tStatus = access(aAddress, aUsePEC, I2C_SMBUS_READ, aCommand, I2C_SMBUS_WORD_DATA, &tData);
+        *aValue = (tStatus == SMBUS_STATUS_OK) ? tData.word : 0xFFFF;
+        return tStatus;
+    }
+
+    static uint8_t writeWord(uint8_t aAddress, uint8_t aCommand, uint16_t aValue, bool aUsePEC) {
+        union i2c_smbus_data tData;
+        tData.word = aValue;
+        return access(aAddress, aUsePEC, I2C_SMBUS_WRITE, aCommand, I2C_SMBUS_WORD_DATA, &tData);
+    }
+
+    static uint8_t readManufacturerAccessWord(uint8_t aAddress, uint16_t aCommand, uint16_t * aValue, bool aUsePEC) {
+        uint8_t tStatus = writeWord(aAddress, MANUFACTURER_ACCESS, aCommand, aUsePEC);
+        if (tStatus != SMBUS_STATUS_OK) {
+            *aValue = 0xFFFF;
+            return tStatus;
+        }
+        return readWord(aAddress, MANUFACTURER_ACCESS, aValue, aUsePEC);
+    }
+
+    static uint8_t readBlock(uint8_t aAddress, uint8_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength,
+            uint8_t * aLengthOfData, bool aUsePEC) {
+        union i2c_smbus_data tData;
+        uint8_t tStatus = access(aAddress, aUsePEC, I2C_SMBUS_READ, aCommand, I2C_SMBUS_BLOCK_DATA, &tData);
+        *aLengthOfData = 0;
+        if (tStatus == SMBUS_STATUS_OK) {
+            // first byte is the length
+            *aLengthOfData = (tData.block[0] > aDataBufferLength) ? aDataBufferLength : tData.block[0];
+            memcpy(aDataBuffer, &tData.block[1], *aLengthOfData);
+        }
+        return tStatus;
+    }
+
+    static uint8_t readManufacturerAccessBlock(uint8_t aAddress, uint16_t aCommand, uint8_t * aDataBuffer,
+            uint8_t aDataBufferLength, uint8_t * aLengthOfData, bool aUsePEC) {
+        union i2c_smbus_data tData;
+        tData.block[0] = 2;
+        tData.block[1] = aCommand;
+        tData.block[2] = aCommand >> 8;
+        uint8_t tStatus = access(aAddress, aUsePEC, I2C_SMBUS_WRITE, MANUFACTURER_BLOCK_ACCESS, I2C_SMBUS_BLOCK_DATA, &tData);
+        if (tStatus != SMBUS_STATUS_OK) {
+            *aLengthOfData = 0;
+            return tStatus;
+        }
+        return readBlock(aAddress, MANUFACTURER_BLOCK_ACCESS, aDataBuffer, aDataBufferLength, aLengthOfData, aUsePEC);
+    }
+
+    /*
+     * Synchronous, the result is available immediately
+     */
+    static bool startReadWord(uint8_t aAddress, uint8_t aCommand, bool aUsePEC) {
+        sLinuxI2CStartedReadStatus = readWord(aAddress, aCommand, &sLinuxI2CStartedReadValue, aUsePEC);
+        return true;
+    }
+
+    static uint8_t getStartedReadWordResult(uint16_t * aValue) {
+        *aValue = sLinuxI2CStartedReadValue;
+        return sLinuxI2CStartedReadStatus;
+    }
+
+private:
+    /*
+     * The kernel returns EBADMSG if PEC does not match
+     */
+    static uint8_t access(uint8_t aAddress, bool aUsePEC, uint8_t aReadWrite, uint8_t aCommand, uint32_t aSize,
+            union i2c_smbus_data * aData) {
+        if (sLinuxI2CSelectedAddress != aAddress) {
+            // I2C_SLAVE fails for addresses used by a kernel driver
+            if (ioctl(sLinuxI2CFile, I2C_SLAVE, aAddress) < 0) {
+                return SMBUS_STATUS_BUS_ERROR;
+            }
+            sLinuxI2CSelectedAddress = aAddress;
+        }
+        if (sLinuxI2CSelectedPEC != aUsePEC) {
+            // without PEC support of the adapter, a read with PEC would not be checked
+            if (ioctl(sLinuxI2CFile, I2C_PEC, aUsePEC ? 1 : 0) < 0) {
+                return SMBUS_STATUS_BUS_ERROR;
+            }
+            sLinuxI2CSelectedPEC = aUsePEC;
+        }
+        struct i2c_smbus_ioctl_data tArguments;
+        tArguments.read_write = aReadWrite;
+        tArguments.command = aCommand;
+        tArguments.size = aSize;
+        tArguments.data = aData;
+        if (ioctl(sLinuxI2CFile, I2C_SMBUS, &tArguments) == 0) {
+            return SMBUS_STATUS_OK;
+        }
+        if (errno == EBADMSG) {
+            return SMBUS_STATUS_PEC_ERROR;
+        }
+        return SMBUS_STATUS_NAK;
+    }
+};
+
+#endif /* SRC_LINUXI2CDEVTRANSPORT_H_ */
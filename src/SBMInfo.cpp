@@ -17,8 +17,20 @@
 
 #include <Arduino.h>
 
+//#define SHOW_SCHEDULER_STATISTICS // print achieved polls per second and worst case jitter of each register every minute
+//#define USE_SNAPSHOT_POLLING // poll all dynamic registers together as one snapshot instead of each with its own period
+//#define USE_ADAPTIVE_POLLING // poll faster while discharging or on alarms and slower while idle
+//#define SHOW_FORMAT_BENCHMARK // print the cycles for formatting a value with float and with fixed point at startup
+//#define SHOW_AT_RATE_SWEEP // print TimeToFull, TimeToEmpty and OK for 50 AtRate values at startup
+//#define USE_CURVE_LOG // log voltage, current, temperature and charge every second to EEPROM, send 'd' to dump the log
+//#define CURVE_LOG_IN_RAM // log to a RAM buffer instead of EEPROM, the log is then lost at reset
+//#define USE_REGISTER_STATISTICS // print min, max, mean and standard deviation of all samples of each polled register every minute
+//#define USE_TRIGGER_CAPTURE // capture voltage, current and cell voltages at maximum rate around an alarm, send 't' to trigger
+//#define USE_DATA_FLASH_DUMP // send 'f' for a binary image of the data flash of a bq20z70, 'c' for only the pages changed since then
 #include "SBMInfo.h"
+#include "FixedPointFormat.h"
 #include "LiquidCrystal.h"
+#include "ShadowLCD.h"
 
 #define VERSION "2.1"
 
@@ -30,109 +42,415 @@
 
 #define SCL_PORT PORTC
 #define SCL_PIN 5
+
+/*
+ * Select the SMBus transport, default is SoftI2CMaster. See SMBus.h.
+ * USE_HARDWARE_TWI uses the interrupt driven hardware TWI (see AsyncTWI.h) instead of SoftI2CMaster.
+ * Then the bus transfers run in the background and interrupts need not to be disabled during a transfer.
+ * USE_PIN_DISCOVERY uses a bit banged master on digital pins which are searched at start, see discoverPins().
+ * Then the pack can be connected to any pair of PIN_DISCOVERY_CANDIDATE_PINS.
+ * USE_LINUX_I2C_DEV and USE_SIMULATOR_TRANSPORT are only for the host build in extras/host.
+ */
+//#define USE_HARDWARE_TWI
+//#define USE_PIN_DISCOVERY
+//#define USE_LINUX_I2C_DEV
+//#define USE_SIMULATOR_TRANSPORT
+#if defined(USE_HARDWARE_TWI)
+#include "AsyncTWI.h"
+typedef HardwareTWITransport SMBusTransport;
+#elif defined(USE_PIN_DISCOVERY)
+#include "DigitalPinI2CTransport.h"
+typedef DigitalPinI2CTransport SMBusTransport;
+#if !defined(PIN_DISCOVERY_CANDIDATE_PINS)
+// all pins of an Uno which are not used by serial, LCD and LED
+#define PIN_DISCOVERY_CANDIDATE_PINS 8, 9, 10, 11, 12, A0, A1, A2, A3, A4, A5
+#endif
+#elif defined(USE_LINUX_I2C_DEV)
+#include "LinuxI2CDevTransport.h"
+typedef LinuxI2CDevTransport SMBusTransport;
+#elif defined(USE_SIMULATOR_TRANSPORT)
+#include "SimulatorTransport.h"
+typedef SimulatorTransport SMBusTransport;
+#else
 #define I2C_SLOWMODE 1
 // Otherwise it may give read errors because of the arduino 1 ms clock interrupt.
 #define I2C_NOINTERRUPT  1
 // must be located after the defines
 #include <SoftI2CMaster.h>
+#include "SoftI2CTransport.h"
+typedef SoftI2CTransport SMBusTransport;
+#endif
+#include "SMBus.h"
 
-#define DATA_BUFFER_LENGTH 32
-uint8_t sI2CDataBuffer[DATA_BUFFER_LENGTH];
+/*
+ * TUNE_BUS_CLOCK selects the fastest reliable bus clock for each pack, see tuneBusClock().
+ * It requires a transport whose clock can be changed at runtime, i.e. USE_HARDWARE_TWI or USE_PIN_DISCOVERY.
+ */
+//#define TUNE_BUS_CLOCK
+#if defined(TUNE_BUS_CLOCK) && !defined(USE_HARDWARE_TWI) && !defined(USE_PIN_DISCOVERY)
+#error "TUNE_BUS_CLOCK requires USE_HARDWARE_TWI or USE_PIN_DISCOVERY, the clock of SoftI2CMaster is fixed at compile time"
+#endif
+
+/*
+ * If the pack announces PEC support in SpecificationInfo, all transfers are checked by SMBus Packet Error Checking.
+ * Reads are then only repeated if the PEC does not match and changed values are no longer checked by 2 extra reads.
+ */
+#define SUPPORT_PEC
 
-uint8_t sI2CDeviceAddress;
+/*
+ * The registers supported by a pack are probed at start, see probeRegisters().
+ * The result is stored in EEPROM, so a known pack is not probed again at the next start.
+ */
+#define CACHE_REGISTER_CAPABILITIES
 
-LiquidCrystal myLCD(2, 3, 4, 5, 6, 7);
+/*
+ * Changed values are sent as binary frames (see BinaryTelemetry.h) instead of text, after the info of setup() is printed as text.
+ * Use extras/host/SBMTelemetryDecoder.cpp to convert the output to the text report.
+ * The LCD then only shows the values of setup().
+ */
+//#define USE_BINARY_TELEMETRY
+#if defined(USE_BINARY_TELEMETRY)
+#include "BinaryTelemetry.h"
+#  if defined(SHOW_SCHEDULER_STATISTICS)
+#error "The text of SHOW_SCHEDULER_STATISTICS can not be mixed with USE_BINARY_TELEMETRY"
+#  endif
+#  if defined(USE_TRIGGER_CAPTURE)
+#error "The text of USE_TRIGGER_CAPTURE can not be mixed with USE_BINARY_TELEMETRY"
+#  endif
+#  if defined(USE_REGISTER_STATISTICS)
+#error "The text of USE_REGISTER_STATISTICS can not be mixed with USE_BINARY_TELEMETRY"
+#  endif
+#  if defined(USE_DATA_FLASH_DUMP)
+#error "The image of USE_DATA_FLASH_DUMP can not be mixed with USE_BINARY_TELEMETRY"
+#  endif
+#endif
+
+#if defined(USE_CURVE_LOG)
+#include "CurveLog.h"
+#define CURVE_LOG_DUMP_COMMAND 'd'
+#endif
+#if defined(USE_TRIGGER_CAPTURE)
+#define CAPTURE_TRIGGER_COMMAND 't'
+#endif
+#if defined(USE_DATA_FLASH_DUMP)
+#include "DataFlashImage.h"
+#define DATA_FLASH_DUMP_COMMAND 'f'
+#define DATA_FLASH_CHANGES_COMMAND 'c'
+#endif
+#if defined(CACHE_REGISTER_CAPABILITIES) || (defined(USE_CURVE_LOG) && !defined(CURVE_LOG_IN_RAM)) || defined(USE_DATA_FLASH_DUMP)
+#include <EEPROM.h>
+#endif
+#include "SMBusPEC.h" // for the CRC of the device name
+
+#define DATA_BUFFER_LENGTH 34 // 32 byte block and the 2 byte command in front of a ManufacturerBlockAccess record
+uint8_t sI2CDataBuffer[DATA_BUFFER_LENGTH];
 
-void printBinary(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue);
-void printSigned(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue);
-void printCapacity(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCapacity);
-void printPercentage(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aPercentage);
-
-void printTime(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMinutes);
-void printBatteryMode(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMode);
-void printBatteryStatus(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aStatus);
-void printManufacturerDate(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aDate);
-void printVoltage(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aVoltage);
-void printCurrent(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCurrent);
-void printTemperature(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aTemperature);
-
-void printFunctionDescriptionArray(struct SBMFunctionDescriptionStruct * aSBMFunctionDescription, uint8_t aLengthOfArray,
-bool aOnlyPrintIfValueChanged);
-void printSMBStaticInfo(void);
+LiquidCrystal myLCD(2, 3, 4, 5, 6, 7);
+/*
+ * All output to the LCD goes to the shadow buffer. Each loop sends only up to LCD_MAX_CELLS_PER_LOOP changed characters.
+ */
+ShadowLCD myShadowLCD(myLCD);
+#define LCD_MAX_CELLS_PER_LOOP 8
+#define LCD_CURRENT_COLUMN 12 // voltage and current share the first row
+
+void printBinary(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue);
+void printSigned(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue);
+void printCapacity(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCapacity);
+void printPercentage(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aPercentage);
+
+void printTime(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMinutes);
+void printBatteryMode(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMode);
+void printBatteryStatus(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aStatus);
+void printManufacturerDate(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aDate);
+void printVoltage(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aVoltage);
+void printCurrent(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCurrent);
+void printTemperature(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aTemperature);
+
+void printDescription(const struct SBMFunctionDescriptionStruct * aDescription);
+bool isLCDOutput(const struct SBMFunctionDescriptionStruct * aDescription);
+
+void printFunctionDescriptionArray(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterStates, uint8_t aLengthOfArray, bool aOnlyPrintIfValueChanged);
+uint16_t printSMBStaticInfo(uint16_t * aValues, bool aValuesAreCached);
 void printSMBManufacturerInfo(void);
 void printSMBNonStandardInfo(bool aOnlyPrintIfValueChanged);
 void printSMBATRateInfo(void);
-
+#if defined(SHOW_AT_RATE_SWEEP)
+void printAtRateSweep(void);
+#endif
+
+void initPollScheduler(void);
+uint32_t initPollSchedulerOfPack(struct SBMPackStruct * aPack, uint32_t aStartMillis);
+#if defined(SHOW_FORMAT_BENCHMARK)
+void printFormatBenchmark(void);
+#endif
+#if defined(USE_CURVE_LOG)
+void initCurveLog(void);
+void logCurve(void);
+void dumpCurveLog(void);
+#endif
+#if defined(USE_TRIGGER_CAPTURE)
+bool captureNextSample(void);
+void triggerCapture(const __FlashStringHelper * aCause, uint16_t aValue);
+void checkBatteryStatusTrigger(uint16_t aLastStatus, uint16_t aStatus);
+#endif
+#if defined(USE_DATA_FLASH_DUMP)
+void dumpDataFlash(bool aOnlyChangedPages);
+#endif
+#if defined(USE_BINARY_TELEMETRY)
+void startTelemetry(void);
+void sendTelemetryFrame(struct SBMPackStruct * aPack, uint8_t aFunctionCode, uint16_t aValue, uint32_t aMillis);
+#endif
+bool pollNextDueRegister(void);
+#if defined(USE_SNAPSHOT_POLLING)
+bool pollNextDueSnapshot(void);
+#endif
+void printQueuedOutput(void);
+#if defined(SHOW_SCHEDULER_STATISTICS)
+void printSchedulerStatistics(void);
+#endif
+#if defined(USE_REGISTER_STATISTICS)
+void addStatisticsSample(const struct SBMFunctionDescriptionStruct * aDescription, struct SBMRegisterStateStruct * aRegisterState,
+        uint16_t aValue);
+void printRegisterStatistics(void);
+#endif
+
+bool isI2CDeviceAttached(uint8_t aI2CDeviceAddress);
 bool checkForAttachedI2CDevice(uint8_t aI2CDeviceAddress);
 int scanForAttachedI2CDevice(void);
+uint8_t discoverPacks(void);
+#if defined(USE_PIN_DISCOVERY)
+void discoverPins(void);
+#endif
 
 void BlinkLedForever(int aBinkDelay);
 void TogglePin(uint8_t aPinNr);
 int readWord(uint8_t aFunction);
 void writeWord(uint8_t aFunction, uint16_t aValue);
+#if defined(SUPPORT_PEC)
+void checkPECSupport(uint16_t aSpecificationInfo);
+#endif
 
 // Pin 13 has an LED connected on most Arduino boards.
 const int LED_PIN = 13;
 
 /*
  * Command definitions
+ * The register table is generated from the register map in SBMInfo.h and stored in program memory.
+ * It contains the groups one after the other, the arrays below point to the first entry of each group.
+ */
+#define SBM_DESCRIPTION_STRINGS(aFunctionCode, aFormat, aDescription, aDescriptionLCD, aPollPeriodMillis, aReportPolicy) \
+    const char sDescription_##aFunctionCode[] PROGMEM = aDescription; \
+    const char sDescriptionLCD_##aFunctionCode[] PROGMEM = aDescriptionLCD;
+// unused empty LCD strings are removed by the linker
+#define SBM_DESCRIPTION_ENTRY(aFunctionCode, aFormat, aDescription, aDescriptionLCD, aPollPeriodMillis, aReportPolicy) \
+    { aFunctionCode, aFormat, aPollPeriodMillis, aReportPolicy, sDescription_##aFunctionCode, \
+        (sizeof(aDescriptionLCD) > 1) ? sDescriptionLCD_##aFunctionCode : NULL },
+#define SBM_COUNT_ENTRY(...) + 1
+
+SBM_STATIC_REGISTERS(SBM_DESCRIPTION_STRINGS)
+SBM_DYNAMIC_REGISTERS(SBM_DESCRIPTION_STRINGS)
+SBM_NON_STANDARD_REGISTERS(SBM_DESCRIPTION_STRINGS)
+SBM_CONTROLLER_REGISTERS(SBM_DESCRIPTION_STRINGS)
+SBM_AT_RATE_REGISTERS(SBM_DESCRIPTION_STRINGS)
+
+const struct SBMFunctionDescriptionStruct sSBMFunctionDescriptionTable[] PROGMEM = {
+SBM_STATIC_REGISTERS(SBM_DESCRIPTION_ENTRY)
+SBM_DYNAMIC_REGISTERS(SBM_DESCRIPTION_ENTRY)
+SBM_NON_STANDARD_REGISTERS(SBM_DESCRIPTION_ENTRY)
+SBM_CONTROLLER_REGISTERS(SBM_DESCRIPTION_ENTRY)
+SBM_AT_RATE_REGISTERS(SBM_DESCRIPTION_ENTRY) };
+
+#define NUMBER_OF_STATIC_REGISTERS (0 SBM_STATIC_REGISTERS(SBM_COUNT_ENTRY))
+#define NUMBER_OF_DYNAMIC_REGISTERS (0 SBM_DYNAMIC_REGISTERS(SBM_COUNT_ENTRY))
+#define NUMBER_OF_NON_STANDARD_REGISTERS (0 SBM_NON_STANDARD_REGISTERS(SBM_COUNT_ENTRY))
+#define NUMBER_OF_CONTROLLER_REGISTERS (0 SBM_CONTROLLER_REGISTERS(SBM_COUNT_ENTRY))
+#define NUMBER_OF_AT_RATE_REGISTERS (0 SBM_AT_RATE_REGISTERS(SBM_COUNT_ENTRY))
+#define NUMBER_OF_REGISTERS (NUMBER_OF_STATIC_REGISTERS + NUMBER_OF_DYNAMIC_REGISTERS + NUMBER_OF_NON_STANDARD_REGISTERS \
+        + NUMBER_OF_CONTROLLER_REGISTERS + NUMBER_OF_AT_RATE_REGISTERS)
+// the non standard and the controller registers are polled with the same state array
+#define NUMBER_OF_OPTIONAL_REGISTERS (NUMBER_OF_NON_STANDARD_REGISTERS + NUMBER_OF_CONTROLLER_REGISTERS)
+#define SUPPORTED_REGISTER_MASK_SIZE ((NUMBER_OF_REGISTERS + 7) / 8)
+
+const struct SBMFunctionDescriptionStruct * const sSBMStaticFunctionDescriptionArray = sSBMFunctionDescriptionTable;
+const struct SBMFunctionDescriptionStruct * const sSBMDynamicFunctionDescriptionArray = &sSBMStaticFunctionDescriptionArray[NUMBER_OF_STATIC_REGISTERS];
+const struct SBMFunctionDescriptionStruct * const sSBMNonStandardFunctionDescriptionArray = &sSBMDynamicFunctionDescriptionArray[NUMBER_OF_DYNAMIC_REGISTERS];
+const struct SBMFunctionDescriptionStruct * const sSBMControllerFunctionDescriptionArray = &sSBMNonStandardFunctionDescriptionArray[NUMBER_OF_NON_STANDARD_REGISTERS];
+const struct SBMFunctionDescriptionStruct * const sSBMATRateFunctionDescriptionArray = &sSBMControllerFunctionDescriptionArray[NUMBER_OF_CONTROLLER_REGISTERS];
+
+#define SBM_REPORT_POLICY_ENTRY(aPolicy, aDeadband, aDeadbandPermille, aMinIntervalSeconds, aMaxIntervalSeconds) \
+    { aDeadband, aDeadbandPermille, aMinIntervalSeconds, aMaxIntervalSeconds },
+const struct SBMReportPolicyStruct sReportPolicyTable[] PROGMEM = {
+SBM_REPORT_POLICIES(SBM_REPORT_POLICY_ENTRY) };
+
+/*
+ * Controller drivers, see SBM_CONTROLLER_DRIVERS in SBMInfo.h
+ */
+#define SBM_CONTROLLER_BLOCK_STRINGS(aFunctionCode, aLength, aFormat, aDescription) \
+    const char sBlockDescription_##aFunctionCode[] PROGMEM = aDescription;
+#define SBM_CONTROLLER_BLOCK_ENTRY(aFunctionCode, aLength, aFormat, aDescription) \
+    { aFunctionCode, aLength, aFormat, sBlockDescription_##aFunctionCode },
+SBM_CONTROLLER_BLOCKS(SBM_CONTROLLER_BLOCK_STRINGS)
+const struct SBMControllerBlockStruct sControllerBlockTable[] PROGMEM = {
+SBM_CONTROLLER_BLOCKS(SBM_CONTROLLER_BLOCK_ENTRY) };
+#define NUMBER_OF_CONTROLLER_BLOCKS (0 SBM_CONTROLLER_BLOCKS(SBM_COUNT_ENTRY))
+
+/*
+ * ManufacturerAccess records, see SBM_MANUFACTURER_BLOCKS in SBMInfo.h
+ */
+#define SBM_MANUFACTURER_BLOCK_STRINGS(aCommand, aLength, aFormat, aDescription) \
+    const char sManufacturerBlockDescription_##aCommand[] PROGMEM = aDescription;
+#define SBM_MANUFACTURER_BLOCK_ENTRY(aCommand, aLength, aFormat, aDescription) \
+    { (uint8_t) aCommand, aLength, aFormat, sManufacturerBlockDescription_##aCommand },
+#define SBM_MANUFACTURER_BLOCK_CHECK(aCommand, aLength, aFormat, aDescription) \
+    static_assert(aCommand <= 0xFF && aLength <= DATA_BUFFER_LENGTH - 2, "Manufacturer block does not fit in table or buffer");
+SBM_MANUFACTURER_BLOCKS(SBM_MANUFACTURER_BLOCK_STRINGS)
+SBM_MANUFACTURER_BLOCKS(SBM_MANUFACTURER_BLOCK_CHECK)
+const struct SBMControllerBlockStruct sManufacturerBlockTable[] PROGMEM = {
+SBM_MANUFACTURER_BLOCKS(SBM_MANUFACTURER_BLOCK_ENTRY) };
+#define NUMBER_OF_MANUFACTURER_BLOCKS (0 SBM_MANUFACTURER_BLOCKS(SBM_COUNT_ENTRY))
+
+#define SBM_CONTROLLER_DRIVER_STRINGS(aDeviceType, aName, aFeatures, aRegisterMask, aBlockMask) \
+    const char sControllerName_##aDeviceType[] PROGMEM = aName;
+#define SBM_CONTROLLER_DRIVER_ENTRY(aDeviceType, aName, aFeatures, aRegisterMask, aBlockMask) \
+    { aDeviceType, sControllerName_##aDeviceType, aFeatures, aRegisterMask, aBlockMask },
+SBM_CONTROLLER_DRIVERS(SBM_CONTROLLER_DRIVER_STRINGS)
+const struct SBMControllerDriverStruct sControllerDriverTable[] PROGMEM = {
+SBM_CONTROLLER_DRIVERS(SBM_CONTROLLER_DRIVER_ENTRY) };
+#define NUMBER_OF_CONTROLLER_DRIVERS (0 SBM_CONTROLLER_DRIVERS(SBM_COUNT_ENTRY))
+#define CONTROLLER_UNKNOWN 0xFF // index of driver if the device type is unknown
+static_assert(NUMBER_OF_CONTROLLER_REGISTERS <= 8 && NUMBER_OF_CONTROLLER_BLOCKS <= 8,
+        "RegisterMask or BlockMask of SBMControllerDriverStruct is too small");
+
+#define INDEX_OF_DESIGN_VOLTAGE 3 // to retrieve value for mWh to mA conversion
+#define INDEX_OF_SPEC_INFO 6 // to retrieve value for PEC support
+
+/*
+ * Access to the members of the register table in program memory
+ */
+inline uint8_t getFunctionCode(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return pgm_read_byte(&aDescription->FunctionCode);
+}
+inline uint8_t getFormat(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return pgm_read_byte(&aDescription->Format);
+}
+inline uint16_t getPollPeriodMillis(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return pgm_read_word(&aDescription->PollPeriodMillis);
+}
+/*
+ * @return the value as signed number for FORMAT_CURRENT and FORMAT_SIGNED, else unsigned
+ */
+inline int32_t getNumericValue(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue) {
+    uint8_t tFormat = getFormat(aDescription);
+    if (tFormat == FORMAT_CURRENT || tFormat == FORMAT_SIGNED) {
+        return (int16_t) aValue;
+    }
+    return aValue;
+}
+inline const struct SBMReportPolicyStruct * getReportPolicy(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return &sReportPolicyTable[pgm_read_byte(&aDescription->ReportPolicy)];
+}
+inline const __FlashStringHelper * getDescription(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return (const __FlashStringHelper *) pgm_read_ptr(&aDescription->Description);
+}
+inline const __FlashStringHelper * getDescriptionLCD(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return (const __FlashStringHelper *) pgm_read_ptr(&aDescription->DescriptionLCD);
+}
+
+/*
+ * More than one pack can be monitored, if the packs are attached to the channels of TCA9548A I2C multiplexers.
+ * The description arrays above are shared, the values and the scheduler state of the registers are stored for each pack.
+ */
+#if !defined(MAX_NUMBER_OF_PACKS)
+#define MAX_NUMBER_OF_PACKS 4 // each pack requires 390 bytes of RAM, 486 with SHOW_SCHEDULER_STATISTICS, 726 with USE_REGISTER_STATISTICS
+#endif
+/*
+ * Identifies a pack, to detect if another pack was attached
+ */
+struct SBMPackIdentityStruct {
+    uint16_t SerialNumber;
+    uint16_t ManufactureDate;
+    uint8_t DeviceNameCRC;
+};
+
+struct SBMPackStruct {
+    SMBusDevice<SMBusTransport> Device; // address and PEC state
+    uint8_t MuxAddress; // MUX_NONE if pack is attached directly
+    uint8_t MuxChannel;
+    struct SBMPackIdentityStruct Identity;
+    bool IsRemoved; // pack does not answer, only its presence is checked
+    uint8_t FailedReads; // consecutive reads without answer
+    uint32_t NextPresenceCheckMillis;
+#if defined(TUNE_BUS_CLOCK)
+    uint8_t BusClockIndex; // index in sBusClockSteps
+    uint8_t BusErrorLevel; // leaky bucket of PEC and bus errors
+    uint16_t CheckedPECErrorCount; // PECErrorCount of Device already added to BusErrorLevel
+#endif
+    uint8_t SupportedRegisterMask[SUPPORTED_REGISTER_MASK_SIZE]; // bit n is set if entry n of sSBMFunctionDescriptionTable is supported
+    bool CapacityModePower; // false = current, true = power
+    uint16_t DesignVoltage; // for mWh to mA conversion
+    uint8_t ControllerIndex; // index in sControllerDriverTable or CONTROLLER_UNKNOWN
+    bool ManufacturerBlockAccess; // ManufacturerAccess records are read with one block access, cleared if this fails
+#if defined(USE_SNAPSHOT_POLLING)
+    uint32_t NextSnapshotMillis;
+#endif
+#if defined(USE_ADAPTIVE_POLLING)
+    uint8_t PollState; // POLL_STATE_*
+    uint16_t BatteryStatus;
+    int16_t Current;
+    uint16_t ReferenceVoltage; // to detect fast changes
+    uint32_t ReferenceVoltageMillis;
+    uint16_t ReferenceTemperature;
+    uint32_t ReferenceTemperatureMillis;
+    uint32_t LastEventMillis;
+#endif
+    struct SBMRegisterStateStruct DynamicRegisterStates[NUMBER_OF_DYNAMIC_REGISTERS];
+    struct SBMRegisterStateStruct OptionalRegisterStates[NUMBER_OF_OPTIONAL_REGISTERS]; // non standard and controller registers
+};
+struct SBMPackStruct sPacks[MAX_NUMBER_OF_PACKS];
+uint8_t sNumberOfPacks = 0;
+struct SBMPackStruct * sCurrentPack = &sPacks[0]; // pack accessed by readWord() etc. and printed by the value formatters
+
+uint8_t sSelectedMuxAddress = MUX_NONE;
+uint8_t sSelectedMuxChannel;
+
+void selectMuxChannel(uint8_t aMuxAddress, uint8_t aMuxChannel);
+void selectMuxChannelOfPack(struct SBMPackStruct * aPack);
+void printPackInfo(struct SBMPackStruct * aPack);
+void printIdentifiedPackInfo(struct SBMPackStruct * aPack, bool aIdentityIsValid);
+#if defined(TUNE_BUS_CLOCK)
+void tuneBusClock(struct SBMPackStruct * aPack);
+void selectBusClockOfPack(struct SBMPackStruct * aPack);
+void checkBusErrors(struct SBMPackStruct * aPack, uint8_t aStatus);
+#endif
+bool readPackIdentity(struct SBMPackIdentityStruct * aIdentity);
+void identifyController(struct SBMPackStruct * aPack);
+void initRegisterCapabilities(struct SBMPackStruct * aPack, bool aIdentityIsValid);
+bool isRegisterSupported(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aDescription);
+
+/*
+ * Snapshot of all dynamic registers of a pack.
+ * The registers are read back-to-back and the values are printed afterwards, so all values belong
+ * to the same point in time. Especially the power computed from voltage and current is only correct
+ * if both are read close together, since the current can change within milliseconds.
  */
-#define INDEX_OF_DESIGN_VOLTAGE 3 // to retrieve last value for mWh to mA conversion
-struct SBMFunctionDescriptionStruct sSBMStaticFunctionDescriptionArray[] = { {
-SERIAL_NUM, "Serial Number: " }, {
-MFG_DATE, "Manufacture Date (YYYY-MM-DD):", &printManufacturerDate }, {
-DESIGN_CAPACITY, "Design Capacity: ", &printCapacity }, {
-DESIGN_VOLTAGE, "Design Voltage: ", &printVoltage }, {
-CHARGING_CURRENT, "Charging Current: ", &printCurrent }, {
-CHARGING_VOLTAGE, "Charging Voltage: ", &printVoltage }, {
-SPEC_INFO, "Specification Info: " }, {
-CYCLE_COUNT, "Cycle Count: " }, {
-MAX_ERROR, "Max Error of charge calculation (%): " }, {
-REMAINING_TIME_ALARM, "RemainingTimeAlarm: ", &printTime }, {
-REMAINING_CAPACITY_ALARM, "Remaining Capacity Alarm: ", &printCapacity }, {
-BATTERY_MODE, "Battery Mode (BIN): 0b", &printBatteryMode }, {
-PACK_STATUS, "Pack Status (BIN): ", &printBinary } };
-
-struct SBMFunctionDescriptionStruct sSBMDynamicFunctionDescriptionArray[] = { {
-FULL_CHARGE_CAPACITY, "Full Charge Capacity: ", &printCapacity }, {
-REMAINING_CAPACITY, "Remaining Capacity: ", &printCapacity, "Capacity " }, {
-RELATIVE_SOC, "Relative Charge: ", &printPercentage, " rel Charge " }, {
-ABSOLUTE_SOC, "Absolute Charge(%): ", NULL, "% Abs Charge " }, {
-RUN_TIME_TO_EMPTY, "Minutes remaining until empty: ", &printTime }, {
-AVERAGE_TIME_TO_EMPTY, "Average minutes remaining until empty: ", &printTime, " min to Empty " }, {
-TIME_TO_FULL, "Minutes remaining for full charge: ", &printTime, " min to Full " }, {
-BATTERY_STATUS, "Battery Status (BIN): 0b", &printBatteryStatus }, {
-VOLTAGE, "Voltage: ", &printVoltage, "Voltage: " }, {
-CURRENT, "Current: ", &printCurrent, "Current: " }, {
-AverageCurrent, "Average Current of last minute: ", &printCurrent }, {
-TEMPERATURE, "Temperature: ", &printTemperature } };
-
-/*
- * These aren't part of the standard, but work with some packs.
- */
-int nonStandardInfoSupportedByPack = 0; // 0 not initialized, 1 supported, > 1 not supported
-struct SBMFunctionDescriptionStruct sSBMNonStandardFunctionDescriptionArray[] = { {
-CELL1_VOLTAGE, "Cell 1 Voltage: ", &printVoltage }, {
-CELL2_VOLTAGE, "Cell 2 Voltage: ", &printVoltage }, {
-CELL3_VOLTAGE, "Cell 3 Voltage: ", &printVoltage }, {
-CELL4_VOLTAGE, "Cell 4 Voltage: ", &printVoltage }, {
-STATE_OF_HEALTH, "State of Health: " } };
-
-bool sCapacityModePower = false; // false = current, true = power
-uint16_t sDesignVoltage; // to retrieve last value for mWh to mA conversion
-
-/*
- * Value depends on capacity mode
- */
-struct SBMFunctionDescriptionStruct sSBMATRateFunctionDescriptionArray[] = { {
-AtRateTimeToFull, "TimeToFull at rate: ", &printTime }, {
-AtRateTimeToEmpty, "TimeToEmpty at rate: ", &printTime }, {
-AtRateOK, "Can be delivered for 10 seconds at rate: " }, };
-
-struct SBMFunctionDescriptionStruct sSBMbq20z70FunctionDescriptionArray[] = { {
-BQ20Z70_ChargingStatus, "Charging Status: ", &printBinary }, {
-BQ20Z70_OperationStatus, "Operation Status: ", &printBinary }, {
-BQ20Z70_PackVoltage, "Pack Voltage: ", &printVoltage } };
+struct SBMSnapshotStruct {
+    uint32_t AcquisitionMillis; // start of acquisition, the timestamp of all values
+    uint32_t AcquisitionMicros; // duration of acquisition
+    uint32_t VoltageCurrentSkewMicros; // time between the reads of voltage and current
+    uint16_t ValidMask; // bit n is set if the read of register n of sSBMDynamicFunctionDescriptionArray was valid
+    uint16_t Values[NUMBER_OF_DYNAMIC_REGISTERS];
+};
+static_assert(NUMBER_OF_DYNAMIC_REGISTERS <= 16, "ValidMask of SBMSnapshotStruct is too small");
+struct SBMSnapshotStruct sSnapshot;
+#if defined(USE_SNAPSHOT_POLLING) && !defined(SNAPSHOT_PERIOD_MILLIS)
+#define SNAPSHOT_PERIOD_MILLIS 1000
+#endif
+void acquireSnapshot(struct SBMPackStruct * aPack, struct SBMSnapshotStruct * aSnapshot);
+void printSnapshot(struct SBMSnapshotStruct * aSnapshot, struct SBMRegisterStateStruct * aRegisterStates);
+#if defined(SHOW_SCHEDULER_STATISTICS)
+void printSnapshotTiming(struct SBMSnapshotStruct * aSnapshot);
+#endif
 
 /*
  * Program starts here
@@ -142,10 +460,17 @@ void setup() {
 // initialize the digital pin as an output.
     pinMode(LED_PIN, OUTPUT);
 
+#if defined(USE_HARDWARE_TWI)
+    // Shutdown SPI, timers, and ADC
+    PRR = (1 << PRSPI) | (1 << PRTIM1) | (1 << PRTIM2) | (1 << PRADC);
+#else
     // Shutdown SPI and TWI, timers, and ADC
     PRR = (1 << PRSPI) | (1 << PRTWI) | (1 << PRTIM1) | (1 << PRTIM2) | (1 << PRADC);
+#endif
+#if !defined(USE_PIN_DISCOVERY)
     // Disable  digital input on all unused ADC channel pins to reduce power consumption
     DIDR0 = ADC0D | ADC1D | ADC2D | ADC3D;
+#endif
 
     Serial.begin(115200);
     while (!Serial) {
@@ -153,31 +478,38 @@ void setup() {
     }
 
     // set up the LCD's number of columns and rows:
-    myLCD.begin(20, 4);
+    myShadowLCD.begin();
     Serial.println(F("START SBMInfo\r\nVersion " VERSION " from " __DATE__));
-    myLCD.print(F("SBMInfo " VERSION));
-    myLCD.setCursor(0, 1);
-    myLCD.print(F(__DATE__));
+    myShadowLCD.print(F("SBMInfo " VERSION));
+    myShadowLCD.setCursor(0, 1);
+    myShadowLCD.print(F(__DATE__));
+    myShadowLCD.renderAll();
+#if defined(SHOW_FORMAT_BENCHMARK)
+    printFormatBenchmark();
+#endif
     /*
      * The workaround to set __FILE__ with #line __LINE__ "LightToServo.cpp" disables source output including in .lss file (-S option)
      */
 
-    bool tI2CSucessfullyInitialized = i2c_init();
+#if defined(USE_PIN_DISCOVERY)
+    discoverPins();
+#endif
+    bool tI2CSucessfullyInitialized = SMBusTransport::init();
 
     if (tI2CSucessfullyInitialized) {
         Serial.println(F("I2C initalized sucessfully"));
     } else {
         Serial.println(F("I2C pullups missing"));
-        myLCD.setCursor(0, 2);
-        myLCD.print(F("I2C pullups missing"));
+        myShadowLCD.setCursor(0, 2);
+        myShadowLCD.print(F("I2C pullups missing"));
+        myShadowLCD.renderAll();
         BlinkLedForever(100);
     }
-    Serial.flush();
 
     /*
-     * Check for I2C device and blink until device attached
+     * Check for packs and blink until device attached
      */
-    if (!checkForAttachedI2CDevice(SBM_DEVICE_ADDRESS)) {
+    if (discoverPacks() == 0) {
         int tDeviceAttached;
         do {
             tDeviceAttached = scanForAttachedI2CDevice();
@@ -186,6 +518,38 @@ void setup() {
         } while (tDeviceAttached < 0);
     }
 
+    for (uint8_t i = 0; i < sNumberOfPacks; ++i) {
+        printPackInfo(&sPacks[i]);
+    }
+
+    Serial.println(F("\r\n*** CHANGED VALUES ***"));
+#if defined(USE_BINARY_TELEMETRY)
+    startTelemetry();
+#endif
+    initPollScheduler();
+#if defined(USE_CURVE_LOG)
+    initCurveLog();
+#endif
+}
+
+#define PACK_IDENTITY_READ_TRIES 3 // a NAK of one of the identity reads at startup would disable the caches for this pack
+/*
+ * Prints all info of one pack and initializes its register values
+ */
+void printPackInfo(struct SBMPackStruct * aPack) {
+    sCurrentPack = aPack;
+    if (sNumberOfPacks > 1) {
+        Serial.print(F("\r\n\r\n*** PACK "));
+        Serial.print((int) (aPack - sPacks) + 1);
+        if (aPack->MuxAddress != MUX_NONE) {
+            Serial.print(F(" at multiplexer 0x"));
+            Serial.print(aPack->MuxAddress, HEX);
+            Serial.print(F(" channel "));
+            Serial.print(aPack->MuxChannel);
+        }
+        Serial.println(F(" ***"));
+    }
+
     uint16_t tVoltage;
     do {
         tVoltage = readWord(VOLTAGE);
@@ -193,324 +557,2669 @@ void setup() {
         TogglePin(LED_PIN);
     } while (tVoltage == 0xFFFF);
 
-    Serial.println(F("\r\n*** STATIC INFO ***"));
-    Serial.flush(); // in order not to interfere with i2c timing
-    printSMBStaticInfo();
+    bool tIdentityIsValid = false;
+    for (uint8_t i = 0; i < PACK_IDENTITY_READ_TRIES && !tIdentityIsValid; ++i) {
+        tIdentityIsValid = readPackIdentity(&aPack->Identity);
+    }
+    if (!tIdentityIsValid) {
+        Serial.println(F("Identity of pack could not be read -> info is not cached"));
+    }
+    printIdentifiedPackInfo(aPack, tIdentityIsValid);
+}
+
+/*
+ * Static register values of the last packs attached since start.
+ * If a known pack is attached again, its static info is printed from here and its manufacturer and rate test info is skipped.
+ * The values are not stored in EEPROM, since some of them, like the cycle count, change during the life of a pack.
+ */
+#if !defined(STATIC_INFO_CACHE_SIZE)
+#define STATIC_INFO_CACHE_SIZE 2 // each entry requires 31 bytes of RAM
+#endif
+struct StaticInfoCacheEntryStruct {
+    struct SBMPackIdentityStruct Identity;
+    uint16_t Values[NUMBER_OF_STATIC_REGISTERS];
+};
+struct StaticInfoCacheEntryStruct sStaticInfoCache[STATIC_INFO_CACHE_SIZE];
+uint8_t sStaticInfoCacheCount = 0;
+uint8_t sStaticInfoCacheNextEntry = 0; // the entry to be replaced next
+
+struct StaticInfoCacheEntryStruct * findStaticInfoCacheEntry(struct SBMPackIdentityStruct * aIdentity) {
+    for (uint8_t i = 0; i < sStaticInfoCacheCount; ++i) {
+        if (memcmp(&sStaticInfoCache[i].Identity, aIdentity, sizeof(struct SBMPackIdentityStruct)) == 0) {
+            return &sStaticInfoCache[i];
+        }
+    }
+    return NULL;
+}
+
+void storeStaticInfoCacheEntry(struct SBMPackIdentityStruct * aIdentity, uint16_t * aValues) {
+    struct StaticInfoCacheEntryStruct * tEntry = &sStaticInfoCache[sStaticInfoCacheNextEntry];
+    tEntry->Identity = *aIdentity;
+    memcpy(tEntry->Values, aValues, sizeof(tEntry->Values));
+    sStaticInfoCacheNextEntry = (sStaticInfoCacheNextEntry + 1) % STATIC_INFO_CACHE_SIZE;
+    if (sStaticInfoCacheCount < STATIC_INFO_CACHE_SIZE) {
+        sStaticInfoCacheCount++;
+    }
+}
+
+/*
+ * Prints all info of the current pack after its identity was read.
+ * An invalid identity could match another pack, so the caches are then neither read nor written.
+ */
+void printIdentifiedPackInfo(struct SBMPackStruct * aPack, bool aIdentityIsValid) {
+    aPack->CapacityModePower = false;
+    identifyController(aPack);
+    initRegisterCapabilities(aPack, aIdentityIsValid);
+
+    uint16_t tStaticValues[NUMBER_OF_STATIC_REGISTERS];
+    struct StaticInfoCacheEntryStruct * tCacheEntry = NULL;
+    if (aIdentityIsValid) {
+        tCacheEntry = findStaticInfoCacheEntry(&aPack->Identity);
+    }
+    if (tCacheEntry != NULL) {
+        Serial.println(F("\r\n*** STATIC INFO (known pack) ***"));
+        memcpy(tStaticValues, tCacheEntry->Values, sizeof(tStaticValues));
+    } else {
+        Serial.println(F("\r\n*** STATIC INFO ***"));
+    }
+    uint16_t tSpecificationInfo = printSMBStaticInfo(tStaticValues, tCacheEntry != NULL);
+#if defined(SUPPORT_PEC)
+    checkPECSupport(tSpecificationInfo);
+#else
+    (void) tSpecificationInfo;
+#endif
+
+    if (tCacheEntry == NULL) {
+        if (aIdentityIsValid) {
+            storeStaticInfoCacheEntry(&aPack->Identity, tStaticValues);
+        }
+
+        Serial.println(F("\r\n*** MANUFACTURER INFO ***"));
+        printSMBManufacturerInfo();
+
+        Serial.println(F("\r\n*** RATE TEST INFO ***"));
+        printSMBATRateInfo();
+#if defined(SHOW_AT_RATE_SWEEP)
+        Serial.println(F("\r\n*** AT RATE SWEEP ***"));
+        printAtRateSweep();
+#endif
+    }
+#if defined(TUNE_BUS_CLOCK)
+    tuneBusClock(aPack);
+#endif
+
+    Serial.println(F("\r\n*** DYNAMIC INFO ***"));
+    acquireSnapshot(aPack, &sSnapshot);
+    printSnapshot(&sSnapshot, aPack->DynamicRegisterStates);
+#if defined(SHOW_SCHEDULER_STATISTICS)
+    printSnapshotTiming(&sSnapshot);
+#endif
+
+    Serial.println(F("\r\n*** DYNAMIC NON STANDARD INFO ***"));
+    printSMBNonStandardInfo(false);
+}
+
+/*
+ * Never blocks, every call polls at most one register which is due and prints at most one changed value
+ */
+void loop() {
+#if defined(USE_TRIGGER_CAPTURE)
+    if (!captureNextSample()) {
+        pollNextDueRegister();
+    }
+#else
+    pollNextDueRegister();
+#endif
+    printQueuedOutput();
+    myShadowLCD.render(LCD_MAX_CELLS_PER_LOOP);
+#if defined(USE_CURVE_LOG)
+    logCurve();
+#endif
+#if defined(USE_CURVE_LOG) || defined(USE_TRIGGER_CAPTURE) || defined(USE_DATA_FLASH_DUMP)
+    if (Serial.available() > 0) {
+        char tCommand = Serial.read();
+#  if defined(USE_CURVE_LOG)
+        if (tCommand == CURVE_LOG_DUMP_COMMAND) {
+            dumpCurveLog();
+        }
+#  endif
+#  if defined(USE_TRIGGER_CAPTURE)
+        if (tCommand == CAPTURE_TRIGGER_COMMAND) {
+            triggerCapture(F("Command"), 0);
+        }
+#  endif
+#  if defined(USE_DATA_FLASH_DUMP)
+        if (tCommand == DATA_FLASH_DUMP_COMMAND || tCommand == DATA_FLASH_CHANGES_COMMAND) {
+            dumpDataFlash(tCommand == DATA_FLASH_CHANGES_COMMAND);
+        }
+#  endif
+    }
+#endif
+#if defined(SHOW_SCHEDULER_STATISTICS)
+    printSchedulerStatistics();
+#endif
+#if defined(USE_REGISTER_STATISTICS)
+    printRegisterStatistics();
+#endif
+}
+
+void TogglePin(uint8_t aPinNr) {
+    if (digitalRead(aPinNr) == HIGH) {
+        digitalWrite(aPinNr, LOW);
+    } else {
+        digitalWrite(aPinNr, HIGH);
+    }
+}
+
+void BlinkLedForever(int aBinkDelay) {
+    do {
+        digitalWrite(LED_PIN, HIGH);
+        delay(aBinkDelay);
+        digitalWrite(LED_PIN, LOW);
+        delay(aBinkDelay);
+    } while (true);
+}
+
+bool isI2CDeviceAttached(uint8_t aI2CDeviceAddress) {
+    return SMBusTransport::quickCommand(aI2CDeviceAddress) == SMBUS_STATUS_OK;
+}
+
+bool checkForAttachedI2CDevice(uint8_t aStandardDeviceAddress) {
+    if (isI2CDeviceAttached(aStandardDeviceAddress)) {
+        Serial.print(F("Found attached I2C device at 0x"));
+        Serial.println(aStandardDeviceAddress, HEX);
+        return true;
+    } else {
+        return false;
+    }
+}
+
+int sScanCount = 0;
+int scanForAttachedI2CDevice(void) {
+    int tFoundAdress = -1;
+    for (uint8_t i = 0; i < 127; i++) {
+        if (isI2CDeviceAttached(i)) {
+            Serial.print(F("Found I2C device attached at address: 0x"));
+            Serial.println(i, HEX);
+            tFoundAdress = i;
+        }
+    }
+    if (tFoundAdress < 0) {
+        Serial.print(F("Found no attached I2C device - "));
+        Serial.println(sScanCount);
+        myShadowLCD.setCursor(0, 3);
+        // print the number of seconds since reset:
+        myShadowLCD.print("No device ");
+        myShadowLCD.print(sScanCount);
+        myShadowLCD.renderAll();
+        sScanCount++;
+    } else {
+        sPacks[0].Device.Address = tFoundAdress;
+        sPacks[0].MuxAddress = MUX_NONE;
+        sNumberOfPacks = 1;
+    }
+    return tFoundAdress;
+}
+
+#if defined(USE_PIN_DISCOVERY)
+const uint8_t sPinDiscoveryCandidatePins[] PROGMEM = { PIN_DISCOVERY_CANDIDATE_PINS };
+#define NUMBER_OF_PIN_DISCOVERY_CANDIDATE_PINS (sizeof(sPinDiscoveryCandidatePins) / sizeof(sPinDiscoveryCandidatePins[0]))
+
+/*
+ * Probes each pair of candidate pins as SDA and SCL with a quick command until a device acknowledges.
+ * Pairs with a line held low are skipped. The first pass checks only the Smart Battery address 0x0B,
+ * the second pass all addresses, e.g. for a multiplexer. Blinks until a device is found.
+ */
+void discoverPins(void) {
+    Serial.println(F("Searching SDA and SCL pins"));
+    uint32_t tStartMillis = millis();
+    while (true) {
+        for (uint8_t tPass = 0; tPass < 2; ++tPass) {
+            for (uint8_t tSDAIndex = 0; tSDAIndex < NUMBER_OF_PIN_DISCOVERY_CANDIDATE_PINS; ++tSDAIndex) {
+                uint8_t tSDAPin = pgm_read_byte(&sPinDiscoveryCandidatePins[tSDAIndex]);
+                for (uint8_t tSCLIndex = 0; tSCLIndex < NUMBER_OF_PIN_DISCOVERY_CANDIDATE_PINS; ++tSCLIndex) {
+                    uint8_t tSCLPin = pgm_read_byte(&sPinDiscoveryCandidatePins[tSCLIndex]);
+                    if (tSCLIndex == tSDAIndex) {
+                        continue;
+                    }
+                    SMBusTransport::setPins(tSDAPin, tSCLPin);
+                    if (!DigitalPinI2CBus::isIdle()) {
+                        continue;
+                    }
+                    uint8_t tAddress = SBM_DEVICE_ADDRESS;
+                    uint8_t tLastAddress = SBM_DEVICE_ADDRESS;
+                    if (tPass > 0) {
+                        tAddress = 1;
+                        tLastAddress = 126;
+                    }
+                    for (; tAddress <= tLastAddress; ++tAddress) {
+                        if (isI2CDeviceAttached(tAddress)) {
+                            Serial.print(F("Found I2C device at 0x"));
+                            Serial.print(tAddress, HEX);
+                            Serial.print(F(" with SDA at pin "));
+                            Serial.print(tSDAPin);
+                            Serial.print(F(" and SCL at pin "));
+                            Serial.print(tSCLPin);
+                            Serial.print(F(" after "));
+                            Serial.print(millis() - tStartMillis);
+                            Serial.println(F(" ms"));
+                            myShadowLCD.setCursor(0, 3);
+                            myShadowLCD.print(F("SDA pin "));
+                            myShadowLCD.print(tSDAPin);
+                            myShadowLCD.print(F(" SCL pin "));
+                            myShadowLCD.print(tSCLPin);
+                            myShadowLCD.renderAll();
+                            return;
+                        }
+                    }
+                }
+            }
+        }
+        delay(500);
+        TogglePin(LED_PIN);
+    }
+}
+#endif
+
+/*
+ * Enables one channel of one multiplexer and disables the channels of the multiplexer selected before.
+ * MUX_NONE only disables the multiplexer selected before.
+ */
+void selectMuxChannel(uint8_t aMuxAddress, uint8_t aMuxChannel) {
+    if (aMuxAddress == sSelectedMuxAddress && (aMuxAddress == MUX_NONE || aMuxChannel == sSelectedMuxChannel)) {
+        return;
+    }
+    if (sSelectedMuxAddress != MUX_NONE && sSelectedMuxAddress != aMuxAddress) {
+        SMBusTransport::sendByte(sSelectedMuxAddress, 0);
+    }
+    if (aMuxAddress != MUX_NONE) {
+        SMBusTransport::sendByte(aMuxAddress, 1 << aMuxChannel);
+    }
+    sSelectedMuxAddress = aMuxAddress;
+    sSelectedMuxChannel = aMuxChannel;
+}
+
+/*
+ * Also selects the bus clock of the pack
+ */
+void selectMuxChannelOfPack(struct SBMPackStruct * aPack) {
+    selectMuxChannel(aPack->MuxAddress, aPack->MuxChannel);
+#if defined(TUNE_BUS_CLOCK)
+    selectBusClockOfPack(aPack);
+#endif
+}
+
+void addPack(uint8_t aMuxAddress, uint8_t aMuxChannel) {
+    if (sNumberOfPacks < MAX_NUMBER_OF_PACKS) {
+        struct SBMPackStruct * tPack = &sPacks[sNumberOfPacks++];
+        tPack->Device.Address = SBM_DEVICE_ADDRESS;
+        tPack->MuxAddress = aMuxAddress;
+        tPack->MuxChannel = aMuxChannel;
+    }
+}
+
+/*
+ * A directly attached pack hides all packs behind the multiplexers, since they have the same address.
+ * So the multiplexer channels are only searched if there is no pack attached directly.
+ * @return number of packs found
+ */
+uint8_t discoverPacks(void) {
+    sNumberOfPacks = 0;
+    uint8_t tFoundMuxMask = 0;
+#if MAX_NUMBER_OF_PACKS > 1
+    for (uint8_t i = 0; i < MUX_MAX_NUMBER; ++i) {
+        // disable all channels, they may be still enabled after a reset of the Arduino
+        if (SMBusTransport::sendByte(MUX_BASE_ADDRESS + i, 0) == SMBUS_STATUS_OK) {
+            tFoundMuxMask |= 1 << i;
+            Serial.print(F("Found I2C multiplexer at 0x"));
+            Serial.println(MUX_BASE_ADDRESS + i, HEX);
+        }
+    }
+    sSelectedMuxAddress = MUX_NONE;
+#endif
+
+    if (checkForAttachedI2CDevice(SBM_DEVICE_ADDRESS)) {
+        addPack(MUX_NONE, 0);
+        return sNumberOfPacks;
+    }
+
+    for (uint8_t i = 0; i < MUX_MAX_NUMBER; ++i) {
+        if (tFoundMuxMask & (1 << i)) {
+            for (uint8_t tChannel = 0; tChannel < MUX_NUMBER_OF_CHANNELS; ++tChannel) {
+                selectMuxChannel(MUX_BASE_ADDRESS + i, tChannel);
+                if (isI2CDeviceAttached(SBM_DEVICE_ADDRESS)) {
+                    Serial.print(F("Found pack at multiplexer 0x"));
+                    Serial.print(MUX_BASE_ADDRESS + i, HEX);
+                    Serial.print(F(" channel "));
+                    Serial.println(tChannel);
+                    addPack(MUX_BASE_ADDRESS + i, tChannel);
+                }
+            }
+        }
+    }
+    selectMuxChannel(MUX_NONE, 0);
+    if (sNumberOfPacks == MAX_NUMBER_OF_PACKS) {
+        Serial.print(F("Maximum number of packs reached: "));
+        Serial.println(MAX_NUMBER_OF_PACKS);
+    }
+    return sNumberOfPacks;
+}
+
+/*
+ * The following functions access the current pack
+ */
+int readWord(uint8_t aFunction) {
+    selectMuxChannelOfPack(sCurrentPack);
+    return sCurrentPack->Device.readWord(aFunction);
+}
+
+void writeWord(uint8_t aFunction, uint16_t aValue) {
+    selectMuxChannelOfPack(sCurrentPack);
+    sCurrentPack->Device.writeWord(aFunction, aValue);
+}
+
+int readWordFromManufacturerAccess(uint16_t aCommand) {
+    selectMuxChannelOfPack(sCurrentPack);
+    return sCurrentPack->Device.readWordFromManufacturerAccess(aCommand);
+}
+
+uint8_t readBlock(uint8_t aCommand, uint8_t* aDataBufferPtr, uint8_t aDataBufferLength) {
+    selectMuxChannelOfPack(sCurrentPack);
+    return sCurrentPack->Device.readBlock(aCommand, aDataBufferPtr, aDataBufferLength);
+}
+
+/*
+ * Reads the record of a ManufacturerAccess command into sI2CDataBuffer.
+ * With ManufacturerBlockAccess the whole record is read with one block write and one block read.
+ * Otherwise, or if this fails, only the first word of the record is read with ManufacturerAccess.
+ * @return number of bytes of the record in sI2CDataBuffer, 0 if the read failed
+ */
+uint8_t readManufacturerRecord(uint16_t aCommand) {
+    if (sCurrentPack->ManufacturerBlockAccess) {
+        selectMuxChannelOfPack(sCurrentPack);
+        uint8_t tLength = sCurrentPack->Device.readBlockFromManufacturerBlockAccess(aCommand, sI2CDataBuffer,
+                DATA_BUFFER_LENGTH);
+        if (sCurrentPack->Device.LastReadIsValid) {
+            return tLength;
+        }
+        // e.g. an older firmware, use the word path until the pack is identified again
+        sCurrentPack->ManufacturerBlockAccess = false;
+    }
+    uint16_t tWord = readWordFromManufacturerAccess(aCommand);
+    sI2CDataBuffer[0] = tWord;
+    sI2CDataBuffer[1] = tWord >> 8;
+    return sCurrentPack->Device.LastReadIsValid ? 2 : 0;
+}
+
+/*
+ * @return the first word of the record, 0xFFFF if the read failed
+ */
+uint16_t readManufacturerWord(uint16_t aCommand) {
+    readManufacturerRecord(aCommand);
+    return sI2CDataBuffer[0] | (sI2CDataBuffer[1] << 8);
+}
+
+#if defined(TUNE_BUS_CLOCK)
+/*
+ * Bus clock tuning.
+ * Starting with the lowest clock of sBusClockSteps, each step is validated by BUS_CLOCK_VALIDATION_READS reads of the
+ * stable registers DesignCapacity and SerialNumber, which must all answer with the value read at the lowest clock
+ * and, if enabled, with a valid PEC. The first step with an error ends the search.
+ * A faster step is only taken if its reads are at least BUS_CLOCK_MIN_GAIN_PERCENT shorter. For a pack which stretches
+ * the clock after each byte, like the bq2084, a faster clock gains nearly nothing, but reduces the margin.
+ * While polling, PEC and bus errors fill a leaky bucket. If it overflows, the clock of the pack is reduced by one step.
+ * A removed pack is checked with the lowest clock, since another pack may be inserted.
+ */
+#define BUS_CLOCK_VALIDATION_READS  8
+#define BUS_CLOCK_MIN_GAIN_PERCENT  10
+#define BUS_ERROR_WEIGHT            8 // one error leaks out after 8 reads without error
+#define BUS_ERROR_LIMIT             24 // 3 errors within a few reads reduce the clock
+#define READ_WORD_BITS              49 // start, 3 address, command and 2 data bytes each with acknowledge, repeated start and stop
+const uint32_t sBusClockSteps[] PROGMEM = { 25000, 50000, 100000, 200000, 400000 };
+#define NUMBER_OF_BUS_CLOCK_STEPS (sizeof(sBusClockSteps) / sizeof(sBusClockSteps[0]))
+uint8_t sSelectedBusClockIndex = 0xFF; // the transport starts with its default clock
+
+uint32_t getBusClock(uint8_t aIndex) {
+    return pgm_read_dword(&sBusClockSteps[aIndex]);
+}
+
+void selectBusClock(uint8_t aIndex) {
+    if (aIndex != sSelectedBusClockIndex) {
+        SMBusTransport::setClock(getBusClock(aIndex));
+        sSelectedBusClockIndex = aIndex;
+    }
+}
+
+void selectBusClockOfPack(struct SBMPackStruct * aPack) {
+    selectBusClock(aPack->IsRemoved ? 0 : aPack->BusClockIndex);
+}
+
+/*
+ * Reads without the retries of SMBusDevice, since every error counts
+ * @return average duration of one read in microseconds or 0 if a read failed or returned another value
+ */
+uint16_t validateBusClock(struct SBMPackStruct * aPack, uint16_t aDesignCapacity) {
+    uint32_t tStartMicros = micros();
+    for (uint8_t i = 0; i < BUS_CLOCK_VALIDATION_READS; ++i) {
+        uint8_t tCommand = DESIGN_CAPACITY;
+        uint16_t tExpectedValue = aDesignCapacity;
+        if (i & 0x01) {
+            tCommand = SERIAL_NUM;
+            tExpectedValue = aPack->Identity.SerialNumber;
+        }
+        uint16_t tValue;
+        if (SMBusTransport::readWord(aPack->Device.Address, tCommand, &tValue, aPack->Device.PECEnabled) != SMBUS_STATUS_OK
+                || tValue != tExpectedValue) {
+            return 0;
+        }
+    }
+    return (micros() - tStartMicros) / BUS_CLOCK_VALIDATION_READS;
+}
+
+/*
+ * Prints the duration of a read for each clock step and the part of it which is not explained by the bits transferred,
+ * i.e. the clock stretching of the pack and the overhead of the transport
+ */
+void tuneBusClock(struct SBMPackStruct * aPack) {
+    Serial.println(F("\r\n*** BUS CLOCK ***"));
+    aPack->BusClockIndex = 0;
+    aPack->BusErrorLevel = 0;
+    aPack->CheckedPECErrorCount = aPack->Device.PECErrorCount;
+    selectMuxChannelOfPack(aPack);
+    uint16_t tDesignCapacity = aPack->Device.readWord(DESIGN_CAPACITY);
+    uint8_t tReadBits = READ_WORD_BITS + (aPack->Device.PECEnabled ? 9 : 0);
+    uint16_t tSlowestReadMicros = 0;
+    uint16_t tSelectedReadMicros = 0;
+    for (uint8_t i = 0; i < NUMBER_OF_BUS_CLOCK_STEPS; ++i) {
+        selectBusClock(i);
+        uint16_t tReadMicros = validateBusClock(aPack, tDesignCapacity);
+        Serial.print(getBusClock(i) / 1000);
+        Serial.print(F(" kHz: "));
+        if (tReadMicros == 0) {
+            Serial.println(F("errors"));
+            break;
+        }
+        uint16_t tBitMicros = (tReadBits * 1000000UL) / getBusClock(i);
+        Serial.print(tReadMicros);
+        Serial.print(F(" us per read, "));
+        Serial.print(tReadMicros > tBitMicros ? tReadMicros - tBitMicros : 0);
+        Serial.println(F(" us stretched or overhead"));
+        if (tSlowestReadMicros == 0) {
+            tSlowestReadMicros = tReadMicros;
+            tSelectedReadMicros = tReadMicros;
+        } else if ((uint32_t) tReadMicros * 100 <= (uint32_t) tSelectedReadMicros * (100 - BUS_CLOCK_MIN_GAIN_PERCENT)) {
+            aPack->BusClockIndex = i;
+            tSelectedReadMicros = tReadMicros;
+        }
+    }
+    selectBusClock(aPack->BusClockIndex);
+    Serial.print(F("Selected "));
+    Serial.print(getBusClock(aPack->BusClockIndex) / 1000);
+    Serial.print(F(" kHz"));
+    if (aPack->BusClockIndex > 0) {
+        Serial.print(F(", "));
+        Serial.print(1000000UL / tSelectedReadMicros);
+        Serial.print(F(" instead of "));
+        Serial.print(1000000UL / tSlowestReadMicros);
+        Serial.print(F(" reads per second"));
+    }
+    Serial.println();
+}
+
+/*
+ * Called after each poll with the status of the read
+ */
+void checkBusErrors(struct SBMPackStruct * aPack, uint8_t aStatus) {
+    uint8_t tErrors = aPack->Device.PECErrorCount - aPack->CheckedPECErrorCount;
+    aPack->CheckedPECErrorCount = aPack->Device.PECErrorCount;
+    if (aStatus == SMBUS_STATUS_BUS_ERROR) {
+        tErrors++;
+    }
+    if (tErrors == 0) {
+        if (aPack->BusErrorLevel > 0) {
+            aPack->BusErrorLevel--;
+        }
+        return;
+    }
+    aPack->BusErrorLevel += tErrors * BUS_ERROR_WEIGHT;
+    if (aPack->BusErrorLevel >= BUS_ERROR_LIMIT) {
+        aPack->BusErrorLevel = 0;
+        if (aPack->BusClockIndex > 0) {
+            aPack->BusClockIndex--;
+#if !defined(USE_BINARY_TELEMETRY)
+            Serial.print(F("Pack "));
+            Serial.print((int) (aPack - sPacks) + 1);
+            Serial.print(F(" bus clock reduced to "));
+            Serial.print(getBusClock(aPack->BusClockIndex) / 1000);
+            Serial.println(F(" kHz"));
+#endif
+        }
+    }
+}
+#endif // defined(TUNE_BUS_CLOCK)
+
+/*
+ * Register capabilities of a pack.
+ * Every register of sSBMFunctionDescriptionTable is probed once at start and classified.
+ * Only supported registers are printed and polled afterwards, so the bus time is not wasted for registers
+ * a pack does not have. The result is stored in EEPROM for the next start, see CACHE_REGISTER_CAPABILITIES.
+ */
+#define REGISTER_SUPPORTED      0
+#define REGISTER_NAK            1 // no valid answer
+#define REGISTER_CONSTANT_FFFF  2 // valid answer, but always 0xFFFF
+#define REGISTER_ALIASED        3 // optional register which only repeats the value of another optional register
+
+inline uint8_t getRegisterIndex(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return aDescription - sSBMFunctionDescriptionTable;
+}
+
+/*
+ * The non standard and the controller registers are not part of the standard
+ */
+bool isOptionalRegister(uint8_t aIndex) {
+    return aIndex >= NUMBER_OF_STATIC_REGISTERS + NUMBER_OF_DYNAMIC_REGISTERS
+            && aIndex < NUMBER_OF_STATIC_REGISTERS + NUMBER_OF_DYNAMIC_REGISTERS + NUMBER_OF_OPTIONAL_REGISTERS;
+}
+
+bool isControllerRegister(uint8_t aIndex) {
+    return (uint8_t) (aIndex - getRegisterIndex(sSBMControllerFunctionDescriptionArray)) < NUMBER_OF_CONTROLLER_REGISTERS;
+}
 
-    Serial.println(F("\r\n*** MANUFACTURER INFO ***"));
-    Serial.flush();
-    printSMBManufacturerInfo();
+/*
+ * @return false for a controller register which the controller of the pack does not have according to its driver
+ */
+bool isRegisterOfController(struct SBMPackStruct * aPack, uint8_t aIndex) {
+    if (!isControllerRegister(aIndex)) {
+        return true;
+    }
+    return aPack->ControllerIndex != CONTROLLER_UNKNOWN
+            && (pgm_read_byte(&sControllerDriverTable[aPack->ControllerIndex].RegisterMask)
+                    & (1 << (aIndex - getRegisterIndex(sSBMControllerFunctionDescriptionArray))));
+}
 
-    Serial.println(F("\r\n*** RATE TEST INFO ***"));
-    Serial.flush();
-    printSMBATRateInfo();
+bool isRegisterSupported(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aDescription) {
+    uint8_t tIndex = getRegisterIndex(aDescription);
+    return aPack->SupportedRegisterMask[tIndex / 8] & (1 << (tIndex % 8));
+}
+
+/*
+ * Reads a register twice, to distinguish an unsupported register from a transmit error
+ */
+uint8_t classifyRegister(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t * aValue) {
+    uint8_t tFunctionCode = getFunctionCode(aDescription);
+    *aValue = readWord(tFunctionCode);
+    if (!sCurrentPack->Device.LastReadIsValid) {
+        *aValue = readWord(tFunctionCode);
+        if (!sCurrentPack->Device.LastReadIsValid) {
+            return REGISTER_NAK;
+        }
+    }
+    // 0xFFFF is a valid value for times, e.g. TimeToFull while discharging
+    if (*aValue == 0xFFFF && getFormat(aDescription) != FORMAT_TIME) {
+        *aValue = readWord(tFunctionCode);
+        if (*aValue == 0xFFFF) {
+            return REGISTER_CONSTANT_FFFF;
+        }
+    }
+    return REGISTER_SUPPORTED;
+}
+
+/*
+ * Some packs answer unknown commands with the value of the last valid command.
+ * Such an optional register has the same value as another optional register, but a different format,
+ * e.g. the State of Health of the HP pack returns Cell 4 Voltage.
+ * Only registers of different formats are compared, since the voltages of balanced cells are often equal.
+ */
+bool isRegisterAliased(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t * aValues) {
+    uint8_t tIndex = getRegisterIndex(aDescription);
+    for (uint8_t i = 0; i < tIndex; ++i) {
+        const struct SBMFunctionDescriptionStruct * tOtherDescription = &sSBMFunctionDescriptionTable[i];
+        if (isOptionalRegister(i) && aValues[i] == aValues[tIndex] && getFormat(tOtherDescription) != getFormat(aDescription)) {
+            // read again in reverse order, to exclude an equal value by chance
+            uint16_t tOtherValue = readWord(getFunctionCode(tOtherDescription));
+            if (readWord(getFunctionCode(aDescription)) == tOtherValue) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void printRegisterClass(uint8_t aClass) {
+    if (aClass == REGISTER_NAK) {
+        Serial.println(F("no answer"));
+    } else if (aClass == REGISTER_CONSTANT_FFFF) {
+        Serial.println(F("always 0xFFFF"));
+    } else {
+        Serial.println(F("same value as other register"));
+    }
+}
+
+/*
+ * Probes all registers of the current pack and sets its SupportedRegisterMask.
+ * The controller registers which the controller does not have are not probed.
+ */
+void probeRegisters(struct SBMPackStruct * aPack) {
+    uint16_t tValues[NUMBER_OF_REGISTERS];
+    uint8_t tNumberOfSupportedRegisters = 0;
+    memset(aPack->SupportedRegisterMask, 0, sizeof(aPack->SupportedRegisterMask));
+    for (uint8_t i = 0; i < NUMBER_OF_REGISTERS; ++i) {
+        const struct SBMFunctionDescriptionStruct * tDescription = &sSBMFunctionDescriptionTable[i];
+        if (!isRegisterOfController(aPack, i)) {
+            tValues[i] = 0xFFFF; // is never the value of a supported optional register, see isRegisterAliased()
+            continue;
+        }
+        uint8_t tClass = classifyRegister(tDescription, &tValues[i]);
+        // the driver guarantees that the controller registers exist, a status of 0 would look like an alias of an empty cell
+        if (tClass == REGISTER_SUPPORTED && isOptionalRegister(i) && !isControllerRegister(i)
+                && isRegisterAliased(tDescription, tValues)) {
+            tClass = REGISTER_ALIASED;
+        }
+        if (tClass == REGISTER_SUPPORTED) {
+            aPack->SupportedRegisterMask[i / 8] |= 1 << (i % 8);
+            tNumberOfSupportedRegisters++;
+        } else {
+            Serial.print(F("Not supported: "));
+            Serial.print(getDescription(tDescription));
+            printRegisterClass(tClass);
+        }
+    }
+    Serial.print(tNumberOfSupportedRegisters);
+    Serial.print(F(" of "));
+    Serial.print(NUMBER_OF_REGISTERS);
+    Serial.println(F(" registers supported"));
+}
+
+#if defined(CACHE_REGISTER_CAPABILITIES)
+/*
+ * The cache is a ring of entries at the start of the EEPROM, the first byte is the index of the entry to be replaced next.
+ * An entry is valid if its CRC matches. The CRC starts with the CRC of the function codes of the table,
+ * so all entries are invalid after a change of the register table.
+ */
+#if !defined(CAPABILITY_CACHE_EEPROM_START)
+#define CAPABILITY_CACHE_EEPROM_START 0
+#endif
+#define CAPABILITY_CACHE_NUMBER_OF_ENTRIES 8
+struct CapabilityCacheEntryStruct {
+    struct SBMPackIdentityStruct Identity;
+    uint8_t SupportedRegisterMask[SUPPORTED_REGISTER_MASK_SIZE];
+    uint8_t CRC;
+};
+#define CAPABILITY_CACHE_END (CAPABILITY_CACHE_EEPROM_START + 1 + CAPABILITY_CACHE_NUMBER_OF_ENTRIES * sizeof(struct CapabilityCacheEntryStruct))
+
+uint8_t getCapabilityCacheEntryCRC(struct CapabilityCacheEntryStruct * aEntry) {
+    uint8_t tCRC = 0;
+    for (uint8_t i = 0; i < NUMBER_OF_REGISTERS; ++i) {
+        tCRC = crc8Update(tCRC, getFunctionCode(&sSBMFunctionDescriptionTable[i]));
+    }
+    return crc8Update(tCRC, (uint8_t *) aEntry, offsetof(struct CapabilityCacheEntryStruct, CRC));
+}
+
+uint16_t getCapabilityCacheEntryAddress(uint8_t aEntryIndex) {
+    return CAPABILITY_CACHE_EEPROM_START + 1 + aEntryIndex * sizeof(struct CapabilityCacheEntryStruct);
+}
+
+void readCapabilityCacheEntry(uint8_t aEntryIndex, struct CapabilityCacheEntryStruct * aEntry) {
+    uint16_t tAddress = getCapabilityCacheEntryAddress(aEntryIndex);
+    for (uint8_t i = 0; i < sizeof(struct CapabilityCacheEntryStruct); ++i) {
+        ((uint8_t *) aEntry)[i] = EEPROM.read(tAddress + i);
+    }
+}
+
+/*
+ * @return true if an entry for the identity of the pack was found
+ */
+bool readCapabilitiesFromCache(struct SBMPackStruct * aPack, struct CapabilityCacheEntryStruct * aKey) {
+    struct CapabilityCacheEntryStruct tEntry;
+    for (uint8_t i = 0; i < CAPABILITY_CACHE_NUMBER_OF_ENTRIES; ++i) {
+        readCapabilityCacheEntry(i, &tEntry);
+        if (memcmp(&tEntry.Identity, &aKey->Identity, sizeof(struct SBMPackIdentityStruct)) == 0
+                && tEntry.CRC == getCapabilityCacheEntryCRC(&tEntry)) {
+            memcpy(aPack->SupportedRegisterMask, tEntry.SupportedRegisterMask, sizeof(aPack->SupportedRegisterMask));
+            return true;
+        }
+    }
+    return false;
+}
+
+void writeCapabilitiesToCache(struct SBMPackStruct * aPack, struct CapabilityCacheEntryStruct * aKey) {
+    memcpy(aKey->SupportedRegisterMask, aPack->SupportedRegisterMask, sizeof(aKey->SupportedRegisterMask));
+    aKey->CRC = getCapabilityCacheEntryCRC(aKey);
+
+    uint8_t tEntryIndex = EEPROM.read(CAPABILITY_CACHE_EEPROM_START);
+    if (tEntryIndex >= CAPABILITY_CACHE_NUMBER_OF_ENTRIES) {
+        tEntryIndex = 0; // erased EEPROM
+    }
+    uint16_t tAddress = getCapabilityCacheEntryAddress(tEntryIndex);
+    for (uint8_t i = 0; i < sizeof(struct CapabilityCacheEntryStruct); ++i) {
+        EEPROM.update(tAddress + i, ((uint8_t *) aKey)[i]);
+    }
+    EEPROM.update(CAPABILITY_CACHE_EEPROM_START, (tEntryIndex + 1) % CAPABILITY_CACHE_NUMBER_OF_ENTRIES);
+}
+#endif // defined(CACHE_REGISTER_CAPABILITIES)
+
+/*
+ * Selects the driver for the controller of the current pack by its device type
+ */
+void identifyController(struct SBMPackStruct * aPack) {
+    aPack->ControllerIndex = CONTROLLER_UNKNOWN;
+    aPack->ManufacturerBlockAccess = false;
+    uint16_t tType = readWordFromManufacturerAccess(TI_Device_Type);
+    if (!aPack->Device.LastReadIsValid) {
+        return;
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_CONTROLLER_DRIVERS; ++i) {
+        if (pgm_read_word(&sControllerDriverTable[i].DeviceType) == tType) {
+            aPack->ControllerIndex = i;
+            aPack->ManufacturerBlockAccess = pgm_read_byte(&sControllerDriverTable[i].Features) & CONTROLLER_BLOCK_ACCESS;
+            return;
+        }
+    }
+}
+
+/*
+ * Sets the SupportedRegisterMask of the pack from the cache or by probing all registers
+ */
+void initRegisterCapabilities(struct SBMPackStruct * aPack, bool aIdentityIsValid) {
+    Serial.println(F("\r\n*** REGISTER CAPABILITIES ***"));
+#if defined(CACHE_REGISTER_CAPABILITIES)
+    if (!aIdentityIsValid) {
+        probeRegisters(aPack);
+        return;
+    }
+    struct CapabilityCacheEntryStruct tKey;
+    memset(&tKey, 0, sizeof(tKey));
+    tKey.Identity = aPack->Identity;
+    if (readCapabilitiesFromCache(aPack, &tKey)) {
+        Serial.println(F("Read from EEPROM"));
+        return;
+    }
+    probeRegisters(aPack);
+    writeCapabilitiesToCache(aPack, &tKey);
+#else
+    (void) aIdentityIsValid;
+    probeRegisters(aPack);
+#endif
+}
+
+/*
+ * Reads serial number, manufacture date and device name of the current pack
+ * @return false if a read failed
+ */
+bool readPackIdentity(struct SBMPackIdentityStruct * aIdentity) {
+    memset(aIdentity, 0, sizeof(struct SBMPackIdentityStruct)); // identities are compared with memcmp()
+    aIdentity->SerialNumber = readWord(SERIAL_NUM);
+    bool tIsValid = sCurrentPack->Device.LastReadIsValid;
+    aIdentity->ManufactureDate = readWord(MFG_DATE);
+    tIsValid = tIsValid && sCurrentPack->Device.LastReadIsValid;
+    uint8_t tReceivedLength = readBlock(DEV_NAME, sI2CDataBuffer, DATA_BUFFER_LENGTH);
+    aIdentity->DeviceNameCRC = crc8Update(0, sI2CDataBuffer, tReceivedLength);
+    return tIsValid && sCurrentPack->Device.LastReadIsValid;
+}
+
+#if defined(SUPPORT_PEC)
+/*
+ * Version 0b0011 in SpecificationInfo means "Version 1.1 with optional PEC support"
+ */
+void checkPECSupport(uint16_t aSpecificationInfo) {
+    if (((aSpecificationInfo >> 4) & 0x0F) == 3) {
+        sCurrentPack->Device.PECEnabled = true;
+        readWord(VOLTAGE);
+        if (sCurrentPack->Device.LastReadIsValid) {
+            Serial.println(F("PEC supported by pack -> enabled"));
+        } else {
+            sCurrentPack->Device.PECEnabled = false;
+            Serial.println(F("PEC announced by pack, but not working -> disabled"));
+        }
+    }
+}
+#endif
+
+/*
+ * Prints the number of the current pack before the description if more than one pack is monitored
+ */
+void printDescription(const struct SBMFunctionDescriptionStruct * aDescription) {
+    if (sNumberOfPacks > 1) {
+        Serial.print(F("Pack "));
+        Serial.print((int) (sCurrentPack - sPacks) + 1);
+        Serial.print(F(": "));
+    }
+    Serial.print(getDescription(aDescription));
+}
+
+/*
+ * Only the values of the first pack are shown on the LCD
+ */
+bool isLCDOutput(const struct SBMFunctionDescriptionStruct * aDescription) {
+    return getDescriptionLCD(aDescription) != NULL && sCurrentPack == &sPacks[0];
+}
+
+/*
+ * The formatters print every value, the decision if a changed value is printed is made by the report policy
+ */
+void printFormattedValue(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription, uint16_t aActualValue) {
+    switch (getFormat(aSBMFunctionDescription)) {
+    case FORMAT_BINARY:
+        printBinary(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_SIGNED:
+        printSigned(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_CAPACITY:
+        printCapacity(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_PERCENTAGE:
+        printPercentage(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_TIME:
+        printTime(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_BATTERY_MODE:
+        printBatteryMode(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_BATTERY_STATUS:
+        printBatteryStatus(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_MANUFACTURER_DATE:
+        printManufacturerDate(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_VOLTAGE:
+        printVoltage(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_CURRENT:
+        printCurrent(aSBMFunctionDescription, aActualValue);
+        break;
+    case FORMAT_TEMPERATURE:
+        printTemperature(aSBMFunctionDescription, aActualValue);
+        break;
+    default: // FORMAT_NUMBER
+        printDescription(aSBMFunctionDescription);
+        Serial.println(aActualValue);
+        break;
+    }
+}
+
+/*
+ * @param aRegisterState - if NULL, the value is printed without storing it
+ */
+void printValue(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription, struct SBMRegisterStateStruct * aRegisterState,
+        uint16_t aActualValue) {
+    printFormattedValue(aSBMFunctionDescription, aActualValue);
+    if (aRegisterState != NULL) {
+        aRegisterState->lastValue = aActualValue;
+        aRegisterState->LastReadValue = aActualValue;
+    }
+}
+
+/*
+ * Output queue for the changed values found by the poll scheduler.
+ * Formatting and printing a value blocks as soon as the 64 byte TX buffer of Serial is full, since the UART needs 87 us per byte.
+ * Therefore the values are queued here and a value is formatted only if the TX buffer has enough room for a typical line.
+ * The TX buffer itself is drained by the TX interrupt of HardwareSerial, which is blocked during SoftI2CMaster transfers,
+ * but runs in parallel to transfers of the hardware TWI.
+ * If the queue is full, the oldest value is dropped. With OUTPUT_POLICY_COALESCE a value of a register which is still
+ * in the queue replaces the queued value, so no outdated values are printed.
+ */
+#define OUTPUT_POLICY_DROP_OLDEST   0
+#define OUTPUT_POLICY_COALESCE      1
+#if !defined(OUTPUT_POLICY)
+#define OUTPUT_POLICY OUTPUT_POLICY_COALESCE
+#endif
+#if !defined(OUTPUT_QUEUE_SIZE)
+#define OUTPUT_QUEUE_SIZE 16
+#endif
+#define OUTPUT_MIN_FREE_TX_BUFFER 40 // most lines are shorter
+
+struct OutputRecordStruct {
+    struct SBMPackStruct * Pack;
+    const struct SBMFunctionDescriptionStruct * Description;
+    struct SBMRegisterStateStruct * RegisterState; // to find the record of a register for OUTPUT_POLICY_COALESCE
+    uint16_t Value;
+#if defined(USE_BINARY_TELEMETRY)
+    uint32_t Millis;
+#endif
+};
+struct OutputRecordStruct sOutputQueue[OUTPUT_QUEUE_SIZE];
+uint8_t sOutputQueueHead = 0;
+uint8_t sOutputQueueCount = 0;
+uint16_t sOutputOverrunCount = 0; // values dropped, since queue was full
+uint16_t sOutputCoalescedCount = 0; // values replaced by a newer value of the same register
+
+/*
+ * Queue a changed value for output and store it as last value of the register
+ */
+void queueOutput(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint16_t aValue, uint32_t aMillis) {
+    struct OutputRecordStruct * tRecord = NULL;
+#if OUTPUT_POLICY == OUTPUT_POLICY_COALESCE
+    for (uint8_t i = 0; i < sOutputQueueCount; ++i) {
+        struct OutputRecordStruct * tQueuedRecord = &sOutputQueue[(sOutputQueueHead + i) % OUTPUT_QUEUE_SIZE];
+        if (tQueuedRecord->RegisterState == aRegisterState) {
+            tRecord = tQueuedRecord;
+            sOutputCoalescedCount++;
+            break;
+        }
+    }
+#endif
+    if (tRecord == NULL) {
+        if (sOutputQueueCount == OUTPUT_QUEUE_SIZE) {
+            // drop oldest
+            sOutputQueueHead = (sOutputQueueHead + 1) % OUTPUT_QUEUE_SIZE;
+            sOutputQueueCount--;
+            sOutputOverrunCount++;
+        }
+        tRecord = &sOutputQueue[(sOutputQueueHead + sOutputQueueCount) % OUTPUT_QUEUE_SIZE];
+        sOutputQueueCount++;
+        tRecord->Pack = aPack;
+        tRecord->Description = aDescription;
+        tRecord->RegisterState = aRegisterState;
+    }
+    tRecord->Value = aValue;
+#if defined(USE_BINARY_TELEMETRY)
+    tRecord->Millis = aMillis;
+#endif
+#if defined(USE_TRIGGER_CAPTURE)
+    if (aPack == &sPacks[0] && getFunctionCode(aDescription) == BATTERY_STATUS) {
+        checkBatteryStatusTrigger(aRegisterState->lastValue, aValue);
+    }
+#endif
+    aRegisterState->lastValue = aValue;
+    aRegisterState->LastReportSeconds = aMillis / 1000;
+}
+
+/*
+ * Prints at most one queued value, and only if it can be written to the TX buffer without waiting
+ */
+void printNextQueuedRecord(void) {
+    struct OutputRecordStruct * tRecord = &sOutputQueue[sOutputQueueHead];
+    sOutputQueueHead = (sOutputQueueHead + 1) % OUTPUT_QUEUE_SIZE;
+    sOutputQueueCount--;
+    sCurrentPack = tRecord->Pack;
+#if defined(USE_BINARY_TELEMETRY)
+    sendTelemetryFrame(tRecord->Pack, getFunctionCode(tRecord->Description), tRecord->Value, tRecord->Millis);
+#else
+    printFormattedValue(tRecord->Description, tRecord->Value);
+#endif
+}
+
+void printQueuedOutput(void) {
+    if (sOutputQueueCount == 0 || Serial.availableForWrite() < OUTPUT_MIN_FREE_TX_BUFFER) {
+        return;
+    }
+    printNextQueuedRecord();
+}
+
+/*
+ * Prints all queued values, even if this blocks
+ */
+void flushQueuedOutput(void) {
+    while (sOutputQueueCount > 0) {
+        printNextQueuedRecord();
+    }
+}
+
+/*
+ * Read word and print if value has changed.
+ * Changed values are only checked once here, the check for bit errors is done by the poll scheduler.
+ * A read which is not acknowledged or has a wrong PEC is repeated once. If this fails too,
+ * nothing is printed and the register state keeps its former value.
+ * @return the value read, 0xFFFF if the read failed
+ */
+uint16_t readWordAndPrint(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterState, bool aOnlyPrintIfValueChanged) {
+    uint16_t tActualValue = readWord(getFunctionCode(aSBMFunctionDescription));
+    if (!sCurrentPack->Device.LastReadIsValid) {
+        tActualValue = readWord(getFunctionCode(aSBMFunctionDescription));
+        if (!sCurrentPack->Device.LastReadIsValid) {
+            return 0xFFFF;
+        }
+    }
+
+    if (!aOnlyPrintIfValueChanged || aRegisterState == NULL || tActualValue != aRegisterState->lastValue) {
+        printValue(aSBMFunctionDescription, aRegisterState, tActualValue);
+    }
+    return tActualValue;
+}
+
+/*
+ * Reads all dynamic registers of the pack back-to-back
+ */
+void acquireSnapshot(struct SBMPackStruct * aPack, struct SBMSnapshotStruct * aSnapshot) {
+    selectMuxChannelOfPack(aPack);
+    aSnapshot->AcquisitionMillis = millis();
+    uint32_t tStartMicros = micros();
+    uint32_t tVoltageMicros = tStartMicros;
+    uint32_t tCurrentMicros = tStartMicros;
+    aSnapshot->ValidMask = 0;
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+        uint8_t tFunctionCode = getFunctionCode(&sSBMDynamicFunctionDescriptionArray[i]);
+        if (tFunctionCode == VOLTAGE) {
+            tVoltageMicros = micros();
+        } else if (tFunctionCode == CURRENT) {
+            tCurrentMicros = micros();
+        }
+        if (!isRegisterSupported(aPack, &sSBMDynamicFunctionDescriptionArray[i])) {
+            aSnapshot->Values[i] = 0xFFFF;
+            continue;
+        }
+        aSnapshot->Values[i] = aPack->Device.readWord(tFunctionCode);
+        if (aPack->Device.LastReadIsValid) {
+            aSnapshot->ValidMask |= 1 << i;
+        }
+    }
+    aSnapshot->AcquisitionMicros = micros() - tStartMicros;
+    aSnapshot->VoltageCurrentSkewMicros =
+            (tCurrentMicros > tVoltageMicros) ? tCurrentMicros - tVoltageMicros : tVoltageMicros - tCurrentMicros;
+}
+
+/*
+ * Prints all valid values of the snapshot of the current pack and stores them as last values
+ */
+void printSnapshot(struct SBMSnapshotStruct * aSnapshot, struct SBMRegisterStateStruct * aRegisterStates) {
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+        if (!isRegisterSupported(sCurrentPack, &sSBMDynamicFunctionDescriptionArray[i]) || !(aSnapshot->ValidMask & (1 << i))) {
+            continue;
+        }
+        printValue(&sSBMDynamicFunctionDescriptionArray[i], &aRegisterStates[i], aSnapshot->Values[i]);
+    }
+}
+
+#if defined(SHOW_SCHEDULER_STATISTICS)
+void printSnapshotTiming(struct SBMSnapshotStruct * aSnapshot) {
+    Serial.print(F("acquisition: "));
+    Serial.print(aSnapshot->AcquisitionMicros);
+    Serial.print(F(" us, voltage to current skew: "));
+    Serial.print(aSnapshot->VoltageCurrentSkewMicros);
+    Serial.println(F(" us"));
+}
+#endif
+
+#if defined(USE_ADAPTIVE_POLLING)
+/*
+ * Adaptive polling scales the poll periods of all registers of a pack with the state of the pack.
+ * The state is derived from the alarm bits of BatteryStatus, the current and the change of voltage and temperature.
+ * An event is a set alarm bit, a high current or a fast change of voltage or temperature. The event state
+ * is kept for ADAPTIVE_EVENT_HOLD_MILLIS after the last event.
+ */
+#define POLL_STATE_IDLE         0
+#define POLL_STATE_CHARGING     1
+#define POLL_STATE_DISCHARGING  2
+#define POLL_STATE_EVENT        3
+const char sPollStateNameIdle[] PROGMEM = "idle";
+const char sPollStateNameCharging[] PROGMEM = "charging";
+const char sPollStateNameDischarging[] PROGMEM = "discharging";
+const char sPollStateNameEvent[] PROGMEM = "event";
+const char * const sPollStateNames[] PROGMEM = { sPollStateNameIdle, sPollStateNameCharging, sPollStateNameDischarging,
+        sPollStateNameEvent };
+const uint16_t sPollPeriodPercent[] PROGMEM = { 400, 100, 50, 25 }; // factor for the poll periods of each state
+
+#define ADAPTIVE_MIN_POLL_PERIOD_MILLIS     100
+#define ADAPTIVE_MAX_POLL_PERIOD_MILLIS     60000
+#define ADAPTIVE_IDLE_CURRENT_MILLIAMPERE   20 // below this current the pack is idle
+#define ADAPTIVE_EVENT_CURRENT_MILLIAMPERE  2000
+#define ADAPTIVE_VOLTAGE_WINDOW_MILLIS      1000
+#define ADAPTIVE_EVENT_VOLTAGE_CHANGE       50 // mV per window
+#define ADAPTIVE_TEMPERATURE_WINDOW_MILLIS  60000
+#define ADAPTIVE_EVENT_TEMPERATURE_CHANGE   10 // 1 degree per window
+#define ADAPTIVE_EVENT_HOLD_MILLIS          10000
+#define ALARM_BITS (OVER_CHARGED_ALARM | TERMINATE_CHARGE_ALARM | OVER_TEMP_ALARM | TERMINATE_DISCHARGE_ALARM \
+        | REMAINING_CAPACITY_ALARM_FLAG | REMAINING_TIME_ALARM_FLAG)
+
+/*
+ * @return the poll period scaled for the state of the pack and limited to the configured bounds
+ */
+uint32_t getAdaptedPollPeriodMillis(struct SBMPackStruct * aPack, uint16_t aPollPeriodMillis) {
+    uint32_t tPollPeriodMillis = ((uint32_t) aPollPeriodMillis * pgm_read_word(&sPollPeriodPercent[aPack->PollState])) / 100;
+    if (tPollPeriodMillis < ADAPTIVE_MIN_POLL_PERIOD_MILLIS) {
+        return ADAPTIVE_MIN_POLL_PERIOD_MILLIS;
+    }
+    if (tPollPeriodMillis > ADAPTIVE_MAX_POLL_PERIOD_MILLIS && tPollPeriodMillis > aPollPeriodMillis) {
+        // do not lengthen periods which are already longer than the maximum
+        return (aPollPeriodMillis > ADAPTIVE_MAX_POLL_PERIOD_MILLIS) ? aPollPeriodMillis : ADAPTIVE_MAX_POLL_PERIOD_MILLIS;
+    }
+    return tPollPeriodMillis;
+}
+
+/*
+ * Brings the deadlines of the registers forward, which are later than one new poll period
+ */
+void shortenPollDeadlines(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint8_t aLengthOfArray, uint32_t aMillis) {
+    for (uint8_t i = 0; i < aLengthOfArray; ++i) {
+        if (getPollPeriodMillis(aSBMFunctionDescription) != 0) {
+            uint32_t tLatestMillis = aMillis + getAdaptedPollPeriodMillis(aPack, getPollPeriodMillis(aSBMFunctionDescription));
+            if ((int32_t) (aRegisterState->NextPollMillis - tLatestMillis) > 0) {
+                aRegisterState->NextPollMillis = tLatestMillis;
+            }
+        }
+        aSBMFunctionDescription++;
+        aRegisterState++;
+    }
+}
+
+void printPollState(struct SBMPackStruct * aPack) {
+    if (sNumberOfPacks > 1) {
+        Serial.print(F("Pack "));
+        Serial.print((int) (aPack - sPacks) + 1);
+        Serial.print(F(": "));
+    }
+    Serial.print(F("Poll state: "));
+    Serial.print((const __FlashStringHelper *) pgm_read_ptr(&sPollStateNames[aPack->PollState]));
+    Serial.print(F(", poll periods "));
+    Serial.print(pgm_read_word(&sPollPeriodPercent[aPack->PollState]));
+    Serial.println(F(" %"));
+}
+
+/*
+ * Stores the values the state depends on
+ * @return false if the value is not used for the state
+ */
+bool storePollStateValue(struct SBMPackStruct * aPack, uint8_t aFunctionCode, uint16_t aValue, uint32_t aMillis) {
+    bool tEvent = false;
+    if (aFunctionCode == BATTERY_STATUS) {
+        aPack->BatteryStatus = aValue;
+    } else if (aFunctionCode == CURRENT) {
+        aPack->Current = aValue;
+    } else if (aFunctionCode == VOLTAGE) {
+        if (aMillis - aPack->ReferenceVoltageMillis >= ADAPTIVE_VOLTAGE_WINDOW_MILLIS) {
+            tEvent = abs((int32_t) aValue - aPack->ReferenceVoltage) >= ADAPTIVE_EVENT_VOLTAGE_CHANGE;
+            aPack->ReferenceVoltage = aValue;
+            aPack->ReferenceVoltageMillis = aMillis;
+        }
+    } else if (aFunctionCode == TEMPERATURE) {
+        if (aMillis - aPack->ReferenceTemperatureMillis >= ADAPTIVE_TEMPERATURE_WINDOW_MILLIS) {
+            tEvent = abs((int32_t) aValue - aPack->ReferenceTemperature) >= ADAPTIVE_EVENT_TEMPERATURE_CHANGE;
+            aPack->ReferenceTemperature = aValue;
+            aPack->ReferenceTemperatureMillis = aMillis;
+        }
+    } else {
+        return false;
+    }
+    if (tEvent || (aPack->BatteryStatus & ALARM_BITS) || abs(aPack->Current) >= ADAPTIVE_EVENT_CURRENT_MILLIAMPERE) {
+        aPack->LastEventMillis = aMillis;
+    }
+    return true;
+}
+
+void evaluatePollState(struct SBMPackStruct * aPack, uint32_t aMillis) {
+    uint8_t tPollState;
+    if (aMillis - aPack->LastEventMillis < ADAPTIVE_EVENT_HOLD_MILLIS) {
+        tPollState = POLL_STATE_EVENT;
+    } else if (aPack->Current <= -ADAPTIVE_IDLE_CURRENT_MILLIAMPERE) {
+        tPollState = POLL_STATE_DISCHARGING;
+    } else if (aPack->Current >= ADAPTIVE_IDLE_CURRENT_MILLIAMPERE) {
+        tPollState = POLL_STATE_CHARGING;
+    } else {
+        tPollState = POLL_STATE_IDLE;
+    }
+
+    if (aPack->PollState != tPollState) {
+        aPack->PollState = tPollState;
+        shortenPollDeadlines(aPack, sSBMDynamicFunctionDescriptionArray, aPack->DynamicRegisterStates,
+        NUMBER_OF_DYNAMIC_REGISTERS, aMillis);
+        shortenPollDeadlines(aPack, sSBMNonStandardFunctionDescriptionArray, aPack->OptionalRegisterStates,
+        NUMBER_OF_OPTIONAL_REGISTERS, aMillis);
+#if defined(USE_SNAPSHOT_POLLING)
+        uint32_t tLatestMillis = aMillis + getAdaptedPollPeriodMillis(aPack, SNAPSHOT_PERIOD_MILLIS);
+        if ((int32_t) (aPack->NextSnapshotMillis - tLatestMillis) > 0) {
+            aPack->NextSnapshotMillis = tLatestMillis;
+        }
+#endif
+#if !defined(USE_BINARY_TELEMETRY)
+        printPollState(aPack);
+#endif
+    }
+}
+
+/*
+ * Called for each valid value read by the poll scheduler
+ */
+void updatePollState(struct SBMPackStruct * aPack, uint8_t aFunctionCode, uint16_t aValue, uint32_t aMillis) {
+    if (storePollStateValue(aPack, aFunctionCode, aValue, aMillis)) {
+        evaluatePollState(aPack, aMillis);
+    }
+}
+
+/*
+ * Starts with the values printed by setup()
+ */
+void initPollState(struct SBMPackStruct * aPack, uint32_t aMillis) {
+    aPack->PollState = POLL_STATE_CHARGING; // the state with the unchanged periods
+    aPack->LastEventMillis = aMillis - ADAPTIVE_EVENT_HOLD_MILLIS;
+    aPack->ReferenceVoltageMillis = aMillis;
+    aPack->ReferenceTemperatureMillis = aMillis;
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+        uint8_t tFunctionCode = getFunctionCode(&sSBMDynamicFunctionDescriptionArray[i]);
+        uint16_t tValue = aPack->DynamicRegisterStates[i].lastValue;
+        if (tFunctionCode == VOLTAGE) {
+            aPack->ReferenceVoltage = tValue;
+        } else if (tFunctionCode == TEMPERATURE) {
+            aPack->ReferenceTemperature = tValue;
+        } else {
+            storePollStateValue(aPack, tFunctionCode, tValue, aMillis);
+        }
+    }
+    uint8_t tOldPollState = aPack->PollState;
+    evaluatePollState(aPack, aMillis);
+#if !defined(USE_BINARY_TELEMETRY)
+    if (aPack->PollState == tOldPollState) {
+        printPollState(aPack); // report the initial state also if unchanged
+    }
+#else
+    (void) tOldPollState;
+#endif
+}
+#endif // defined(USE_ADAPTIVE_POLLING)
+
+/*
+ * Hot swap of packs.
+ * A pack is regarded as removed after PACK_MAX_FAILED_READS consecutive reads of the poll scheduler without answer.
+ * Then it is checked every PACK_PRESENCE_CHECK_MILLIS with an SMBus quick command, which transfers only the address byte.
+ * If it answers again, it is identified by serial number, manufacture date and device name.
+ * The same pack continues to be polled, for another pack the info is printed as in setup() and its polling starts again.
+ */
+#define PACK_MAX_FAILED_READS 4 // a NAK by chance is very unlikely to occur 4 times in sequence
+#define PACK_PRESENCE_CHECK_MILLIS 100
+
+void markPackRemoved(struct SBMPackStruct * aPack) {
+    aPack->IsRemoved = true;
+    aPack->FailedReads = 0;
+    aPack->NextPresenceCheckMillis = millis() + PACK_PRESENCE_CHECK_MILLIS;
+#if !defined(USE_BINARY_TELEMETRY)
+    Serial.print(F("Pack "));
+    Serial.print((int) (aPack - sPacks) + 1);
+    Serial.println(F(" removed"));
+#endif
+}
+
+/*
+ * @return true if the bus was accessed
+ */
+bool checkPresenceOfRemovedPack(struct SBMPackStruct * aPack, uint32_t aMillis) {
+    if ((int32_t) (aMillis - aPack->NextPresenceCheckMillis) < 0) {
+        return false;
+    }
+    aPack->NextPresenceCheckMillis = aMillis + PACK_PRESENCE_CHECK_MILLIS;
+    selectMuxChannelOfPack(aPack);
+    if (!isI2CDeviceAttached(aPack->Device.Address)) {
+        return true;
+    }
+
+    /*
+     * Identify the pack without PEC, since another pack may not support it
+     */
+    sCurrentPack = aPack;
+    bool tPECEnabled = aPack->Device.PECEnabled;
+    aPack->Device.PECEnabled = false;
+    struct SBMPackIdentityStruct tIdentity;
+    readWord(VOLTAGE);
+    if (!aPack->Device.LastReadIsValid || !readPackIdentity(&tIdentity)) {
+        // pack is not yet ready, try again at next check
+        aPack->Device.PECEnabled = tPECEnabled;
+        return true;
+    }
+    aPack->IsRemoved = false;
+    if (memcmp(&tIdentity, &aPack->Identity, sizeof(tIdentity)) == 0) {
+        // the registers which are overdue now are polled first
+        aPack->Device.PECEnabled = tPECEnabled;
+#if !defined(USE_BINARY_TELEMETRY)
+        Serial.print(F("Pack "));
+        Serial.print((int) (aPack - sPacks) + 1);
+        Serial.println(F(" reconnected"));
+#endif
+        return true;
+    }
+
+    flushQueuedOutput(); // the values of the former pack
+    sCurrentPack = aPack;
+    Serial.print(F("\r\n*** PACK "));
+    Serial.print((int) (aPack - sPacks) + 1);
+    Serial.println(F(" CHANGED ***"));
+    aPack->Identity = tIdentity;
+    printIdentifiedPackInfo(aPack, true);
+#if defined(USE_BINARY_TELEMETRY)
+    // the decoder skips the text above, but requires these values to format the capacities
+    sendTelemetryFrame(aPack, DESIGN_VOLTAGE, aPack->DesignVoltage, millis());
+    sendTelemetryFrame(aPack, BATTERY_MODE, aPack->CapacityModePower ? CAPACITY_MODE : 0, millis());
+#endif
+    initPollSchedulerOfPack(aPack, millis());
+    return true;
+}
+
+/*
+ * Cooperative poll scheduler for the dynamic and the non standard registers of all packs.
+ * Each register has its own period and deadline. Every call of pollNextDueRegister() reads the most overdue register
+ * of the next pack which has a due register, so one call takes at most one bus transaction (plus one for the multiplexer)
+ * and the packs are served round robin.
+ * To avoid spurious outputs a changed value is read 2 times again, 33 and 50 ms after the start of the first read,
+ * even if the first read itself was late.
+ * The value is printed only if all 3 reads differ from the last printed value.
+ * With PEC enabled, transmit errors are detected by readWord() and the value is printed immediately.
+ */
+#define CHANGE_CONFIRMATION_READS 2
+#define SCHEDULER_START_SPREAD_MILLIS 5 // distance of the first deadlines of the registers, to avoid that all are due at the same time
+const uint8_t sChangeConfirmationDelayMillis[CHANGE_CONFIRMATION_READS + 1] = { 0, 33, 50 }; // just guessed the values
+uint32_t sSchedulerStartMillis;
+#if defined(USE_REGISTER_STATISTICS)
+uint32_t sStatisticsStartMillis; // start of the window of the register statistics
+#endif
+uint8_t sNextPolledPackIndex = 0;
+
+/*
+ * @return the start time for the next array
+ */
+uint32_t initPollSchedulerArray(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint8_t aLengthOfArray, uint32_t aMillis) {
+    for (uint8_t i = 0; i < aLengthOfArray; ++i) {
+        aRegisterState->NextPollMillis = aMillis + getPollPeriodMillis(aSBMFunctionDescription);
+        aMillis += SCHEDULER_START_SPREAD_MILLIS;
+        aRegisterState->ChangeConfirmationCount = 0;
+#if defined(SHOW_SCHEDULER_STATISTICS)
+        aRegisterState->PollCount = 0;
+        aRegisterState->MaxJitterMillis = 0;
+#endif
+#if defined(USE_REGISTER_STATISTICS)
+        aRegisterState->SampleCount = 0;
+#endif
+        aSBMFunctionDescription++;
+        aRegisterState++;
+    }
+    return aMillis;
+}
+
+/*
+ * Also called if another pack was attached
+ * @return the start time for the next pack
+ */
+uint32_t initPollSchedulerOfPack(struct SBMPackStruct * aPack, uint32_t aStartMillis) {
+#if defined(USE_SNAPSHOT_POLLING)
+    aPack->NextSnapshotMillis = aStartMillis;
+#endif
+#if defined(USE_ADAPTIVE_POLLING)
+    initPollState(aPack, aStartMillis);
+#endif
+    aStartMillis = initPollSchedulerArray(sSBMDynamicFunctionDescriptionArray, aPack->DynamicRegisterStates,
+    NUMBER_OF_DYNAMIC_REGISTERS, aStartMillis);
+    return initPollSchedulerArray(sSBMNonStandardFunctionDescriptionArray, aPack->OptionalRegisterStates,
+    NUMBER_OF_OPTIONAL_REGISTERS, aStartMillis);
+}
+
+void initPollScheduler(void) {
+    sSchedulerStartMillis = millis();
+#if defined(USE_REGISTER_STATISTICS)
+    sStatisticsStartMillis = sSchedulerStartMillis;
+#endif
+    uint32_t tStartMillis = sSchedulerStartMillis;
+    for (uint8_t i = 0; i < sNumberOfPacks; ++i) {
+        tStartMillis = initPollSchedulerOfPack(&sPacks[i], tStartMillis);
+    }
+}
+
+/*
+ * @return the index of the entry of the array with the biggest delay relative to its due time or -1 if none is due
+ */
+int8_t findMostOverdueEntry(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint8_t aLengthOfArray, uint32_t aMillis, int32_t * aMaxDelayMillis) {
+    int8_t tMostOverdueIndex = -1;
+    for (uint8_t i = 0; i < aLengthOfArray; ++i) {
+        if (getPollPeriodMillis(aSBMFunctionDescription) != 0 && isRegisterSupported(aPack, aSBMFunctionDescription)) {
+            // signed difference handles the overflow of millis()
+            int32_t tDelayMillis;
+            if (aRegisterState->ChangeConfirmationCount == 0) {
+                tDelayMillis = aMillis - aRegisterState->NextPollMillis;
+            } else {
+                // the confirmations are due relative to the first read of the change, not to its possibly missed deadline
+                tDelayMillis = (int16_t) ((uint16_t) aMillis
+                        - (uint16_t) (aRegisterState->ChangeMillis
+                                + sChangeConfirmationDelayMillis[aRegisterState->ChangeConfirmationCount]));
+            }
+            if (tDelayMillis >= *aMaxDelayMillis) {
+                *aMaxDelayMillis = tDelayMillis;
+                tMostOverdueIndex = i;
+            }
+        }
+        aSBMFunctionDescription++;
+        aRegisterState++;
+    }
+    return tMostOverdueIndex;
+}
+
+/*
+ * @return the state of the most overdue register of the pack or NULL if none is due
+ */
+struct SBMRegisterStateStruct * findNextDueRegisterOfPack(struct SBMPackStruct * aPack, uint32_t aMillis,
+        int32_t * aMaxDelayMillis, const struct SBMFunctionDescriptionStruct ** aDescription) {
+    struct SBMRegisterStateStruct * tRegisterState = NULL;
+    *aMaxDelayMillis = 0;
+    int8_t tIndex;
+#if !defined(USE_SNAPSHOT_POLLING)
+    // with snapshot polling the dynamic registers are read by pollNextDueSnapshot()
+    tIndex = findMostOverdueEntry(aPack, sSBMDynamicFunctionDescriptionArray, aPack->DynamicRegisterStates,
+    NUMBER_OF_DYNAMIC_REGISTERS, aMillis, aMaxDelayMillis);
+    if (tIndex >= 0) {
+        *aDescription = &sSBMDynamicFunctionDescriptionArray[tIndex];
+        tRegisterState = &aPack->DynamicRegisterStates[tIndex];
+    }
+#endif
+    tIndex = findMostOverdueEntry(aPack, sSBMNonStandardFunctionDescriptionArray, aPack->OptionalRegisterStates,
+    NUMBER_OF_OPTIONAL_REGISTERS, aMillis, aMaxDelayMillis);
+    if (tIndex >= 0) {
+        *aDescription = &sSBMNonStandardFunctionDescriptionArray[tIndex];
+        tRegisterState = &aPack->OptionalRegisterStates[tIndex];
+    }
+    return tRegisterState;
+}
+
+/*
+ * @return the larger of the absolute and the relative deadband of the report policy for a change starting at aValue
+ */
+uint16_t getDeadband(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue) {
+    const struct SBMReportPolicyStruct * tPolicy = getReportPolicy(aDescription);
+    uint16_t tMagnitude = abs(getNumericValue(aDescription, aValue));
+    uint16_t tDeadband = pgm_read_word(&tPolicy->Deadband);
+    uint16_t tRelativeDeadband = ((uint32_t) tMagnitude * pgm_read_byte(&tPolicy->DeadbandPermille)) / 1000;
+    return (tRelativeDeadband > tDeadband) ? tRelativeDeadband : tDeadband;
+}
+
+/*
+ * Applies the report policy of the register, see SBM_REPORT_POLICIES in SBMInfo.h
+ * @return true if the value differs enough from the last reported value to be reported now
+ */
+bool isReportableChange(const struct SBMFunctionDescriptionStruct * aDescription, struct SBMRegisterStateStruct * aRegisterState,
+        uint16_t aValue, uint32_t aMillis) {
+    uint16_t tLastValue = aRegisterState->lastValue;
+    if (aValue == tLastValue) {
+        return false;
+    }
+    const struct SBMReportPolicyStruct * tPolicy = getReportPolicy(aDescription);
+    int32_t tChange = getNumericValue(aDescription, aValue) - getNumericValue(aDescription, tLastValue);
+    uint16_t tDeadband = getDeadband(aDescription, tLastValue);
+    uint32_t tAbsoluteChange = abs(tChange);
+    uint16_t tSecondsSinceReport = (uint16_t) (aMillis / 1000) - aRegisterState->LastReportSeconds;
+    if (tAbsoluteChange > (uint32_t) tDeadband * REPORT_STEP_DEADBANDS) {
+        return true;
+    }
+    if (tAbsoluteChange > tDeadband) {
+        return tSecondsSinceReport >= pgm_read_byte(&tPolicy->MinIntervalSeconds);
+    }
+    uint16_t tMaxIntervalSeconds = pgm_read_word(&tPolicy->MaxIntervalSeconds);
+    return tMaxIntervalSeconds != 0 && tSecondsSinceReport >= tMaxIntervalSeconds;
+}
+
+/*
+ * A confirmation read must return the changed value of the first read, or for a register with a deadband,
+ * a value within the deadband of it. So two different bit errors can not confirm each other.
+ */
+bool isChangeConfirmed(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aChangedValue, uint16_t aValue) {
+    int32_t tDifference = getNumericValue(aDescription, aValue) - getNumericValue(aDescription, aChangedValue);
+    return (uint32_t) abs(tDifference) <= getDeadband(aDescription, aChangedValue);
+}
+
+/*
+ * Check and print the polled value and compute next deadline.
+ * Without PEC, a change is only queued after CHANGE_CONFIRMATION_READS reads confirmed it,
+ * and the value of the first read is queued.
+ */
+void processPolledValue(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint16_t aActualValue, bool aIsValid, uint32_t aMillis,
+        int32_t aDelayMillis) {
+    if (aRegisterState->ChangeConfirmationCount == 0) {
+#if defined(SHOW_SCHEDULER_STATISTICS)
+        aRegisterState->PollCount++;
+        if (aDelayMillis > (int32_t) aRegisterState->MaxJitterMillis) {
+            aRegisterState->MaxJitterMillis = aDelayMillis;
+        }
+#else
+        (void) aDelayMillis;
+#endif
+#if defined(USE_REGISTER_STATISTICS)
+        // the reads which confirm a change are no regular samples
+        if (aIsValid) {
+            addStatisticsSample(aDescription, aRegisterState, aActualValue);
+        }
+#endif
+    }
+
+    if (!aIsValid) {
+        // transmit error detected
+        aRegisterState->ChangeConfirmationCount = 0;
+    } else if (aRegisterState->ChangeConfirmationCount == 0) {
+        if (!isReportableChange(aDescription, aRegisterState, aActualValue, aMillis)) {
+            // unchanged or change not to be reported
+            aRegisterState->LastReadValue = aActualValue;
+        } else if (!aPack->Device.PECEnabled) {
+            // check value again later, maybe it was a transmit error
+            aRegisterState->ChangedValue = aActualValue;
+            aRegisterState->ChangeMillis = aMillis;
+            aRegisterState->ChangeConfirmationCount = 1;
+            return;
+        } else {
+            aRegisterState->LastReadValue = aActualValue;
+            queueOutput(aPack, aDescription, aRegisterState, aActualValue, aMillis);
+        }
+    } else if (!isChangeConfirmed(aDescription, aRegisterState->ChangedValue, aActualValue)) {
+        // the first or this read was a transmit error
+        aRegisterState->ChangeConfirmationCount = 0;
+    } else if (aRegisterState->ChangeConfirmationCount < CHANGE_CONFIRMATION_READS) {
+        aRegisterState->ChangeConfirmationCount++;
+        return;
+    } else {
+        aRegisterState->ChangeConfirmationCount = 0;
+        aRegisterState->LastReadValue = aActualValue;
+        queueOutput(aPack, aDescription, aRegisterState, aRegisterState->ChangedValue, aMillis);
+    }
+#if defined(USE_ADAPTIVE_POLLING)
+    if (aIsValid) {
+        updatePollState(aPack, getFunctionCode(aDescription), aActualValue, aMillis);
+    }
+    aRegisterState->NextPollMillis += getAdaptedPollPeriodMillis(aPack, getPollPeriodMillis(aDescription));
+#else
+    aRegisterState->NextPollMillis += getPollPeriodMillis(aDescription);
+#endif
+    if ((int32_t) (aMillis - aRegisterState->NextPollMillis) > 0) {
+        // we are more than one period late, do not try to catch up
+        aRegisterState->NextPollMillis = aMillis;
+    }
+}
+
+/*
+ * The read is started here and its result is processed as soon as it is available.
+ * For synchronous transports this is within the same call, for the hardware TWI it is in one of the next calls,
+ * so the bus transfer runs while loop() is printing or updating the LCD.
+ */
+struct SBMRegisterStateStruct * sPolledRegisterState = NULL; // != NULL while a read is active
+const struct SBMFunctionDescriptionStruct * sPolledDescription;
+struct SBMPackStruct * sPolledPack;
+uint32_t sPollMillis;
+int32_t sPollDelayMillis;
+
+/*
+ * @return true if a register read was started
+ */
+bool pollNextDueRegister(void) {
+    bool tReadStarted = false;
+    if (sPolledRegisterState == NULL) {
+#if defined(USE_SNAPSHOT_POLLING)
+        if (pollNextDueSnapshot()) {
+            return true;
+        }
+#endif
+        sPollMillis = millis();
+        struct SBMRegisterStateStruct * tRegisterState = NULL;
+        for (uint8_t i = 0; i < sNumberOfPacks && tRegisterState == NULL; ++i) {
+            sPolledPack = &sPacks[sNextPolledPackIndex];
+            sNextPolledPackIndex++;
+            if (sNextPolledPackIndex >= sNumberOfPacks) {
+                sNextPolledPackIndex = 0;
+            }
+            if (sPolledPack->IsRemoved) {
+                if (checkPresenceOfRemovedPack(sPolledPack, sPollMillis)) {
+                    return false;
+                }
+                continue;
+            }
+            tRegisterState = findNextDueRegisterOfPack(sPolledPack, sPollMillis, &sPollDelayMillis, &sPolledDescription);
+        }
+        if (tRegisterState == NULL) {
+            return false;
+        }
+        selectMuxChannelOfPack(sPolledPack);
+        if (!sPolledPack->Device.startReadWord(getFunctionCode(sPolledDescription))) {
+            return false;
+        }
+        sPolledRegisterState = tRegisterState;
+        tReadStarted = true;
+    }
+
+    uint16_t tActualValue;
+    uint8_t tStatus = sPolledPack->Device.getStartedReadWordResult(&tActualValue);
+    if (tStatus != SMBUS_STATUS_PENDING) {
+        struct SBMRegisterStateStruct * tRegisterState = sPolledRegisterState;
+        sPolledRegisterState = NULL;
+#if defined(TUNE_BUS_CLOCK)
+        checkBusErrors(sPolledPack, tStatus);
+#endif
+        if (tStatus == SMBUS_STATUS_OK || tStatus == SMBUS_STATUS_PEC_ERROR) {
+            sPolledPack->FailedReads = 0;
+        } else if (++sPolledPack->FailedReads >= PACK_MAX_FAILED_READS) {
+            tRegisterState->ChangeConfirmationCount = 0;
+            markPackRemoved(sPolledPack);
+            return tReadStarted;
+        }
+        processPolledValue(sPolledPack, sPolledDescription, tRegisterState, tActualValue, tStatus == SMBUS_STATUS_OK,
+                sPollMillis, sPollDelayMillis);
+    }
+    return tReadStarted;
+}
+
+#if defined(USE_SNAPSHOT_POLLING)
+/*
+ * Snapshot polling reads all dynamic registers of a pack every SNAPSHOT_PERIOD_MILLIS
+ * and queues all changed values with the timestamp of the snapshot.
+ * Without PEC, a changed value is read CHANGE_CONFIRMATION_READS times again directly after the snapshot
+ * and is queued only if all reads differ from the last printed value, like it is done by the poll scheduler.
+ * The non standard registers are still polled by the poll scheduler.
+ * Acquisition of a snapshot blocks loop() for 12 bus transactions.
+ */
+uint8_t sNextSnapshotPackIndex = 0;
+#if defined(SHOW_SCHEDULER_STATISTICS)
+struct SBMSnapshotStruct sMaxSnapshotTiming; // only the timing values are used
+#endif
+
+/*
+ * Without PEC, the changed value of the snapshot must be confirmed by the next reads, see isChangeConfirmed()
+ */
+bool isSnapshotChangeConfirmed(struct SBMPackStruct * aPack, const struct SBMFunctionDescriptionStruct * aDescription,
+        uint16_t aChangedValue) {
+    if (aPack->Device.PECEnabled) {
+        return true;
+    }
+    for (uint8_t i = 0; i < CHANGE_CONFIRMATION_READS; ++i) {
+        uint16_t tValue = aPack->Device.readWord(getFunctionCode(aDescription));
+        if (!aPack->Device.LastReadIsValid || !isChangeConfirmed(aDescription, aChangedValue, tValue)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void processSnapshot(struct SBMPackStruct * aPack, struct SBMSnapshotStruct * aSnapshot, int32_t aDelayMillis) {
+    struct SBMRegisterStateStruct * tRegisterState = aPack->DynamicRegisterStates;
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+#if defined(SHOW_SCHEDULER_STATISTICS)
+        tRegisterState->PollCount++;
+        if (aDelayMillis > (int32_t) tRegisterState->MaxJitterMillis) {
+            tRegisterState->MaxJitterMillis = aDelayMillis;
+        }
+#else
+        (void) aDelayMillis;
+#endif
+        uint16_t tValue = aSnapshot->Values[i];
+#if defined(USE_REGISTER_STATISTICS)
+        if (aSnapshot->ValidMask & (1 << i)) {
+            addStatisticsSample(&sSBMDynamicFunctionDescriptionArray[i], tRegisterState, tValue);
+        }
+#endif
+        if (aSnapshot->ValidMask & (1 << i)) {
+            if (!isReportableChange(&sSBMDynamicFunctionDescriptionArray[i], tRegisterState, tValue,
+                    aSnapshot->AcquisitionMillis)) {
+                tRegisterState->LastReadValue = tValue;
+            } else if (isSnapshotChangeConfirmed(aPack, &sSBMDynamicFunctionDescriptionArray[i], tValue)) {
+                tRegisterState->LastReadValue = tValue;
+                queueOutput(aPack, &sSBMDynamicFunctionDescriptionArray[i], tRegisterState, tValue,
+                        aSnapshot->AcquisitionMillis);
+            }
+        }
+#if defined(USE_ADAPTIVE_POLLING)
+        if (aSnapshot->ValidMask & (1 << i)) {
+            updatePollState(aPack, getFunctionCode(&sSBMDynamicFunctionDescriptionArray[i]), tValue, aSnapshot->AcquisitionMillis);
+        }
+#endif
+        tRegisterState++;
+    }
+}
+
+/*
+ * Acquires the snapshot of the next pack which is due
+ * @return true if a snapshot was acquired
+ */
+bool pollNextDueSnapshot(void) {
+    uint32_t tMillis = millis();
+    for (uint8_t i = 0; i < sNumberOfPacks; ++i) {
+        struct SBMPackStruct * tPack = &sPacks[sNextSnapshotPackIndex];
+        sNextSnapshotPackIndex++;
+        if (sNextSnapshotPackIndex >= sNumberOfPacks) {
+            sNextSnapshotPackIndex = 0;
+        }
+        if (tPack->IsRemoved) {
+            continue; // presence is checked by pollNextDueRegister()
+        }
+        // signed difference handles the overflow of millis()
+        int32_t tDelayMillis = tMillis - tPack->NextSnapshotMillis;
+        if (tDelayMillis >= 0) {
+            acquireSnapshot(tPack, &sSnapshot);
+            if (sSnapshot.ValidMask == 0) {
+                // no register answered
+                markPackRemoved(tPack);
+                return true;
+            }
+#if defined(TUNE_BUS_CLOCK)
+            checkBusErrors(tPack, SMBUS_STATUS_OK);
+#endif
+#if defined(SHOW_SCHEDULER_STATISTICS)
+            if (sSnapshot.AcquisitionMicros > sMaxSnapshotTiming.AcquisitionMicros) {
+                sMaxSnapshotTiming.AcquisitionMicros = sSnapshot.AcquisitionMicros;
+            }
+            if (sSnapshot.VoltageCurrentSkewMicros > sMaxSnapshotTiming.VoltageCurrentSkewMicros) {
+                sMaxSnapshotTiming.VoltageCurrentSkewMicros = sSnapshot.VoltageCurrentSkewMicros;
+            }
+#endif
+            processSnapshot(tPack, &sSnapshot, tDelayMillis);
+#if defined(USE_ADAPTIVE_POLLING)
+            tPack->NextSnapshotMillis += getAdaptedPollPeriodMillis(tPack, SNAPSHOT_PERIOD_MILLIS);
+#else
+            tPack->NextSnapshotMillis += SNAPSHOT_PERIOD_MILLIS;
+#endif
+            if ((int32_t) (tMillis - tPack->NextSnapshotMillis) > 0) {
+                // we are more than one period late, do not try to catch up
+                tPack->NextSnapshotMillis = tMillis;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+#endif // defined(USE_SNAPSHOT_POLLING)
+
+#if defined(USE_BINARY_TELEMETRY)
+uint32_t sLastTelemetryMillis;
+
+/*
+ * The decoder needs the design voltage and the capacity mode of each pack to format the capacities
+ * and the values printed by setup() to decide if a changed value is printed.
+ */
+void startTelemetry(void) {
+    Serial.println(F(TELEMETRY_START_LINE));
+    sLastTelemetryMillis = millis();
+    for (uint8_t i = 0; i < sNumberOfPacks; ++i) {
+        struct SBMPackStruct * tPack = &sPacks[i];
+        sendTelemetryFrame(tPack, DESIGN_VOLTAGE, tPack->DesignVoltage, sLastTelemetryMillis);
+        sendTelemetryFrame(tPack, BATTERY_MODE, tPack->CapacityModePower ? CAPACITY_MODE : 0, sLastTelemetryMillis);
+        for (uint8_t j = 0; j < NUMBER_OF_DYNAMIC_REGISTERS; ++j) {
+            sendTelemetryFrame(tPack, getFunctionCode(&sSBMDynamicFunctionDescriptionArray[j]),
+                    tPack->DynamicRegisterStates[j].LastReadValue, sLastTelemetryMillis);
+        }
+        for (uint8_t j = 0; j < NUMBER_OF_OPTIONAL_REGISTERS; ++j) {
+            if (isRegisterSupported(tPack, &sSBMNonStandardFunctionDescriptionArray[j])) {
+                sendTelemetryFrame(tPack, getFunctionCode(&sSBMNonStandardFunctionDescriptionArray[j]),
+                        tPack->OptionalRegisterStates[j].LastReadValue, sLastTelemetryMillis);
+            }
+        }
+    }
+    sendTelemetryFrame(&sPacks[0], TELEMETRY_END_OF_INITIAL_VALUES, 0, sLastTelemetryMillis);
+}
+
+/*
+ * @param aMillis - time of the read of the value
+ */
+void sendTelemetryFrame(struct SBMPackStruct * aPack, uint8_t aFunctionCode, uint16_t aValue, uint32_t aMillis) {
+    uint8_t tFrame[TELEMETRY_MAX_FRAME_LENGTH];
+    uint8_t tLength = encodeTelemetryFrame(tFrame, aMillis - sLastTelemetryMillis,
+            (sNumberOfPacks > 1) ? (uint8_t) (aPack - sPacks) : TELEMETRY_NO_PACK_INDEX, aFunctionCode, aValue);
+    sLastTelemetryMillis = aMillis;
+    Serial.write(tFrame, tLength);
+}
+
+#if !defined(__AVR__)
+/*
+ * Used by the host decoder of the binary telemetry to print a received value with the formatters of this file
+ * @param aOnlyStore - true for the initial values, which were already printed as text by setup()
+ */
+void printTelemetryValue(uint8_t aPackIndex, uint8_t aFunctionCode, uint16_t aValue, bool aOnlyStore) {
+    if (aPackIndex == TELEMETRY_NO_PACK_INDEX) {
+        aPackIndex = 0;
+        sNumberOfPacks = 1;
+    } else if (aPackIndex >= MAX_NUMBER_OF_PACKS) {
+        return;
+    } else if (sNumberOfPacks <= aPackIndex || sNumberOfPacks < 2) {
+        sNumberOfPacks = (aPackIndex < 1) ? 2 : aPackIndex + 1;
+    }
+    sCurrentPack = &sPacks[aPackIndex];
+    if (aFunctionCode == DESIGN_VOLTAGE) {
+        sCurrentPack->DesignVoltage = aValue;
+        return;
+    }
+    if (aFunctionCode == BATTERY_MODE) {
+        sCurrentPack->CapacityModePower = aValue & CAPACITY_MODE;
+        return;
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+        if (getFunctionCode(&sSBMDynamicFunctionDescriptionArray[i]) == aFunctionCode) {
+            if (aOnlyStore) {
+                sCurrentPack->DynamicRegisterStates[i].lastValue = aValue;
+            } else {
+                printValue(&sSBMDynamicFunctionDescriptionArray[i], &sCurrentPack->DynamicRegisterStates[i], aValue);
+            }
+            return;
+        }
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_OPTIONAL_REGISTERS; ++i) {
+        if (getFunctionCode(&sSBMNonStandardFunctionDescriptionArray[i]) == aFunctionCode) {
+            if (aOnlyStore) {
+                sCurrentPack->OptionalRegisterStates[i].lastValue = aValue;
+            } else {
+                printValue(&sSBMNonStandardFunctionDescriptionArray[i], &sCurrentPack->OptionalRegisterStates[i], aValue);
+            }
+            return;
+        }
+    }
+}
+#endif
+#endif // defined(USE_BINARY_TELEMETRY)
+
+#if defined(USE_CURVE_LOG)
+/*
+ * The curve logger stores the values of the first pack every CURVE_LOG_PERIOD_MILLIS, delta encoded as described in CurveLog.h.
+ * The values are the last values found by the poll scheduler, so logging needs no additional bus transfers.
+ * The EEPROM is written in the background, one byte per loop, since each byte takes 3.3 ms.
+ * The first byte of a record or block is written last, so an interrupted write is never decoded.
+ * Sending CURVE_LOG_DUMP_COMMAND over Serial prints the log as CSV.
+ */
+#if defined(CURVE_LOG_IN_RAM)
+#  if !defined(CURVE_LOG_SIZE)
+#define CURVE_LOG_SIZE 512
+#  endif
+uint8_t sCurveLogStorage[CURVE_LOG_SIZE];
+inline uint8_t readCurveLogByte(uint16_t aAddress) {
+    return sCurveLogStorage[aAddress];
+}
+inline void writeCurveLogByte(uint16_t aAddress, uint8_t aValue) {
+    sCurveLogStorage[aAddress] = aValue;
+}
+inline bool isCurveLogStorageReady(void) {
+    return true;
+}
+#else
+#  if !defined(CURVE_LOG_EEPROM_START)
+#define CURVE_LOG_EEPROM_START 256 // the EEPROM below is left free for settings
+#  endif
+#  if !defined(CURVE_LOG_SIZE)
+#define CURVE_LOG_SIZE (E2END + 1 - CURVE_LOG_EEPROM_START)
+#  endif
+#  if defined(CACHE_REGISTER_CAPABILITIES)
+static_assert(CAPABILITY_CACHE_END <= CURVE_LOG_EEPROM_START, "Curve log overlaps the register capability cache");
+#  endif
+inline uint8_t readCurveLogByte(uint16_t aAddress) {
+    return EEPROM.read(CURVE_LOG_EEPROM_START + aAddress);
+}
+inline void writeCurveLogByte(uint16_t aAddress, uint8_t aValue) {
+    EEPROM.update(CURVE_LOG_EEPROM_START + aAddress, aValue);
+}
+inline bool isCurveLogStorageReady(void) {
+    return eeprom_is_ready();
+}
+#endif
+#define CURVE_LOG_NUMBER_OF_BLOCKS (CURVE_LOG_SIZE / CURVE_LOG_BLOCK_SIZE)
+#if !defined(CURVE_LOG_PERIOD_MILLIS)
+#define CURVE_LOG_PERIOD_MILLIS 1000
+#endif
+
+const uint8_t sCurveLogFunctionCodes[CURVE_LOG_NUMBER_OF_FIELDS] = { VOLTAGE, CURRENT, TEMPERATURE, RELATIVE_SOC,
+CELL1_VOLTAGE, CELL2_VOLTAGE, CELL3_VOLTAGE, CELL4_VOLTAGE };
+uint16_t sCurveLogLastValues[CURVE_LOG_NUMBER_OF_FIELDS];
+uint32_t sCurveLogNextSampleMillis;
+uint8_t sCurveLogBlockIndex;
+uint8_t sCurveLogSequence;
+uint8_t sCurveLogBlockLength; // 0 if the next sample must start a new block
+
+uint16_t sCurveLogPendingAddress; // address of the first byte of the pending record
+uint8_t sCurveLogPendingLength; // 0 if nothing is pending
+uint8_t sCurveLogPendingStep;
+uint8_t sCurveLogPendingBytes[CURVE_LOG_MAX_KEYFRAME_LENGTH];
+
+/*
+ * @return the register state of the pack for a dynamic or non standard register or NULL
+ */
+struct SBMRegisterStateStruct * getRegisterState(struct SBMPackStruct * aPack, uint8_t aFunctionCode) {
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+        if (getFunctionCode(&sSBMDynamicFunctionDescriptionArray[i]) == aFunctionCode) {
+            return &aPack->DynamicRegisterStates[i];
+        }
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_OPTIONAL_REGISTERS; ++i) {
+        if (getFunctionCode(&sSBMNonStandardFunctionDescriptionArray[i]) == aFunctionCode) {
+            return &aPack->OptionalRegisterStates[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Continues after the block with the newest sequence number, so the log of the previous runs is kept
+ */
+void initCurveLog(void) {
+#if defined(CURVE_LOG_IN_RAM)
+    memset(sCurveLogStorage, CURVE_LOG_EMPTY_BLOCK, sizeof(sCurveLogStorage));
+#endif
+    sCurveLogBlockIndex = CURVE_LOG_NUMBER_OF_BLOCKS - 1;
+    sCurveLogSequence = CURVE_LOG_MAX_SEQUENCE;
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_BLOCKS; ++i) {
+        uint8_t tSequence = readCurveLogByte(i * CURVE_LOG_BLOCK_SIZE);
+        uint8_t tNextSequence = readCurveLogByte(((i + 1) % CURVE_LOG_NUMBER_OF_BLOCKS) * CURVE_LOG_BLOCK_SIZE);
+        if (tSequence != CURVE_LOG_EMPTY_BLOCK && tNextSequence != getNextCurveLogSequence(tSequence)) {
+            sCurveLogBlockIndex = i;
+            sCurveLogSequence = tSequence;
+            break;
+        }
+    }
+    sCurveLogBlockLength = 0;
+    sCurveLogPendingLength = 0;
+    sCurveLogNextSampleMillis = millis();
+}
+
+inline bool isCurveLogWritePending(void) {
+    return sCurveLogPendingLength > 0;
+}
+
+/*
+ * Writes the next byte of the pending record or keyframe.
+ * Order is: invalidate first byte, end marker behind the record, bytes 1 to n-1, first byte.
+ * For a record, the first byte already contains the end marker, so the invalidation does not write.
+ */
+void writeNextCurveLogByte(void) {
+    uint8_t tStep = sCurveLogPendingStep++;
+    if (tStep == 0) {
+        writeCurveLogByte(sCurveLogPendingAddress, CURVE_LOG_END_MARKER);
+    } else if (tStep == 1) {
+        uint16_t tEndAddress = sCurveLogPendingAddress + sCurveLogPendingLength;
+        if (tEndAddress % CURVE_LOG_BLOCK_SIZE != 0) {
+            writeCurveLogByte(tEndAddress, CURVE_LOG_END_MARKER);
+        }
+    } else if (tStep <= sCurveLogPendingLength) {
+        writeCurveLogByte(sCurveLogPendingAddress + tStep - 1, sCurveLogPendingBytes[tStep - 1]);
+    } else {
+        writeCurveLogByte(sCurveLogPendingAddress, sCurveLogPendingBytes[0]);
+        sCurveLogPendingLength = 0;
+    }
+}
+
+/*
+ * Takes a sample if due and writes at most one byte
+ */
+void logCurve(void) {
+    if (isCurveLogWritePending()) {
+        if (isCurveLogStorageReady()) {
+            writeNextCurveLogByte();
+        }
+        return;
+    }
+    uint32_t tMillis = millis();
+    int32_t tDelayMillis = tMillis - sCurveLogNextSampleMillis;
+    if (tDelayMillis < 0) {
+        return;
+    }
+    if (tDelayMillis >= CURVE_LOG_PERIOD_MILLIS) {
+        // samples are missing, e.g. after a dump, so the implicit timestamps are wrong
+        sCurveLogBlockLength = 0;
+        sCurveLogNextSampleMillis = tMillis;
+    }
+
+    uint16_t tValues[CURVE_LOG_NUMBER_OF_FIELDS];
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_FIELDS; ++i) {
+        tValues[i] = getRegisterState(&sPacks[0], sCurveLogFunctionCodes[i])->LastReadValue;
+    }
+    uint8_t tLength = 0;
+    if (sCurveLogBlockLength > 0) {
+        tLength = encodeCurveLogRecord(sCurveLogPendingBytes, tValues, sCurveLogLastValues);
+        if (sCurveLogBlockLength + tLength > CURVE_LOG_BLOCK_SIZE) {
+            tLength = 0;
+        }
+    }
+    if (tLength == 0) {
+        // start a new block with a keyframe
+        sCurveLogBlockIndex = (sCurveLogBlockIndex + 1) % CURVE_LOG_NUMBER_OF_BLOCKS;
+        sCurveLogSequence = getNextCurveLogSequence(sCurveLogSequence);
+        sCurveLogBlockLength = 0;
+        tLength = encodeCurveLogKeyframe(sCurveLogPendingBytes, sCurveLogSequence, sCurveLogNextSampleMillis,
+        CURVE_LOG_PERIOD_MILLIS, tValues);
+    }
+    sCurveLogPendingAddress = sCurveLogBlockIndex * CURVE_LOG_BLOCK_SIZE + sCurveLogBlockLength;
+    sCurveLogPendingLength = tLength;
+    sCurveLogPendingStep = 0;
+    sCurveLogBlockLength += tLength;
+    memcpy(sCurveLogLastValues, tValues, sizeof(sCurveLogLastValues));
+    sCurveLogNextSampleMillis += CURVE_LOG_PERIOD_MILLIS;
+}
+
+void printCurveLogSample(uint32_t aMillis, uint16_t * aValues) {
+    Serial.print(aMillis);
+    for (uint8_t i = 0; i < CURVE_LOG_NUMBER_OF_FIELDS; ++i) {
+        Serial.print(',');
+        if (sCurveLogFunctionCodes[i] == CURRENT) {
+            Serial.print((int16_t) aValues[i]);
+        } else {
+            Serial.print(aValues[i]);
+        }
+    }
+    Serial.println();
+}
+
+/*
+ * Prints all blocks, oldest first, as CSV. Blocks loop() until all is sent.
+ */
+void dumpCurveLog(void) {
+    while (isCurveLogWritePending()) {
+        writeNextCurveLogByte();
+    }
+    uint32_t tStartMillis = millis();
+    uint16_t tNumberOfSamples = 0;
+    Serial.println(F("\r\n*** CURVE LOG ***"));
+    Serial.println(F("Millis,Voltage mV,Current mA,Temperature 0.1K,Relative Charge %,Cell 1 mV,Cell 2 mV,Cell 3 mV,Cell 4 mV"));
+    for (uint8_t i = 1; i <= CURVE_LOG_NUMBER_OF_BLOCKS; ++i) {
+        uint16_t tBlockAddress = ((sCurveLogBlockIndex + i) % CURVE_LOG_NUMBER_OF_BLOCKS) * CURVE_LOG_BLOCK_SIZE;
+        if (readCurveLogByte(tBlockAddress) == CURVE_LOG_EMPTY_BLOCK) {
+            continue;
+        }
+        uint8_t tBlock[CURVE_LOG_BLOCK_SIZE - 1];
+        for (uint8_t j = 0; j < sizeof(tBlock); ++j) {
+            tBlock[j] = readCurveLogByte(tBlockAddress + 1 + j);
+        }
+        uint32_t tMillis;
+        uint16_t tPeriodMillis;
+        uint16_t tValues[CURVE_LOG_NUMBER_OF_FIELDS];
+        uint8_t tIndex = decodeCurveLogKeyframe(tBlock, sizeof(tBlock), &tMillis, &tPeriodMillis, tValues);
+        uint8_t tLength = tIndex;
+        while (tLength > 0) {
+            printCurveLogSample(tMillis, tValues);
+            tNumberOfSamples++;
+            tMillis += tPeriodMillis;
+            tLength = decodeCurveLogRecord(&tBlock[tIndex], sizeof(tBlock) - tIndex, tValues);
+            tIndex += tLength;
+        }
+    }
+    Serial.print(tNumberOfSamples);
+    Serial.print(F(" samples dumped in "));
+    Serial.print(millis() - tStartMillis);
+    Serial.println(F(" ms"));
+}
+#endif // defined(USE_CURVE_LOG)
+
+#if defined(USE_TRIGGER_CAPTURE)
+/*
+ * Trigger capture like an oscilloscope, for the first pack.
+ * Before the trigger, a sample of the capture fields is read every CAPTURE_PRE_TRIGGER_PERIOD_MILLIS into a ring
+ * of CAPTURE_PRE_TRIGGER_SAMPLES. After the trigger, the poll scheduler is paused and CAPTURE_POST_TRIGGER_SAMPLES
+ * are read back to back, one sample per loop, i.e. at the maximum rate of the bus.
+ * Then the whole capture is printed as one block of CSV, with the millis relative to the trigger
+ * and the achieved sample rate after the trigger.
+ * Triggers are a rising alarm bit of BatteryStatus, a change of the manufacturer status to charge termination
+ * or permanent failure, and CAPTURE_TRIGGER_COMMAND sent over Serial.
+ * Fields not supported by the pack are not read and left empty in the CSV.
+ */
+#if !defined(CAPTURE_PRE_TRIGGER_SAMPLES)
+#define CAPTURE_PRE_TRIGGER_SAMPLES     8 // each sample requires 14 bytes of RAM
+#endif
+#if !defined(CAPTURE_POST_TRIGGER_SAMPLES)
+#define CAPTURE_POST_TRIGGER_SAMPLES    24
+#endif
+#if !defined(CAPTURE_PRE_TRIGGER_PERIOD_MILLIS)
+#define CAPTURE_PRE_TRIGGER_PERIOD_MILLIS 250
+#endif
+#if !defined(CAPTURE_TRIGGER_ALARM_BITS)
+#define CAPTURE_TRIGGER_ALARM_BITS (OVER_CHARGED_ALARM | TERMINATE_CHARGE_ALARM | OVER_TEMP_ALARM | TERMINATE_DISCHARGE_ALARM \
+        | REMAINING_CAPACITY_ALARM_FLAG | REMAINING_TIME_ALARM_FLAG)
+#endif
+#define CAPTURE_NUMBER_OF_FIELDS        6
+#define CAPTURE_STATE_UNKNOWN           0xFF
+#define CAPTURE_STATE_CHARGE_TERMINATION 0x07
+#define CAPTURE_STATE_PERMANENT_FAILURE 0x09
+
+const uint8_t sCaptureFunctionCodes[CAPTURE_NUMBER_OF_FIELDS] = { VOLTAGE, CURRENT, CELL1_VOLTAGE, CELL2_VOLTAGE, CELL3_VOLTAGE,
+CELL4_VOLTAGE };
+
+struct CaptureSampleStruct {
+    uint16_t Millis; // lower 16 bits of millis(), enough for the time relative to the trigger
+    uint16_t Values[CAPTURE_NUMBER_OF_FIELDS];
+};
+// the ring of pre trigger samples followed by the post trigger samples
+struct CaptureSampleStruct sCaptureSamples[CAPTURE_PRE_TRIGGER_SAMPLES + CAPTURE_POST_TRIGGER_SAMPLES];
+uint8_t sCapturePreTriggerIndex; // the ring entry written next
+uint8_t sCapturePreTriggerCount;
+uint8_t sCapturePostTriggerCount;
+uint8_t sCaptureFieldMask; // bit 0 for the first field, set if the field is supported by the pack
+uint8_t sCaptureManufacturerState = CAPTURE_STATE_UNKNOWN;
+bool sCaptureIsTriggered;
+uint32_t sCaptureTriggerMillis;
+uint32_t sCaptureNextPreTriggerMillis;
+const __FlashStringHelper * sCaptureTriggerCause;
+uint16_t sCaptureTriggerValue;
+
+bool isCaptureFieldSupported(struct SBMPackStruct * aPack, uint8_t aFunctionCode) {
+    for (uint8_t i = 0; i < NUMBER_OF_DYNAMIC_REGISTERS; ++i) {
+        if (getFunctionCode(&sSBMDynamicFunctionDescriptionArray[i]) == aFunctionCode) {
+            return isRegisterSupported(aPack, &sSBMDynamicFunctionDescriptionArray[i]);
+        }
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_NON_STANDARD_REGISTERS; ++i) {
+        if (getFunctionCode(&sSBMNonStandardFunctionDescriptionArray[i]) == aFunctionCode) {
+            return isRegisterSupported(aPack, &sSBMNonStandardFunctionDescriptionArray[i]);
+        }
+    }
+    return false;
+}
+
+uint8_t getCaptureFieldMask(struct SBMPackStruct * aPack) {
+    uint8_t tMask = 0;
+    for (uint8_t i = 0; i < CAPTURE_NUMBER_OF_FIELDS; ++i) {
+        if (isCaptureFieldSupported(aPack, sCaptureFunctionCodes[i])) {
+            tMask |= 1 << i;
+        }
+    }
+    return tMask;
+}
 
-    Serial.println(F("\r\n*** DYNAMIC INFO ***"));
-    Serial.flush();
-    printFunctionDescriptionArray(sSBMDynamicFunctionDescriptionArray,
-            (sizeof(sSBMDynamicFunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)), false);
+/*
+ * Ignored while a capture is running
+ * @param aValue - printed with the cause if not 0
+ */
+void triggerCapture(const __FlashStringHelper * aCause, uint16_t aValue) {
+    if (sCaptureIsTriggered || sPacks[0].IsRemoved) {
+        return;
+    }
+    sCaptureIsTriggered = true;
+    sCaptureTriggerMillis = millis();
+    sCaptureTriggerCause = aCause;
+    sCaptureTriggerValue = aValue;
+    sCapturePostTriggerCount = 0;
+    sCaptureFieldMask = getCaptureFieldMask(&sPacks[0]);
+}
 
-    Serial.println(F("\r\n*** DYNAMIC NON STANDARD INFO ***"));
-    Serial.flush();
-    printSMBNonStandardInfo(false);
+/*
+ * Called for each changed BatteryStatus of the first pack
+ */
+void checkBatteryStatusTrigger(uint16_t aLastStatus, uint16_t aStatus) {
+    uint16_t tNewAlarms = aStatus & ~aLastStatus & CAPTURE_TRIGGER_ALARM_BITS;
+    if (tNewAlarms != 0) {
+        triggerCapture(F("BatteryStatus alarm"), tNewAlarms);
+    }
+}
 
-    Serial.println(F("\r\n*** CHANGED VALUES ***"));
-    Serial.flush();
+void checkManufacturerStateTrigger(struct SBMPackStruct * aPack) {
+    uint16_t tStatus = aPack->Device.readWordFromManufacturerAccess(BQ20Z70_Manufacturer_Status);
+    if (!aPack->Device.LastReadIsValid || tStatus == 0xFFFF) {
+        return;
+    }
+    uint8_t tState = (tStatus >> 8) & 0x0F;
+    if (tState != sCaptureManufacturerState && sCaptureManufacturerState != CAPTURE_STATE_UNKNOWN) {
+        if (tState == CAPTURE_STATE_CHARGE_TERMINATION) {
+            triggerCapture(F("Charge Termination"), tState);
+        } else if (tState == CAPTURE_STATE_PERMANENT_FAILURE) {
+            triggerCapture(F("Permanent Failure"), tState);
+        }
+    }
+    sCaptureManufacturerState = tState;
 }
 
-void loop() {
-    printFunctionDescriptionArray(sSBMDynamicFunctionDescriptionArray,
-            (sizeof(sSBMDynamicFunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)), true);
-    printSMBNonStandardInfo(true);
-    delay(3000);
+void readCaptureSample(struct SBMPackStruct * aPack, struct CaptureSampleStruct * aSample) {
+    selectMuxChannelOfPack(aPack);
+    aSample->Millis = millis();
+    for (uint8_t i = 0; i < CAPTURE_NUMBER_OF_FIELDS; ++i) {
+        aSample->Values[i] = (sCaptureFieldMask & (1 << i)) ? aPack->Device.readWord(sCaptureFunctionCodes[i]) : 0xFFFF;
+    }
 }
 
-void TogglePin(uint8_t aPinNr) {
-    if (digitalRead(aPinNr) == HIGH) {
-        digitalWrite(aPinNr, LOW);
-    } else {
-        digitalWrite(aPinNr, HIGH);
+void printCaptureSample(struct CaptureSampleStruct * aSample) {
+    Serial.print((int16_t) (aSample->Millis - (uint16_t) sCaptureTriggerMillis));
+    for (uint8_t i = 0; i < CAPTURE_NUMBER_OF_FIELDS; ++i) {
+        Serial.print(',');
+        if (sCaptureFieldMask & (1 << i)) {
+            if (sCaptureFunctionCodes[i] == CURRENT) {
+                Serial.print((int16_t) aSample->Values[i]);
+            } else {
+                Serial.print(aSample->Values[i]);
+            }
+        }
     }
+    Serial.println();
 }
 
-void BlinkLedForever(int aBinkDelay) {
-    do {
-        digitalWrite(LED_PIN, HIGH);
-        delay(aBinkDelay);
-        digitalWrite(LED_PIN, LOW);
-        delay(aBinkDelay);
-    } while (true);
+/*
+ * Prints the pre trigger samples, oldest first, and the post trigger samples. Blocks loop() until all is sent.
+ */
+void printCapture(uint32_t aEndMillis) {
+    Serial.println(F("\r\n*** CAPTURE ***"));
+    Serial.print(F("Trigger: "));
+    Serial.print(sCaptureTriggerCause);
+    if (sCaptureTriggerValue != 0) {
+        Serial.print(F(" 0x"));
+        Serial.print(sCaptureTriggerValue, HEX);
+    }
+    Serial.print(F(" at "));
+    Serial.print(sCaptureTriggerMillis);
+    Serial.println(F(" ms"));
+    Serial.println(F("Millis,Voltage mV,Current mA,Cell 1 mV,Cell 2 mV,Cell 3 mV,Cell 4 mV"));
+    for (uint8_t i = 0; i < sCapturePreTriggerCount; ++i) {
+        printCaptureSample(
+                &sCaptureSamples[(sCapturePreTriggerIndex + CAPTURE_PRE_TRIGGER_SAMPLES - sCapturePreTriggerCount + i)
+                        % CAPTURE_PRE_TRIGGER_SAMPLES]);
+    }
+    for (uint8_t i = 0; i < sCapturePostTriggerCount; ++i) {
+        printCaptureSample(&sCaptureSamples[CAPTURE_PRE_TRIGGER_SAMPLES + i]);
+    }
+    uint32_t tMillis = aEndMillis - sCaptureTriggerMillis;
+    Serial.print(sCapturePostTriggerCount);
+    Serial.print(F(" samples after trigger in "));
+    Serial.print(tMillis);
+    Serial.print(F(" ms, "));
+    if (tMillis > 0) {
+        char tBuffer[FIXED_POINT_BUFFER_SIZE];
+        // rounded to 0.1
+        formatFixedPoint(tBuffer, ((sCapturePostTriggerCount * 10000UL) + (tMillis / 2)) / tMillis, 1);
+        Serial.print(tBuffer);
+    }
+    Serial.println(F(" samples/s"));
 }
 
-bool checkForAttachedI2CDevice(uint8_t aStandardDeviceAddress) {
-    bool tOK = i2c_start(aStandardDeviceAddress << 1 | I2C_WRITE);
-    i2c_stop();
-    if (tOK) {
-        Serial.print(F("Found attached I2C device at 0x"));
-        Serial.println(aStandardDeviceAddress, HEX);
-        sI2CDeviceAddress = SBM_DEVICE_ADDRESS;
+/*
+ * Reads a pre trigger sample if due or the next post trigger sample.
+ * The post trigger samples are read without any delay, so the poll scheduler must not be called while capturing.
+ * @return true if a post trigger sample was read
+ */
+bool captureNextSample(void) {
+    struct SBMPackStruct * tPack = &sPacks[0];
+    if (sCaptureIsTriggered) {
+        if (!tPack->IsRemoved) {
+            readCaptureSample(tPack, &sCaptureSamples[CAPTURE_PRE_TRIGGER_SAMPLES + sCapturePostTriggerCount]);
+            sCapturePostTriggerCount++;
+        }
+        if (sCapturePostTriggerCount >= CAPTURE_POST_TRIGGER_SAMPLES || tPack->IsRemoved) {
+            printCapture(millis());
+            // the next capture starts with an empty history
+            sCaptureIsTriggered = false;
+            sCapturePreTriggerCount = 0;
+            sCaptureNextPreTriggerMillis = millis();
+        }
         return true;
-    } else {
+    }
+
+    uint32_t tMillis = millis();
+    int32_t tDelayMillis = tMillis - sCaptureNextPreTriggerMillis;
+    if (tPack->IsRemoved || tDelayMillis < 0) {
         return false;
     }
+    sCaptureNextPreTriggerMillis += CAPTURE_PRE_TRIGGER_PERIOD_MILLIS;
+    if (tDelayMillis >= CAPTURE_PRE_TRIGGER_PERIOD_MILLIS) {
+        sCaptureNextPreTriggerMillis = tMillis + CAPTURE_PRE_TRIGGER_PERIOD_MILLIS;
+    }
+    sCaptureFieldMask = getCaptureFieldMask(tPack);
+    readCaptureSample(tPack, &sCaptureSamples[sCapturePreTriggerIndex]);
+    sCapturePreTriggerIndex = (sCapturePreTriggerIndex + 1) % CAPTURE_PRE_TRIGGER_SAMPLES;
+    if (sCapturePreTriggerCount < CAPTURE_PRE_TRIGGER_SAMPLES) {
+        sCapturePreTriggerCount++;
+    }
+    checkManufacturerStateTrigger(tPack);
+    return false;
 }
+#endif // defined(USE_TRIGGER_CAPTURE)
 
-int sScanCount = 0;
-int scanForAttachedI2CDevice(void) {
-    int tFoundAdress = -1;
-    for (uint8_t i = 0; i < 127; i++) {
-        bool ack = i2c_start(i << 1 | I2C_WRITE);
-        if (ack) {
-            Serial.print(F("Found I2C device attached at address: 0x"));
-            Serial.println(i, HEX);
-            tFoundAdress = i;
+#if defined(SHOW_SCHEDULER_STATISTICS)
+#define SCHEDULER_STATISTICS_PERIOD_MILLIS 60000
+void printSchedulerStatisticsArray(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint8_t aLengthOfArray, uint32_t aElapsedMillis) {
+    for (uint8_t i = 0; i < aLengthOfArray; ++i) {
+        if (aRegisterState->PollCount != 0) {
+            printDescription(aSBMFunctionDescription);
+            char tBuffer[FIXED_POINT_BUFFER_SIZE];
+            // rounded to 0.01
+            formatFixedPoint(tBuffer, ((aRegisterState->PollCount * 100000UL) + (aElapsedMillis / 2)) / aElapsedMillis, 2);
+            Serial.print(tBuffer);
+            Serial.print(F(" polls/s, max jitter "));
+            Serial.print(aRegisterState->MaxJitterMillis);
+            Serial.println(F(" ms"));
+            aRegisterState->PollCount = 0;
+            aRegisterState->MaxJitterMillis = 0;
         }
-        i2c_stop();
-    }
-    if (tFoundAdress < 0) {
-        Serial.print(F("Found no attached I2C device - "));
-        Serial.println(sScanCount);
-        myLCD.setCursor(0, 3);
-        // print the number of seconds since reset:
-        myLCD.print("No device ");
-        myLCD.print(sScanCount);
-        sScanCount++;
-    } else {
-        sI2CDeviceAddress = tFoundAdress;
+        aSBMFunctionDescription++;
+        aRegisterState++;
     }
-    return tFoundAdress;
 }
 
-int readWord(uint8_t aFunction) {
-    cli();
-    i2c_start((sI2CDeviceAddress << 1) | I2C_WRITE);
-    i2c_write(aFunction);
-    i2c_rep_start((sI2CDeviceAddress << 1) | I2C_READ);
-    uint8_t tLSB = i2c_read(false);
-    uint8_t tMSB = i2c_read(true);
-    i2c_stop();
-    return (int) tLSB | (((int) tMSB) << 8);
-    sei();
+/*
+ * Prints and resets the statistics every minute
+ */
+void printSchedulerStatistics(void) {
+    uint32_t tElapsedMillis = millis() - sSchedulerStartMillis;
+    if (tElapsedMillis >= SCHEDULER_STATISTICS_PERIOD_MILLIS) {
+        Serial.println(F("\r\n*** SCHEDULER STATISTICS ***"));
+        uint16_t tPECErrorCount = 0;
+        for (uint8_t i = 0; i < sNumberOfPacks; ++i) {
+            sCurrentPack = &sPacks[i];
+            printSchedulerStatisticsArray(sSBMDynamicFunctionDescriptionArray, sPacks[i].DynamicRegisterStates,
+            NUMBER_OF_DYNAMIC_REGISTERS, tElapsedMillis);
+            printSchedulerStatisticsArray(sSBMNonStandardFunctionDescriptionArray, sPacks[i].OptionalRegisterStates,
+            NUMBER_OF_OPTIONAL_REGISTERS, tElapsedMillis);
+            tPECErrorCount += sPacks[i].Device.PECErrorCount;
+#if defined(USE_ADAPTIVE_POLLING)
+            printPollState(&sPacks[i]);
+#endif
+        }
+#if defined(USE_SNAPSHOT_POLLING)
+        Serial.print(F("Max snapshot "));
+        printSnapshotTiming(&sMaxSnapshotTiming);
+        sMaxSnapshotTiming.AcquisitionMicros = 0;
+        sMaxSnapshotTiming.VoltageCurrentSkewMicros = 0;
+#endif
+        Serial.print(F("PEC errors: "));
+        Serial.println(tPECErrorCount);
+        Serial.print(F("Output overruns: "));
+        Serial.print(sOutputOverrunCount);
+        Serial.print(F(", coalesced: "));
+        Serial.println(sOutputCoalescedCount);
+        Serial.println();
+        sSchedulerStartMillis += tElapsedMillis;
+    }
 }
+#endif
 
-void writeWord(uint8_t aFunction, uint16_t aValue) {
-    cli();
-    i2c_start((sI2CDeviceAddress << 1) | I2C_WRITE);
-    i2c_write(aFunction);
-    i2c_rep_start((sI2CDeviceAddress << 1) | I2C_WRITE);
-    i2c_write(aValue & 0xFF);
-    i2c_write((aValue >> 8) & 0xFF);
-    i2c_stop();
-    sei();
-}
+#if defined(USE_REGISTER_STATISTICS)
+/*
+ * Running statistics of the polled registers, printed and restarted every STATISTICS_WINDOW_SECONDS.
+ * Each valid read is a sample, the changed values which are printed are only a fraction of them.
+ * Mean and variance are updated with the method of Welford in integer arithmetic, so no sample must be stored.
+ * The mean is kept with 8 and the sum of the squared deviations with 4 fractional bits. The sum saturates at 0xFFFFFFFF,
+ * which is reached e.g. for 240 samples with a standard deviation above 1000, then the standard deviation is printed with ">".
+ * Values are in the units of the register, e.g. 0.1 K for the temperature. Binary registers have no statistics
+ * and 0xFFFF of a time, which means "not applicable", is not counted.
+ */
+#if !defined(STATISTICS_WINDOW_SECONDS)
+#define STATISTICS_WINDOW_SECONDS 60
+#endif
 
-int readWordFromManufacturerAccess(uint16_t aCommand) {
-    cli();
-    i2c_start((sI2CDeviceAddress << 1) | I2C_WRITE);
-    i2c_write(MANUFACTURER_ACCESS);
-    // Write manufacturer command word
-    i2c_rep_start((sI2CDeviceAddress << 1) | I2C_WRITE);
-    i2c_write(aCommand);
-    i2c_write(aCommand >> 8);
-    i2c_stop();
-    // Read manufacturer result word
-    i2c_start((sI2CDeviceAddress << 1) | I2C_WRITE);
-    i2c_write(MANUFACTURER_ACCESS);
-    i2c_rep_start((sI2CDeviceAddress << 1) | I2C_READ);
-    uint8_t tLSB = i2c_read(false);
-    uint8_t tMSB = i2c_read(true);
-    i2c_stop();
-    sei();
-    return (int) tLSB | (((int) tMSB) << 8);
+bool hasStatistics(uint8_t aFormat) {
+    return aFormat != FORMAT_BINARY && aFormat != FORMAT_BATTERY_MODE && aFormat != FORMAT_BATTERY_STATUS;
 }
 
-uint8_t readBlock(uint8_t aCommand, uint8_t* aDataBufferPtr, uint8_t aDataBufferLength) {
-    cli();
-    i2c_start((sI2CDeviceAddress << 1) + I2C_WRITE);
-    i2c_write(aCommand);
-    i2c_rep_start((sI2CDeviceAddress << 1) + I2C_READ);
-
-    // First read length of data
-    uint8_t tLengthOfData = i2c_read(false);
-    if (tLengthOfData > aDataBufferLength) {
-        tLengthOfData = aDataBufferLength;
+void addStatisticsSample(const struct SBMFunctionDescriptionStruct * aDescription, struct SBMRegisterStateStruct * aRegisterState,
+        uint16_t aValue) {
+    uint8_t tFormat = getFormat(aDescription);
+    if (!hasStatistics(tFormat) || (tFormat == FORMAT_TIME && aValue == 0xFFFF)
+            || aRegisterState->SampleCount == 0xFFFF) {
+        return;
     }
-
-    // then read data
-    uint8_t tIndex;
-    for (tIndex = 0; tIndex < tLengthOfData - 1; tIndex++) {
-        aDataBufferPtr[tIndex] = i2c_read(false);
+    int32_t tValue = getNumericValue(aDescription, aValue);
+    aRegisterState->SampleCount++;
+    if (aRegisterState->SampleCount == 1) {
+        aRegisterState->MinValue = aValue;
+        aRegisterState->MaxValue = aValue;
+        aRegisterState->MeanQ8 = tValue * 256;
+        aRegisterState->SumOfSquaredDeviations = 0;
+        return;
+    }
+    if (tValue < getNumericValue(aDescription, aRegisterState->MinValue)) {
+        aRegisterState->MinValue = aValue;
+    }
+    if (tValue > getNumericValue(aDescription, aRegisterState->MaxValue)) {
+        aRegisterState->MaxValue = aValue;
+    }
+    int32_t tDelta = tValue * 256 - aRegisterState->MeanQ8;
+    aRegisterState->MeanQ8 += tDelta / (int32_t) aRegisterState->SampleCount;
+    int32_t tDeltaToNewMean = tValue * 256 - aRegisterState->MeanQ8;
+    // both deltas have the same sign, except for rounding of the mean
+    // rounded, otherwise the small increments of a value toggling by 1 would be lost
+    int64_t tIncrement = ((int64_t) tDelta * tDeltaToNewMean + (1 << 11)) >> 12;
+    if (tIncrement > 0) {
+        if ((uint64_t) tIncrement > 0xFFFFFFFF - aRegisterState->SumOfSquaredDeviations) {
+            aRegisterState->SumOfSquaredDeviations = 0xFFFFFFFF;
+        } else {
+            aRegisterState->SumOfSquaredDeviations += tIncrement;
+        }
     }
-    // Read last byte with "true"
-    aDataBufferPtr[tIndex++] = i2c_read(true);
-
-    i2c_stop();
-    sei();
-    return tLengthOfData;
 }
 
-void printValue(struct SBMFunctionDescriptionStruct* aSBMFunctionDescription, uint16_t tActualValue) {
-    {
-        if (aSBMFunctionDescription->ValueFormatter == NULL) {
-            Serial.print(aSBMFunctionDescription->Description);
-            Serial.println(tActualValue);
-            aSBMFunctionDescription->lastValue = tActualValue;
+/*
+ * @return the square root rounded to the nearest integer
+ */
+uint16_t sqrtOfUInt32(uint32_t aValue) {
+    uint32_t tRoot = 0;
+    uint32_t tBit = 1UL << 30;
+    while (tBit > aValue) {
+        tBit >>= 2;
+    }
+    while (tBit != 0) {
+        if (aValue >= tRoot + tBit) {
+            aValue -= tRoot + tBit;
+            tRoot = (tRoot >> 1) + tBit;
         } else {
-            aSBMFunctionDescription->ValueFormatter(aSBMFunctionDescription, tActualValue);
+            tRoot >>= 1;
         }
-        Serial.flush();
-        aSBMFunctionDescription->lastValue = tActualValue;
+        tBit >>= 2;
     }
+    // aValue is now the remainder of the truncated root
+    if (aValue > tRoot && tRoot < 0xFFFF) {
+        tRoot++;
+    }
+    return tRoot;
 }
 
 /*
- * Read word and print if value has changed.
- * To avoid spurious outputs check changed values 3 times.
- */
-void readWordAndPrint(struct SBMFunctionDescriptionStruct *aSBMFunctionDescription, bool aOnlyPrintIfValueChanged) {
-    uint16_t tActualValue = readWord(aSBMFunctionDescription->FunctionCode);
-
-    if (aOnlyPrintIfValueChanged) {
-        if (tActualValue != aSBMFunctionDescription->lastValue) {
-            // check value again, maybe it was a transmit error
-            delay(33); // just guessed the value
-            uint16_t tActualValue2 = readWord(aSBMFunctionDescription->FunctionCode);
-            if (tActualValue2 != aSBMFunctionDescription->lastValue) {
-                delay(17); // just guessed the value
-                uint16_t tActualValue3 = readWord(aSBMFunctionDescription->FunctionCode);
-                if (tActualValue3 != aSBMFunctionDescription->lastValue) {
-                    printValue(aSBMFunctionDescription, tActualValue);
-                }
+ * Prints value / 10 with one decimal
+ */
+void printTenths(int32_t aTenths) {
+    if (aTenths < 0) {
+        Serial.print('-');
+        aTenths = -aTenths;
+    }
+    Serial.print(aTenths / 10);
+    Serial.print('.');
+    Serial.print(aTenths % 10);
+}
+
+void printStatisticsArray(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterState, uint8_t aLengthOfArray) {
+    for (uint8_t i = 0; i < aLengthOfArray; ++i) {
+        uint16_t tCount = aRegisterState->SampleCount;
+        if (tCount != 0) {
+            printDescription(aSBMFunctionDescription);
+            Serial.print(F("min "));
+            Serial.print(getNumericValue(aSBMFunctionDescription, aRegisterState->MinValue));
+            Serial.print(F(", max "));
+            Serial.print(getNumericValue(aSBMFunctionDescription, aRegisterState->MaxValue));
+            Serial.print(F(", mean "));
+            // rounded to 0.1
+            int32_t tMeanQ8 = aRegisterState->MeanQ8;
+            printTenths((tMeanQ8 * 10 + ((tMeanQ8 < 0) ? -128 : 128)) / 256);
+            Serial.print(F(", sd "));
+            if (aRegisterState->SumOfSquaredDeviations == 0xFFFFFFFF) {
+                Serial.print('>');
             }
+            // variance * 16
+            uint32_t tVarianceQ4 = (tCount > 1) ? aRegisterState->SumOfSquaredDeviations / (tCount - 1) : 0;
+            if (tVarianceQ4 < 0xFFFFFFFF / 100) {
+                // sqrt(variance * 16 * 100 / 16) = 10 * sd
+                printTenths(sqrtOfUInt32((tVarianceQ4 * 100) / 16));
+            } else {
+                Serial.print(sqrtOfUInt32(tVarianceQ4 / 16));
+            }
+            Serial.print(F(", "));
+            Serial.print(tCount);
+            Serial.println(F(" samples"));
+            aRegisterState->SampleCount = 0;
         }
+        aSBMFunctionDescription++;
+        aRegisterState++;
+    }
+}
 
-    } else {
-        printValue(aSBMFunctionDescription, tActualValue);
+/*
+ * Prints and restarts the statistics every STATISTICS_WINDOW_SECONDS
+ */
+void printRegisterStatistics(void) {
+    uint32_t tElapsedMillis = millis() - sStatisticsStartMillis;
+    if (tElapsedMillis >= STATISTICS_WINDOW_SECONDS * 1000UL) {
+        Serial.print(F("\r\n*** STATISTICS OF "));
+        Serial.print(tElapsedMillis / 1000);
+        Serial.println(F(" s ***"));
+        for (uint8_t i = 0; i < sNumberOfPacks; ++i) {
+            sCurrentPack = &sPacks[i]; // for the pack number printed by printDescription()
+            printStatisticsArray(sSBMDynamicFunctionDescriptionArray, sPacks[i].DynamicRegisterStates,
+            NUMBER_OF_DYNAMIC_REGISTERS);
+            printStatisticsArray(sSBMNonStandardFunctionDescriptionArray, sPacks[i].OptionalRegisterStates,
+            NUMBER_OF_OPTIONAL_REGISTERS);
+        }
+        Serial.println();
+        sStatisticsStartMillis += tElapsedMillis;
+    }
+}
+#endif // defined(USE_REGISTER_STATISTICS)
+
+#if defined(SHOW_FORMAT_BENCHMARK)
+/*
+ * Measures the formatting of voltages and temperatures with the former float code and with FixedPointFormat.h.
+ * The output is written to a Print, which discards it. The results are only meaningful on the Arduino,
+ * since time is simulated on the host.
+ */
+class NullPrint: public Print {
+public:
+    size_t write(uint8_t aByte) {
+        (void) aByte;
+        return 1;
+    }
+    using Print::write;
+};
+
+#define FORMAT_BENCHMARK_LOOPS 100
+void printFormatBenchmarkResult(const __FlashStringHelper * aName, uint32_t aFloatMicros, uint32_t aFixedPointMicros) {
+    Serial.print(aName);
+    Serial.print(F(" float: "));
+    Serial.print((aFloatMicros * (F_CPU / 1000000L)) / FORMAT_BENCHMARK_LOOPS);
+    Serial.print(F(" cycles, fixed point: "));
+    Serial.print((aFixedPointMicros * (F_CPU / 1000000L)) / FORMAT_BENCHMARK_LOOPS);
+    Serial.println(F(" cycles"));
+}
+
+void printFormatBenchmark(void) {
+    NullPrint tNullPrint;
+    char tBuffer[FIXED_POINT_BUFFER_SIZE];
+
+    uint32_t tStartMicros = micros();
+    for (uint16_t i = 0; i < FORMAT_BENCHMARK_LOOPS; ++i) {
+        tNullPrint.print((float) (11000 + i) / 1000, 3);
+    }
+    uint32_t tFloatMicros = micros() - tStartMicros;
+    tStartMicros = micros();
+    for (uint16_t i = 0; i < FORMAT_BENCHMARK_LOOPS; ++i) {
+        formatMillivolt(tBuffer, 11000 + i);
+        tNullPrint.print(tBuffer);
     }
+    printFormatBenchmarkResult(F("Voltage"), tFloatMicros, micros() - tStartMicros);
+
+    tStartMicros = micros();
+    for (uint16_t i = 0; i < FORMAT_BENCHMARK_LOOPS; ++i) {
+        tNullPrint.print((float) ((2900 + i) / 10.0) - 273.15);
+    }
+    tFloatMicros = micros() - tStartMicros;
+    tStartMicros = micros();
+    for (uint16_t i = 0; i < FORMAT_BENCHMARK_LOOPS; ++i) {
+        formatDeciKelvinAsCelsius(tBuffer, 2900 + i);
+        tNullPrint.print(tBuffer);
+    }
+    printFormatBenchmarkResult(F("Temperature"), tFloatMicros, micros() - tStartMicros);
 }
+#endif
 
-void printBinary(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue) {
-    Serial.print(aDescription->Description);
+void printBinary(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue) {
+    printDescription(aDescription);
     Serial.print("0b");
     Serial.println(aValue, BIN);
 }
 
-void printSigned(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue) {
-    Serial.print(aDescription->Description);
-    Serial.println((int) aValue);
+void printSigned(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValue) {
+    printDescription(aDescription);
+    Serial.println((int16_t) aValue);
 }
 
 const char * getCapacityModeUnit() {
-    if (sCapacityModePower) {
+    if (sCurrentPack->CapacityModePower) {
         return StringCapacityModePower;
     }
     return StringCapacityModeCurrent;
 
 }
 
-void printCapacity(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCapacity) {
-    Serial.print(aDescription->Description);
+void printCapacity(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCapacity) {
+    printDescription(aDescription);
     Serial.print(aCapacity);
     Serial.print(getCapacityModeUnit());
     Serial.print('h');
-    if (sCapacityModePower) {
+    if (sCurrentPack->CapacityModePower) {
         // print also mA since changing capacity mode did not work
         Serial.print(" | ");
-        aCapacity = (aCapacity * 10000L) / sDesignVoltage;
+        aCapacity = convertCentiWattToMilliampere(aCapacity, sCurrentPack->DesignVoltage);
         Serial.print(aCapacity);
         Serial.print(StringCapacityModeCurrent);
         Serial.print('h');
     }
     Serial.println();
 
-    if (aDescription->DescriptionLCD != NULL) {
+    if (isLCDOutput(aDescription)) {
         // always print as mAh
-        myLCD.setCursor(0, 3);
-        myLCD.print(aDescription->DescriptionLCD);
-        myLCD.print(aCapacity);
-        myLCD.print(StringCapacityModeCurrent);
-        myLCD.print('h');
+        myShadowLCD.setCursor(0, 3);
+        myShadowLCD.print(getDescriptionLCD(aDescription));
+        myShadowLCD.print(aCapacity);
+        myShadowLCD.print(StringCapacityModeCurrent);
+        myShadowLCD.print('h');
+        myShadowLCD.clearToColumn(LCD_COLUMNS);
     }
 }
 
-void printPercentage(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aPercentage) {
-    Serial.print(aDescription->Description);
+void printPercentage(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aPercentage) {
+    printDescription(aDescription);
     Serial.print(aPercentage);
     Serial.println(" %");
-    if (aDescription->DescriptionLCD != NULL) {
-        myLCD.setCursor(0, 2);
-        myLCD.print(aPercentage);
-        myLCD.print(" %");
-        myLCD.print(aDescription->DescriptionLCD);
+    if (isLCDOutput(aDescription)) {
+        myShadowLCD.setCursor(0, 2);
+        myShadowLCD.print(aPercentage);
+        myShadowLCD.print(" %");
+        myShadowLCD.print(getDescriptionLCD(aDescription));
+        myShadowLCD.clearToColumn(LCD_COLUMNS);
     }
 }
 
-void printTime(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMinutes) {
-    Serial.print(aDescription->Description);
+void printTime(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMinutes) {
+    printDescription(aDescription);
     if (aMinutes == 65535) {
         Serial.println(F("Battery not beeing (dis)charged"));
     } else {
         Serial.print(aMinutes);
         Serial.println(" min");
-        if (aDescription->DescriptionLCD != NULL) {
-            myLCD.setCursor(0, 1);
-            myLCD.print(aMinutes);
-            myLCD.print(aDescription->DescriptionLCD);
+        if (isLCDOutput(aDescription)) {
+            myShadowLCD.setCursor(0, 1);
+            myShadowLCD.print(aMinutes);
+            myShadowLCD.print(getDescriptionLCD(aDescription));
+            myShadowLCD.clearToColumn(LCD_COLUMNS);
         }
     }
 }
 
-/*
- * Print only if changed by two ore more mV
- */
-void printVoltage(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aVoltage) {
-    if (aVoltage < aDescription->lastValue - 1 || aDescription->lastValue + 1 < aVoltage) {
-        Serial.print(aDescription->Description);
-        Serial.print((float) aVoltage / 1000, 3);
-        Serial.println(" Volt");
-        if (aDescription->DescriptionLCD != NULL) {
-            myLCD.setCursor(0, 0);
-            myLCD.print((float) aVoltage / 1000, 3);
-            myLCD.print(" Volt");
-        }
+void printVoltage(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aVoltage) {
+    char tBuffer[FIXED_POINT_BUFFER_SIZE];
+    formatMillivolt(tBuffer, aVoltage);
+    printDescription(aDescription);
+    Serial.print(tBuffer);
+    Serial.println(" Volt");
+    if (isLCDOutput(aDescription)) {
+        myShadowLCD.setCursor(0, 0);
+        myShadowLCD.print(tBuffer);
+        myShadowLCD.print(" Volt");
+        myShadowLCD.clearToColumn(LCD_CURRENT_COLUMN);
     }
 }
 
-/*
- * Print only if changed by two ore more mA
- */
-void printCurrent(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCurrent) {
-    if (aCurrent < aDescription->lastValue - 1 || aDescription->lastValue + 1 < aCurrent) {
-        Serial.print(aDescription->Description);
-        Serial.print((int) aCurrent);
-        Serial.println(" mA");
-        if (aDescription->DescriptionLCD != NULL) {
-            // clear old value
-            myLCD.setCursor(12, 0);
-            myLCD.print("        ");
-            myLCD.setCursor(12, 0);
-            myLCD.print((int) aCurrent);
-            myLCD.print(" mA");
-        }
+void printCurrent(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aCurrent) {
+    printDescription(aDescription);
+    Serial.print((int16_t) aCurrent);
+    Serial.println(" mA");
+    if (isLCDOutput(aDescription)) {
+        myShadowLCD.setCursor(LCD_CURRENT_COLUMN, 0);
+        myShadowLCD.print((int16_t) aCurrent);
+        myShadowLCD.print(" mA");
+        myShadowLCD.clearToColumn(LCD_COLUMNS);
     }
 }
 
-/*
- * Print only if changed by more than 0.1 C
- */
-void printTemperature(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aTemperature) {
-    if (aTemperature < aDescription->lastValue - 100 || aDescription->lastValue + 100 < aTemperature) {
-        Serial.print(aDescription->Description);
-        Serial.print((float) (aTemperature / 10.0) - 273.15);
-        Serial.println(" C");
-    }
+void printTemperature(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aTemperature) {
+    char tBuffer[FIXED_POINT_BUFFER_SIZE];
+    formatDeciKelvinAsCelsius(tBuffer, aTemperature);
+    printDescription(aDescription);
+    Serial.print(tBuffer);
+    Serial.println(" C");
 }
 
 /*
  * Format as ISO date
  */
-void printManufacturerDate(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aDate) {
-    Serial.print(aDescription->Description);
+void printManufacturerDate(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aDate) {
+    printDescription(aDescription);
 
     int tDay = aDate & 0x1F;
     int tMonth = (aDate >> 5) & 0x0F;
@@ -524,8 +3233,8 @@ void printManufacturerDate(struct SBMFunctionDescriptionStruct * aDescription, u
     Serial.println(tDateAsString);
 }
 
-void printBatteryMode(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMode) {
-    Serial.print(aDescription->Description);
+void printBatteryMode(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aMode) {
+    printDescription(aDescription);
 
     Serial.println(aMode, BIN);
     if (aMode & INTERNAL_CHARGE_CONTROLLER) {
@@ -551,12 +3260,12 @@ void printBatteryMode(struct SBMFunctionDescriptionStruct * aDescription, uint16
     }
 
     if (aMode & CAPACITY_MODE) {
-        sCapacityModePower = true;
+        sCurrentPack->CapacityModePower = true;
         Serial.println(F("- Using power (10mWh) instead of current (mAh)"));
     }
 }
-void printBatteryStatus(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aStatus) {
-    Serial.print(aDescription->Description);
+void printBatteryStatus(const struct SBMFunctionDescriptionStruct * aDescription, uint16_t aStatus) {
+    printDescription(aDescription);
     Serial.println(aStatus, BIN);
     /*
      * Error Bits
@@ -598,15 +3307,27 @@ void printBatteryStatus(struct SBMFunctionDescriptionStruct * aDescription, uint
 
 }
 
-void printFunctionDescriptionArray(struct SBMFunctionDescriptionStruct * aSBMFunctionDescription, uint8_t aLengthOfArray,
-bool aOnlyPrintIfValueChanged) {
+/*
+ * @param aRegisterStates - if NULL, the values are printed without storing them
+ */
+void printFunctionDescriptionArray(const struct SBMFunctionDescriptionStruct * aSBMFunctionDescription,
+        struct SBMRegisterStateStruct * aRegisterStates, uint8_t aLengthOfArray, bool aOnlyPrintIfValueChanged) {
     for (uint8_t i = 0; i < aLengthOfArray; ++i) {
-        readWordAndPrint(aSBMFunctionDescription, aOnlyPrintIfValueChanged);
+        if (isRegisterSupported(sCurrentPack, aSBMFunctionDescription)) {
+            readWordAndPrint(aSBMFunctionDescription, aRegisterStates, aOnlyPrintIfValueChanged);
+        }
         aSBMFunctionDescription++;
+        if (aRegisterStates != NULL) {
+            aRegisterStates++;
+        }
     }
 }
 
-void printSMBStaticInfo(void) {
+/*
+ * @param aValues - the values of the static registers, read here if aValuesAreCached is false
+ * @return SpecificationInfo for the check of PEC support
+ */
+uint16_t printSMBStaticInfo(uint16_t * aValues, bool aValuesAreCached) {
     uint8_t tReceivedLength = 0;
 
     Serial.print(F("Chemistry: "));
@@ -634,21 +3355,109 @@ void printSMBStaticInfo(void) {
     Serial.write(sI2CDataBuffer, tReceivedLength);
     Serial.println("");
 
-    printFunctionDescriptionArray(sSBMStaticFunctionDescriptionArray,
-            (sizeof(sSBMStaticFunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)), false);
-    sDesignVoltage = sSBMStaticFunctionDescriptionArray[INDEX_OF_DESIGN_VOLTAGE].lastValue;
+    for (uint8_t i = 0; i < NUMBER_OF_STATIC_REGISTERS; ++i) {
+        const struct SBMFunctionDescriptionStruct * tDescription = &sSBMStaticFunctionDescriptionArray[i];
+        if (isRegisterSupported(sCurrentPack, tDescription)) {
+            if (!aValuesAreCached) {
+                aValues[i] = readWord(getFunctionCode(tDescription));
+                if (!sCurrentPack->Device.LastReadIsValid) {
+                    // repeat once like readWordAndPrint(), a value which could not be read is not printed
+                    aValues[i] = readWord(getFunctionCode(tDescription));
+                    if (!sCurrentPack->Device.LastReadIsValid) {
+                        continue;
+                    }
+                }
+            }
+            printValue(tDescription, NULL, aValues[i]);
+        } else {
+            aValues[i] = 0;
+        }
+    }
+    sCurrentPack->DesignVoltage = aValues[INDEX_OF_DESIGN_VOLTAGE];
+    return aValues[INDEX_OF_SPEC_INFO];
+}
+
+/*
+ * Prints the first aLength bytes of sI2CDataBuffer with the decoder of the block
+ */
+void printBlock(const struct SBMControllerBlockStruct * aBlock, uint8_t aLength) {
+    if (aLength > pgm_read_byte(&aBlock->Length)) {
+        aLength = pgm_read_byte(&aBlock->Length);
+    }
+    Serial.print((const __FlashStringHelper *) pgm_read_ptr(&aBlock->Description));
+    uint8_t tFormat = pgm_read_byte(&aBlock->Format);
+    if (tFormat == BLOCK_FORMAT_FLAGS) {
+        uint32_t tFlags = 0;
+        for (uint8_t j = aLength; j > 0; --j) {
+            tFlags = (tFlags << 8) | sI2CDataBuffer[j - 1];
+        }
+        Serial.print("0b");
+        Serial.print(tFlags, BIN);
+    } else if (tFormat == BLOCK_FORMAT_WORDS) {
+        for (uint8_t j = 0; j + 1 < aLength; j += 2) {
+            Serial.print(sI2CDataBuffer[j] | (sI2CDataBuffer[j + 1] << 8));
+            Serial.print(" ");
+        }
+    } else {
+        for (uint8_t j = 0; j < aLength; ++j) {
+            Serial.print(sI2CDataBuffer[j], HEX);
+            Serial.print(" ");
+        }
+    }
+    Serial.println();
+}
+
+/*
+ * Reads the blocks of aBlockMask and prints them with their decoder
+ */
+void printControllerBlocks(uint8_t aBlockMask) {
+    for (uint8_t i = 0; i < NUMBER_OF_CONTROLLER_BLOCKS; ++i) {
+        if (!(aBlockMask & (1 << i))) {
+            continue;
+        }
+        const struct SBMControllerBlockStruct * tBlock = &sControllerBlockTable[i];
+        uint8_t tLength = readBlock(pgm_read_byte(&tBlock->FunctionCode), sI2CDataBuffer, DATA_BUFFER_LENGTH);
+        if (sCurrentPack->Device.LastReadIsValid) {
+            printBlock(tBlock, tLength);
+        }
+    }
+}
 
+/*
+ * The records of SBM_MANUFACTURER_BLOCKS have no word representation, so they are only read with ManufacturerBlockAccess
+ */
+void printManufacturerBlocks() {
+    for (uint8_t i = 0; i < NUMBER_OF_MANUFACTURER_BLOCKS && sCurrentPack->ManufacturerBlockAccess; ++i) {
+        const struct SBMControllerBlockStruct * tBlock = &sManufacturerBlockTable[i];
+        uint8_t tLength = readManufacturerRecord(pgm_read_byte(&tBlock->FunctionCode));
+        if (sCurrentPack->ManufacturerBlockAccess) {
+            printBlock(tBlock, tLength);
+        }
+    }
 }
 
+/*
+ * The controller specific part is selected by the driver found by identifyController()
+ */
 void printSMBManufacturerInfo(void) {
 
-    uint16_t tType = readWordFromManufacturerAccess(TI_Device_Type);
+    // the device type was already read by identifyController()
+    uint16_t tType = (sCurrentPack->ControllerIndex != CONTROLLER_UNKNOWN) ?
+            pgm_read_word(&sControllerDriverTable[sCurrentPack->ControllerIndex].DeviceType) : readManufacturerWord(TI_Device_Type);
     Serial.print(F("Device Type: "));
     Serial.print(tType);
     Serial.print(F(" / 0x"));
     Serial.println(tType, HEX);
 
-    uint16_t tVersion = readWordFromManufacturerAccess(TI_Firmware_Version);
+    uint16_t tVersion;
+    uint16_t tBuild = 0;
+    if (readManufacturerRecord(TI_Firmware_Version) >= 6) {
+        // record of ManufacturerBlockAccess, device number, version and build, each big endian
+        tVersion = (sI2CDataBuffer[2] << 8) | sI2CDataBuffer[3];
+        tBuild = (sI2CDataBuffer[4] << 8) | sI2CDataBuffer[5];
+    } else {
+        tVersion = sI2CDataBuffer[0] | (sI2CDataBuffer[1] << 8);
+    }
     // check if read valid data
     if (tType != tVersion) {
 
@@ -656,122 +3465,416 @@ void printSMBManufacturerInfo(void) {
         Serial.print((uint8_t) (tVersion >> 8), HEX);
         Serial.print(".");
         Serial.println((uint8_t) tVersion, HEX);
+        if (tBuild != 0) {
+            Serial.print(F("Firmware Build: "));
+            Serial.println(tBuild, HEX);
+        }
 
-        if (tType == 2083) {
+        uint8_t tFeatures = CONTROLLER_UNKNOWN_FEATURES;
+        uint8_t tBlockMask = 0;
+        if (sCurrentPack->ControllerIndex != CONTROLLER_UNKNOWN) {
+            const struct SBMControllerDriverStruct * tDriver = &sControllerDriverTable[sCurrentPack->ControllerIndex];
+            tFeatures = pgm_read_byte(&tDriver->Features);
+            tBlockMask = pgm_read_byte(&tDriver->BlockMask);
             Serial.print(F("Controller IC identified by device type: "));
-            Serial.println(F("bq2085"));
-            Serial.print(F("End of Discharge Voltage Level: "));
-            uint16_t tLevel = readWordFromManufacturerAccess(BQ2084_EDV_level);
-            Serial.print(((float) tLevel) / 1000, 3);
-            Serial.println(" V");
-            Serial.println();
+            Serial.println((const __FlashStringHelper *) pgm_read_ptr(&tDriver->Name));
+        }
 
-        } else if (tType == 2084) {
-            Serial.print(F("Controller IC identified by device type: "));
-            Serial.println(F("bq2084"));
+        if (tFeatures & CONTROLLER_EDV_LEVEL) {
             Serial.print(F("End of Discharge Voltage Level: "));
-            uint16_t tLevel = readWordFromManufacturerAccess(BQ2084_EDV_level);
-            Serial.print(((float) tLevel) / 1000, 3);
+            char tBuffer[FIXED_POINT_BUFFER_SIZE];
+            formatMillivolt(tBuffer, readWordFromManufacturerAccess(BQ2084_EDV_level));
+            Serial.print(tBuffer);
             Serial.println(" V");
-            Serial.println();
-
-        } else {
-            if (tType == 0x700) {
-                Serial.print(F("Controller IC identified by device type: "));
-                Serial.println(F("bq20z70, bq20z75, bq29330"));
-                printFunctionDescriptionArray(sSBMbq20z70FunctionDescriptionArray,
-                        (sizeof(sSBMbq20z70FunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)), false);
-            } else if (tType == 0x451) {
-                Serial.print(F("Controller IC identified by device type: "));
-                Serial.println(F("bq20z45-R1"));
-                printFunctionDescriptionArray(sSBMbq20z70FunctionDescriptionArray,
-                        (sizeof(sSBMbq20z70FunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)), false);
-            }
-
+        }
+        if (tFeatures & CONTROLLER_HARDWARE_VERSION) {
             Serial.print(F("Hardware Version: 0x"));
-            Serial.println(readWordFromManufacturerAccess(BQ20Z70_Hardware_Version), HEX);
-
-            Serial.println();
-        }
-
-        /*
-         * Status
-         */
-        Serial.print(F("Manufacturer Status (BIN): 0b"));
-        uint8_t tStatus = readWordFromManufacturerAccess(BQ20Z70_Manufacturer_Status) >> 8;
-        Serial.println(tStatus, BIN);
-        Serial.print(F("- FET Status "));
-        Serial.println(tStatus >> 6);
-        Serial.print(F("- State: 0b"));
-        tStatus = tStatus & 0x0F;
-        Serial.println(tStatus, BIN);
-        if (tStatus == 0x01) {
-            Serial.println(F(" - Normal Discharge"));
-        } else if (tStatus == 0x05) {
-            Serial.println(F(" - Charge"));
-        } else if (tStatus == 0x07) {
-            Serial.println(F(" - Charge Termination"));
-        } else if (tStatus == 0x0C) {
-            Serial.println(F(" - Battery Failure"));
-        } else if (tStatus == 0x09) {
-            Serial.println(F(" - Permanent Failure"));
-            uint8_t tPFStatus = readWordFromManufacturerAccess(BQ20Z70_PFStatus) >> 8;
-            Serial.print(F(" - PFStatus: 0b"));
-            Serial.println(tPFStatus, BIN);
-        } else if (tStatus == 0x0F) {
-            Serial.println(F(" - Battery Pack removed"));
+            Serial.println(readManufacturerWord(BQ20Z70_Hardware_Version), HEX);
+        }
+        // the values are stored as start values for polling
+        printFunctionDescriptionArray(sSBMControllerFunctionDescriptionArray,
+                &sCurrentPack->OptionalRegisterStates[NUMBER_OF_NON_STANDARD_REGISTERS], NUMBER_OF_CONTROLLER_REGISTERS, false);
+        printControllerBlocks(tBlockMask);
+        printManufacturerBlocks();
+        Serial.println();
+
+        if (tFeatures & CONTROLLER_MANUFACTURER_STATUS) {
+            /*
+             * Status
+             */
+            Serial.print(F("Manufacturer Status (BIN): 0b"));
+            uint8_t tStatus = readWordFromManufacturerAccess(BQ20Z70_Manufacturer_Status) >> 8;
+            Serial.println(tStatus, BIN);
+            Serial.print(F("- FET Status "));
+            Serial.println(tStatus >> 6);
+            Serial.print(F("- State: 0b"));
+            tStatus = tStatus & 0x0F;
+            Serial.println(tStatus, BIN);
+            if (tStatus == 0x01) {
+                Serial.println(F(" - Normal Discharge"));
+            } else if (tStatus == 0x05) {
+                Serial.println(F(" - Charge"));
+            } else if (tStatus == 0x07) {
+                Serial.println(F(" - Charge Termination"));
+            } else if (tStatus == 0x0C) {
+                Serial.println(F(" - Battery Failure"));
+            } else if (tStatus == 0x09) {
+                Serial.println(F(" - Permanent Failure"));
+                uint8_t tPFStatus = readWordFromManufacturerAccess(BQ20Z70_PFStatus) >> 8;
+                Serial.print(F(" - PFStatus: 0b"));
+                Serial.println(tPFStatus, BIN);
+            } else if (tStatus == 0x0F) {
+                Serial.println(F(" - Battery Pack removed"));
+            }
         }
     }
 }
 
 void printSMBNonStandardInfo(bool aOnlyPrintIfValueChanged) {
-    if (nonStandardInfoSupportedByPack > 1) {
-        return;
-    }
-    if (nonStandardInfoSupportedByPack == 0) {
-        // very simple check if non standard info supported by pack
-        uint16_t tActualValue = readWord(sSBMNonStandardFunctionDescriptionArray[0].FunctionCode);
-        uint16_t tActualValue1 = readWord(sSBMNonStandardFunctionDescriptionArray[1].FunctionCode);
-        if (tActualValue == tActualValue1) {
-            nonStandardInfoSupportedByPack = 2;
-            return;
-        }
-    }
+    printFunctionDescriptionArray(sSBMNonStandardFunctionDescriptionArray, sCurrentPack->OptionalRegisterStates,
+    NUMBER_OF_NON_STANDARD_REGISTERS, aOnlyPrintIfValueChanged);
+}
+
+/*
+ * The pack calculates the AtRate results after AtRate is written, the bq2085-V1P3 needs more than 5 ms.
+ * Until then it may NAK or still answer with the result for the former rate.
+ * Therefore the result which is valid for the sign of the rate is read until it differs from the value
+ * read before AtRate was written. If the result does not change, e.g. for a rate of 0, this ends by the timeout.
+ */
+#define AT_RATE_READY_TIMEOUT_MILLIS 20
 
-    printFunctionDescriptionArray(sSBMNonStandardFunctionDescriptionArray,
-            (sizeof(sSBMNonStandardFunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)), aOnlyPrintIfValueChanged);
+uint8_t getAtRateReadyFunctionCode(int16_t aRate) {
+    return (aRate > 0) ? AtRateTimeToFull : AtRateTimeToEmpty;
+}
+
+/*
+ * @param aFormerValue - the value of the register of getAtRateReadyFunctionCode() before AtRate was written
+ * @return the value of the register of getAtRateReadyFunctionCode()
+ */
+uint16_t waitForAtRateResult(int16_t aRate, uint16_t aFormerValue, uint32_t aWriteMillis) {
+    uint16_t tValue;
+    do {
+        tValue = readWord(getAtRateReadyFunctionCode(aRate));
+        if (sCurrentPack->Device.LastReadIsValid && tValue != aFormerValue) {
+            break;
+        }
+    } while (millis() - aWriteMillis < AT_RATE_READY_TIMEOUT_MILLIS);
+    return tValue;
 }
 
 void printSMBATRateInfo(void) {
+    uint16_t tFormerValue = readWord(getAtRateReadyFunctionCode(100));
     writeWord(AtRate, 100);
+    uint32_t tWriteMillis = millis();
     Serial.print(F("Setting AT rate to 100"));
     Serial.print(getCapacityModeUnit());
-    long tmA;
-    if (sCapacityModePower) {
+    uint16_t tmA;
+    if (sCurrentPack->CapacityModePower) {
         // print also mA since changing capacity mode did not work
         Serial.print(" | ");
-        tmA = (100 * 10000L) / sDesignVoltage;
+        tmA = convertCentiWattToMilliampere(100, sCurrentPack->DesignVoltage);
         Serial.print(tmA);
         Serial.print(StringCapacityModeCurrent);
     }
     Serial.println();
-    delay(20); // > 5 ms for bq2085-V1P3
-    readWordAndPrint(&sSBMATRateFunctionDescriptionArray[0], false);
+    waitForAtRateResult(100, tFormerValue, tWriteMillis);
+    readWordAndPrint(&sSBMATRateFunctionDescriptionArray[0], NULL, false);
 
+    tFormerValue = readWord(getAtRateReadyFunctionCode(-100));
     writeWord(AtRate, -100);
+    tWriteMillis = millis();
     Serial.print(F("Setting AT rate to -100"));
     Serial.print(getCapacityModeUnit());
-    if (sCapacityModePower) {
+    if (sCurrentPack->CapacityModePower) {
         // print also mA since changing capacity mode did not work
         Serial.print(" | ");
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-        Serial.print(-tmA);
+        Serial.print(-(int16_t) tmA);
         Serial.print(StringCapacityModeCurrent);
     }
     Serial.println();
 
-    delay(20); // > 5 ms for bq2085-V1P3
-    for (uint8_t i = 1; i < (sizeof(sSBMATRateFunctionDescriptionArray) / sizeof(SBMFunctionDescriptionStruct)); ++i) {
-        readWordAndPrint(&sSBMATRateFunctionDescriptionArray[i], false);
+    waitForAtRateResult(-100, tFormerValue, tWriteMillis);
+    for (uint8_t i = 1; i < NUMBER_OF_AT_RATE_REGISTERS; ++i) {
+        readWordAndPrint(&sSBMATRateFunctionDescriptionArray[i], NULL, false);
+    }
+}
+
+#if defined(SHOW_AT_RATE_SWEEP)
+/*
+ * Sweep of AtRate over AT_RATE_SWEEP_STEPS rates, starting with AT_RATE_SWEEP_FIRST, printed as CSV.
+ * The steps are pipelined. The next rate is written as soon as the results of a step are read,
+ * so the pack calculates while the line of the former step is printed.
+ * The last column is the time from writing AtRate until its result was read.
+ */
+#if !defined(AT_RATE_SWEEP_FIRST)
+#define AT_RATE_SWEEP_FIRST     -2500 // mA or 10 mW
+#endif
+#if !defined(AT_RATE_SWEEP_INCREMENT)
+#define AT_RATE_SWEEP_INCREMENT 100
+#endif
+#if !defined(AT_RATE_SWEEP_STEPS)
+#define AT_RATE_SWEEP_STEPS     50
+#endif
+
+void printAtRateSweepTime(uint16_t aMinutes) {
+    Serial.print(',');
+    if (aMinutes != 0xFFFF) {
+        Serial.print(aMinutes);
+    }
+}
+
+void printAtRateSweep(void) {
+    if (sCurrentPack->CapacityModePower) {
+        Serial.println(F("AtRate 10mW,TimeToFull min,TimeToEmpty min,OK,Ready ms"));
+    } else {
+        Serial.println(F("AtRate mA,TimeToFull min,TimeToEmpty min,OK,Ready ms"));
+    }
+    uint32_t tStartMillis = millis();
+    uint16_t tTimeToFull = readWord(AtRateTimeToFull);
+    uint16_t tTimeToEmpty = readWord(AtRateTimeToEmpty);
+    int16_t tRate = AT_RATE_SWEEP_FIRST;
+    writeWord(AtRate, tRate);
+    uint32_t tWriteMillis = millis();
+
+    for (uint8_t i = 0; i < AT_RATE_SWEEP_STEPS; ++i) {
+        // the other time is 0xFFFF for the sign of the rate by specification, so it need not to be read
+        if (tRate > 0) {
+            tTimeToFull = waitForAtRateResult(tRate, tTimeToFull, tWriteMillis);
+            tTimeToEmpty = 0xFFFF;
+        } else {
+            tTimeToEmpty = waitForAtRateResult(tRate, tTimeToEmpty, tWriteMillis);
+            tTimeToFull = 0xFFFF;
+        }
+        uint16_t tReadyMillis = millis() - tWriteMillis;
+        uint16_t tOK = readWord(AtRateOK);
+
+        int16_t tPrintedRate = tRate;
+        if (i < AT_RATE_SWEEP_STEPS - 1) {
+            tRate += AT_RATE_SWEEP_INCREMENT;
+            writeWord(AtRate, tRate);
+            tWriteMillis = millis();
+        }
+        Serial.print(tPrintedRate);
+        printAtRateSweepTime(tTimeToFull);
+        printAtRateSweepTime(tTimeToEmpty);
+        Serial.print(',');
+        Serial.print(tOK);
+        Serial.print(',');
+        Serial.println(tReadyMillis);
+    }
+    Serial.print(AT_RATE_SWEEP_STEPS);
+    Serial.print(F(" steps in "));
+    Serial.print(millis() - tStartMillis);
+    Serial.println(F(" ms"));
+}
+#endif
+
+#if defined(USE_DATA_FLASH_DUMP)
+/*
+ * Data flash dump of the first pack, for controllers with CONTROLLER_DATA_FLASH. The pack must be unsealed.
+ * All subclass IDs up to DATA_FLASH_LAST_SUBCLASS_ID are walked. The subclass ID is written once and then its pages
+ * are read back to back, until a page is not acknowledged or shorter than 32 bytes.
+ * Each page is sent as a record of the binary image described in DataFlashImage.h.
+ * The RAM of an ATmega328 can not hold the data flash, so only the CRC-16 signature of each page is kept as reference
+ * in the EEPROM between the register capability cache and the curve log.
+ * DATA_FLASH_DUMP_COMMAND sends all pages and stores the reference, DATA_FLASH_CHANGES_COMMAND sends only the pages whose
+ * signature differs from the reference or which are not contained in it.
+ */
+#if !defined(DATA_FLASH_LAST_SUBCLASS_ID)
+#define DATA_FLASH_LAST_SUBCLASS_ID 127
+#endif
+#define DATA_FLASH_NUMBER_OF_PAGE_COMMANDS  (BQ20Z70_DataFlashSubClassPage8 - BQ20Z70_DataFlashSubClassPage1 + 1)
+#if !defined(DATA_FLASH_REFERENCE_EEPROM_START)
+#define DATA_FLASH_REFERENCE_EEPROM_START 112
+#endif
+#if defined(CURVE_LOG_EEPROM_START)
+#define DATA_FLASH_REFERENCE_EEPROM_END CURVE_LOG_EEPROM_START
+#else
+#define DATA_FLASH_REFERENCE_EEPROM_END (E2END + 1)
+#endif
+#if defined(CACHE_REGISTER_CAPABILITIES)
+static_assert(CAPABILITY_CACHE_END <= DATA_FLASH_REFERENCE_EEPROM_START, "Data flash reference overlaps the register capability cache");
+#endif
+
+struct DataFlashReferenceHeaderStruct {
+    struct SBMPackIdentityStruct Identity;
+    uint8_t NumberOfPages;
+    uint8_t CRC; // of the header and all entries
+};
+struct DataFlashReferenceEntryStruct {
+    uint8_t SubclassID;
+    uint8_t Page;
+    uint16_t Signature;
+};
+#define DATA_FLASH_REFERENCE_MAX_PAGES ((DATA_FLASH_REFERENCE_EEPROM_END - DATA_FLASH_REFERENCE_EEPROM_START \
+        - sizeof(struct DataFlashReferenceHeaderStruct)) / sizeof(struct DataFlashReferenceEntryStruct))
+#define DATA_FLASH_REFERENCE_MAX_PAGES_LIMITED (DATA_FLASH_REFERENCE_MAX_PAGES > 255 ? 255 : DATA_FLASH_REFERENCE_MAX_PAGES)
+static_assert(DATA_FLASH_REFERENCE_MAX_PAGES >= 8, "No space for the data flash reference");
+
+uint16_t getDataFlashReferenceEntryAddress(uint8_t aIndex) {
+    return DATA_FLASH_REFERENCE_EEPROM_START + sizeof(struct DataFlashReferenceHeaderStruct)
+            + aIndex * sizeof(struct DataFlashReferenceEntryStruct);
+}
+
+void readDataFlashReferenceEntry(uint8_t aIndex, struct DataFlashReferenceEntryStruct * aEntry) {
+    uint16_t tAddress = getDataFlashReferenceEntryAddress(aIndex);
+    for (uint8_t i = 0; i < sizeof(struct DataFlashReferenceEntryStruct); ++i) {
+        ((uint8_t *) aEntry)[i] = EEPROM.read(tAddress + i);
+    }
+}
+
+uint8_t getDataFlashReferenceCRC(struct DataFlashReferenceHeaderStruct * aHeader) {
+    uint8_t tCRC = crc8Update(0, (uint8_t *) aHeader, offsetof(struct DataFlashReferenceHeaderStruct, CRC));
+    uint16_t tAddress = getDataFlashReferenceEntryAddress(0);
+    for (uint16_t i = 0; i < aHeader->NumberOfPages * sizeof(struct DataFlashReferenceEntryStruct); ++i) {
+        tCRC = crc8Update(tCRC, EEPROM.read(tAddress + i));
+    }
+    return tCRC;
+}
+
+/*
+ * @return true if the reference is valid and was stored for the identity of the pack
+ */
+bool readDataFlashReferenceHeader(struct SBMPackStruct * aPack, struct DataFlashReferenceHeaderStruct * aHeader) {
+    for (uint8_t i = 0; i < sizeof(struct DataFlashReferenceHeaderStruct); ++i) {
+        ((uint8_t *) aHeader)[i] = EEPROM.read(DATA_FLASH_REFERENCE_EEPROM_START + i);
+    }
+    return aHeader->NumberOfPages <= DATA_FLASH_REFERENCE_MAX_PAGES_LIMITED
+            && memcmp(&aHeader->Identity, &aPack->Identity, sizeof(struct SBMPackIdentityStruct)) == 0
+            && aHeader->CRC == getDataFlashReferenceCRC(aHeader);
+}
+
+/*
+ * The header is written last, so an interrupted dump leaves an invalid reference
+ */
+void writeDataFlashReferenceHeader(struct SBMPackStruct * aPack, uint8_t aNumberOfPages) {
+    struct DataFlashReferenceHeaderStruct tHeader;
+    memset(&tHeader, 0, sizeof(tHeader));
+    tHeader.Identity = aPack->Identity;
+    tHeader.NumberOfPages = aNumberOfPages;
+    tHeader.CRC = getDataFlashReferenceCRC(&tHeader);
+    for (uint8_t i = 0; i < sizeof(struct DataFlashReferenceHeaderStruct); ++i) {
+        EEPROM.update(DATA_FLASH_REFERENCE_EEPROM_START + i, ((uint8_t *) &tHeader)[i]);
+    }
+}
+
+/*
+ * Sends the image and prints the number of pages, the bytes on the bus and on Serial and the duration.
+ * Blocks loop() until all is sent.
+ */
+void dumpDataFlash(bool aOnlyChangedPages) {
+    struct SBMPackStruct * tPack = &sPacks[0];
+    if (tPack->IsRemoved || tPack->ControllerIndex == CONTROLLER_UNKNOWN
+            || !(pgm_read_byte(&sControllerDriverTable[tPack->ControllerIndex].Features) & CONTROLLER_DATA_FLASH)) {
+        Serial.println(F("Data flash of controller can not be read"));
+        return;
+    }
+    struct DataFlashReferenceHeaderStruct tHeader;
+    if (aOnlyChangedPages && !readDataFlashReferenceHeader(tPack, &tHeader)) {
+        Serial.print(F("No data flash reference for this pack, send '"));
+        Serial.print(DATA_FLASH_DUMP_COMMAND);
+        Serial.println(F("' first"));
+        return;
+    }
+    selectMuxChannelOfPack(tPack);
+    uint32_t tStartMillis = millis();
+    uint8_t tPECLength = tPack->Device.PECEnabled ? 1 : 0;
+    uint16_t tNumberOfPages = 0;
+    uint16_t tNumberOfSentPages = 0;
+    uint8_t tNumberOfSkippedSubclasses = 0;
+    uint8_t tReferenceIndex = 0; // the reference is sorted like the walk, so it is compared in one pass
+    struct DataFlashReferenceEntryStruct tReferenceEntry;
+    uint32_t tBusBytes = 0;
+    uint32_t tSerialBytes = 0;
+    uint8_t tRecord[DATA_FLASH_MAX_RECORD_LENGTH];
+
+    Serial.println(F("\r\n" DATA_FLASH_START_LINE));
+    for (uint8_t tSubclassID = 0; tSubclassID <= DATA_FLASH_LAST_SUBCLASS_ID; ++tSubclassID) {
+        bool tSubclassIsSelected = false;
+        for (uint8_t i = 0; i < SMBUS_MAX_TRIES && !tSubclassIsSelected; ++i) {
+            tSubclassIsSelected = tPack->Device.writeWord(BQ20Z70_DataFlashSubClassID, tSubclassID);
+            tBusBytes += 4 + tPECLength; // address, command and word
+        }
+        if (!tSubclassIsSelected) {
+            // the pages would still be the ones of the previous subclass
+            tNumberOfSkippedSubclasses++;
+            continue;
+        }
+        for (uint8_t tPage = 1; tPage <= DATA_FLASH_NUMBER_OF_PAGE_COMMANDS; ++tPage) {
+            // a page longer than the record is clipped and then treated as a full page
+            uint8_t tLength = tPack->Device.readBlock(BQ20Z70_DataFlashSubClassPage1 + tPage - 1, sI2CDataBuffer,
+            DATA_FLASH_PAGE_SIZE);
+            if (!tPack->Device.LastReadIsValid || tLength == 0) {
+                tBusBytes += 2; // address and not acknowledged command
+                break;
+            }
+            tBusBytes += 4 + tLength + tPECLength; // address, command, address, length and data
+            tNumberOfPages++;
+            uint16_t tSignature = getDataFlashPageSignature(sI2CDataBuffer, tLength);
+            bool tSend = true;
+            if (aOnlyChangedPages) {
+                // skip the reference entries of pages which no longer exist
+                uint16_t tKey = (tSubclassID << 8) | tPage;
+                while (tReferenceIndex < tHeader.NumberOfPages) {
+                    readDataFlashReferenceEntry(tReferenceIndex, &tReferenceEntry);
+                    if (((tReferenceEntry.SubclassID << 8) | tReferenceEntry.Page) >= tKey) {
+                        break;
+                    }
+                    tReferenceIndex++;
+                }
+                if (tReferenceIndex < tHeader.NumberOfPages && tReferenceEntry.SubclassID == tSubclassID
+                        && tReferenceEntry.Page == tPage) {
+                    tSend = (tReferenceEntry.Signature != tSignature);
+                    tReferenceIndex++;
+                }
+            } else if (tNumberOfPages <= DATA_FLASH_REFERENCE_MAX_PAGES_LIMITED) {
+                tReferenceEntry.SubclassID = tSubclassID;
+                tReferenceEntry.Page = tPage;
+                tReferenceEntry.Signature = tSignature;
+                uint16_t tAddress = getDataFlashReferenceEntryAddress(tNumberOfPages - 1);
+                for (uint8_t i = 0; i < sizeof(struct DataFlashReferenceEntryStruct); ++i) {
+                    EEPROM.update(tAddress + i, ((uint8_t *) &tReferenceEntry)[i]);
+                }
+            }
+            if (tSend) {
+                uint8_t tRecordLength = encodeDataFlashRecord(tRecord, tSubclassID, tPage, sI2CDataBuffer, tLength);
+                Serial.write(tRecord, tRecordLength);
+                tSerialBytes += tRecordLength;
+                tNumberOfSentPages++;
+            }
+            if (tLength < DATA_FLASH_PAGE_SIZE) {
+                break; // last page of subclass
+            }
+        }
+    }
+    tSerialBytes += Serial.write(tRecord, encodeDataFlashEndRecord(tRecord));
+    Serial.println();
+    uint8_t tNumberOfReferencePages = 0;
+    if (!aOnlyChangedPages) {
+        tNumberOfReferencePages =
+                (tNumberOfPages < DATA_FLASH_REFERENCE_MAX_PAGES_LIMITED) ? tNumberOfPages : DATA_FLASH_REFERENCE_MAX_PAGES_LIMITED;
+        writeDataFlashReferenceHeader(tPack, tNumberOfReferencePages);
+    }
+
+    Serial.print(tNumberOfSentPages);
+    Serial.print(F(" of "));
+    Serial.print(tNumberOfPages);
+    Serial.print(F(" pages sent in "));
+    Serial.print(millis() - tStartMillis);
+    Serial.print(F(" ms, "));
+    Serial.print(tBusBytes);
+    Serial.print(F(" bytes on bus, "));
+    Serial.print(tSerialBytes);
+    Serial.println(F(" bytes on Serial"));
+    if (tNumberOfSkippedSubclasses > 0) {
+        Serial.print(tNumberOfSkippedSubclasses);
+        Serial.println(F(" subclasses skipped, because their ID was not acknowledged"));
+    }
+    if (!aOnlyChangedPages) {
+        Serial.print(F("Signatures of "));
+        Serial.print(tNumberOfReferencePages);
+        Serial.println(F(" pages stored as reference"));
     }
 }
+#endif // defined(USE_DATA_FLASH_DUMP)
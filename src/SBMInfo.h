@@ -11,6 +11,12 @@
 // standard I2C address for Smart Battery packs
 #define SBM_DEVICE_ADDRESS 0x0B
 
+// TCA9548A I2C multiplexers for more than one pack, the address is selected by the A0 to A2 pins
+#define MUX_BASE_ADDRESS            0x70
+#define MUX_MAX_NUMBER              8
+#define MUX_NUMBER_OF_CHANNELS      8
+#define MUX_NONE                    0 // pack is attached directly
+
 // Standard and common non-standard Smart Battery commands
 #define MANUFACTURER_ACCESS      0x00 // r/w Manufacturer specific values
 #define REMAINING_CAPACITY_ALARM  0x01 // r/w
@@ -50,6 +56,7 @@
 #define DEV_NAME                0x21   // String
 #define CELL_CHEM               0x22   // String
 #define MANUFACTURER_DATA       0x23   // Data
+#define MANUFACTURER_BLOCK_ACCESS 0x44 // r/w Block - ManufacturerAccess command and its record, bq40z50
 #define RESERVED_2              0x25 - 0x2E
 
 #define PACK_STATUS             0x2F   // r/w Word - OptionalMfgFunction5
@@ -92,12 +99,28 @@ const char StringCapacityModePower[] = "0 mW"; // 10mWh
 #define FULLY_CHARGED 		0x0020
 #define FULLY_DISCHARGED 	0x0010
 
-struct SBMFunctionDescriptionStruct {
-    uint8_t FunctionCode;
-    const char * Description;
-    void (*ValueFormatter)(struct SBMFunctionDescriptionStruct * aDescription, uint16_t aValueToFormat);
-    const char * DescriptionLCD; // if set output value also on LCD
-    uint16_t lastValue;
+/*
+ * Values and scheduler state of one register of one pack
+ */
+struct SBMRegisterStateStruct {
+    uint16_t lastValue; // last printed or queued value, the reference of the report policy
+    uint16_t LastReadValue; // last read value which is no suspected transmit error, sampled by the curve log
+    uint32_t NextPollMillis; // deadline of next regular poll
+    uint8_t ChangeConfirmationCount; // number of reads which already returned the changed value
+    uint16_t ChangedValue; // value of the first read of a change, which is queued if the change is confirmed
+    uint16_t ChangeMillis; // lower 16 bits of millis() of the first read of a change, the confirmation reads are due relative to it
+    uint16_t LastReportSeconds; // lower 16 bits of the seconds of the last queued output, for the report policy
+#if defined(SHOW_SCHEDULER_STATISTICS)
+    uint16_t PollCount;
+    uint16_t MaxJitterMillis; // maximum delay of a poll relative to its deadline
+#endif
+#if defined(USE_REGISTER_STATISTICS)
+    uint16_t SampleCount; // of the current window, 0 -> the other members are invalid
+    uint16_t MinValue;
+    uint16_t MaxValue;
+    int32_t MeanQ8; // mean * 256
+    uint32_t SumOfSquaredDeviations; // * 16
+#endif
 };
 
 /*
@@ -114,7 +137,7 @@ struct SBMFunctionDescriptionStruct {
 #define BQ20Z70_Manufacturer_Status		0x0006
 
 /*
- * BQ20Z70 extended commands - Not used yet
+ * BQ20Z70 extended commands, see SBM_CONTROLLER_REGISTERS and SBM_CONTROLLER_BLOCKS for the used ones
  */
 #define BQ20Z70_AFEData    				0x45 // -11+1 Byte
 #define BQ20Z70_FETControl    			0x46 // -Byte
@@ -139,4 +162,220 @@ struct SBMFunctionDescriptionStruct {
 // ...
 #define BQ20Z70_DataFlashSubClassPage8	0x7f // -32 Byte
 
+/*
+ * BQ40Z50 extended commands, the status registers are little endian blocks
+ */
+#define BQ40Z50_SafetyStatus            0x51 // -4 Byte
+#define BQ40Z50_PFStatus                0x53 // -4 Byte
+#define BQ40Z50_OperationStatus         0x54 // -4 Byte
+#define BQ40Z50_ChargingStatus          0x55 // -3 Byte
+#define BQ40Z50_GaugingStatus           0x56 // -3 Byte
+#define BQ40Z50_DAStatus1               0x71 // -32 Byte, cell and pack voltages
+
+/*
+ * BQ40Z50 ManufacturerAccess commands, which return more than a word with ManufacturerBlockAccess
+ */
+#define BQ40Z50_ManufacturingStatus     0x0057 // -2 Byte
+#define BQ40Z50_LifetimeDataBlock1      0x0060 // -32 Byte, maximum and minimum cell voltages, currents and temperatures
+
+/*
+ * Formats of the register values, selects the formatter in printFormattedValue()
+ */
+#define FORMAT_NUMBER               0 // unsigned decimal
+#define FORMAT_BINARY               1
+#define FORMAT_SIGNED               2
+#define FORMAT_CAPACITY             3
+#define FORMAT_PERCENTAGE           4
+#define FORMAT_TIME                 5
+#define FORMAT_BATTERY_MODE         6
+#define FORMAT_BATTERY_STATUS       7
+#define FORMAT_MANUFACTURER_DATE    8
+#define FORMAT_VOLTAGE              9
+#define FORMAT_CURRENT              10
+#define FORMAT_TEMPERATURE          11
+
+/*
+ * Constant description of a register. The descriptions and the strings are stored in program memory,
+ * so the members must be read with the get...() functions of SBMInfo.cpp.
+ */
+struct SBMFunctionDescriptionStruct {
+    uint8_t FunctionCode;
+    uint8_t Format; // FORMAT_*
+    uint16_t PollPeriodMillis; // period for polling in loop(), 0 -> not polled
+    uint8_t ReportPolicy; // REPORT_*
+    const char * Description;
+    const char * DescriptionLCD; // if set output value also on LCD
+};
+
+/*
+ * Report policies for changed values of polled registers, see isReportableChange() in SBMInfo.cpp.
+ * A change is reported if it exceeds the deadband, which is the larger of Deadband and DeadbandPermille
+ * of the last reported value. Since the deadband is centered at the last reported value and not at the last read value,
+ * it is also a hysteresis, i.e. a value flipping between two neighboring values gives no output.
+ * A change beyond the deadband is reported not earlier than MinIntervalSeconds after the last report,
+ * a step of more than REPORT_STEP_DEADBANDS times the deadband is reported immediately.
+ * A change within the deadband is reported MaxIntervalSeconds after the last report, 0 -> never.
+ * X(Policy, Deadband, DeadbandPermille, MinIntervalSeconds, MaxIntervalSeconds)
+ */
+#define SBM_REPORT_POLICIES(X) \
+    X(REPORT_EVERY_CHANGE, 0, 0, 0, 0) \
+    X(REPORT_CAPACITY, 0, 2, 0, 60) \
+    X(REPORT_VOLTAGE, 1, 0, 0, 0) \
+    X(REPORT_CURRENT, 10, 10, 1, 60) \
+    X(REPORT_TEMPERATURE, 2, 0, 0, 300)
+#define REPORT_STEP_DEADBANDS 4
+#define SBM_REPORT_POLICY_ENUM(aPolicy, ...) aPolicy,
+enum {
+    SBM_REPORT_POLICIES(SBM_REPORT_POLICY_ENUM)
+};
+
+struct SBMReportPolicyStruct {
+    uint16_t Deadband; // in units of the register value
+    uint8_t DeadbandPermille;
+    uint8_t MinIntervalSeconds;
+    uint16_t MaxIntervalSeconds;
+};
+
+/*
+ * Register map, the register table in program memory is generated from it.
+ * X(FunctionCode, Format, Description, DescriptionLCD or "", PollPeriodMillis, ReportPolicy)
+ */
+#define SBM_STATIC_REGISTERS(X) \
+    X(SERIAL_NUM, FORMAT_NUMBER, "Serial Number: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(MFG_DATE, FORMAT_MANUFACTURER_DATE, "Manufacture Date (YYYY-MM-DD):", "", 0, REPORT_EVERY_CHANGE) \
+    X(DESIGN_CAPACITY, FORMAT_CAPACITY, "Design Capacity: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(DESIGN_VOLTAGE, FORMAT_VOLTAGE, "Design Voltage: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(CHARGING_CURRENT, FORMAT_CURRENT, "Charging Current: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(CHARGING_VOLTAGE, FORMAT_VOLTAGE, "Charging Voltage: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(SPEC_INFO, FORMAT_NUMBER, "Specification Info: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(CYCLE_COUNT, FORMAT_NUMBER, "Cycle Count: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(MAX_ERROR, FORMAT_NUMBER, "Max Error of charge calculation (%): ", "", 0, REPORT_EVERY_CHANGE) \
+    X(REMAINING_TIME_ALARM, FORMAT_TIME, "RemainingTimeAlarm: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(REMAINING_CAPACITY_ALARM, FORMAT_CAPACITY, "Remaining Capacity Alarm: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(BATTERY_MODE, FORMAT_BATTERY_MODE, "Battery Mode (BIN): 0b", "", 0, REPORT_EVERY_CHANGE) \
+    X(PACK_STATUS, FORMAT_BINARY, "Pack Status (BIN): ", "", 0, REPORT_EVERY_CHANGE)
+
+#define SBM_DYNAMIC_REGISTERS(X) \
+    X(FULL_CHARGE_CAPACITY, FORMAT_CAPACITY, "Full Charge Capacity: ", "", 60000, REPORT_EVERY_CHANGE) \
+    X(REMAINING_CAPACITY, FORMAT_CAPACITY, "Remaining Capacity: ", "Capacity ", 1000, REPORT_CAPACITY) \
+    X(RELATIVE_SOC, FORMAT_PERCENTAGE, "Relative Charge: ", " rel Charge ", 2000, REPORT_EVERY_CHANGE) \
+    X(ABSOLUTE_SOC, FORMAT_NUMBER, "Absolute Charge(%): ", "% Abs Charge ", 2000, REPORT_EVERY_CHANGE) \
+    X(RUN_TIME_TO_EMPTY, FORMAT_TIME, "Minutes remaining until empty: ", "", 5000, REPORT_EVERY_CHANGE) \
+    X(AVERAGE_TIME_TO_EMPTY, FORMAT_TIME, "Average minutes remaining until empty: ", " min to Empty ", 5000, REPORT_EVERY_CHANGE) \
+    X(TIME_TO_FULL, FORMAT_TIME, "Minutes remaining for full charge: ", " min to Full ", 5000, REPORT_EVERY_CHANGE) \
+    X(BATTERY_STATUS, FORMAT_BATTERY_STATUS, "Battery Status (BIN): 0b", "", 1000, REPORT_EVERY_CHANGE) \
+    X(VOLTAGE, FORMAT_VOLTAGE, "Voltage: ", "Voltage: ", 250, REPORT_VOLTAGE) \
+    X(CURRENT, FORMAT_CURRENT, "Current: ", "Current: ", 250, REPORT_CURRENT) \
+    X(AverageCurrent, FORMAT_CURRENT, "Average Current of last minute: ", "", 1000, REPORT_CURRENT) \
+    X(TEMPERATURE, FORMAT_TEMPERATURE, "Temperature: ", "", 2000, REPORT_TEMPERATURE)
+
+// These aren't part of the standard, but work with some packs.
+#define SBM_NON_STANDARD_REGISTERS(X) \
+    X(CELL1_VOLTAGE, FORMAT_VOLTAGE, "Cell 1 Voltage: ", "", 1000, REPORT_VOLTAGE) \
+    X(CELL2_VOLTAGE, FORMAT_VOLTAGE, "Cell 2 Voltage: ", "", 1000, REPORT_VOLTAGE) \
+    X(CELL3_VOLTAGE, FORMAT_VOLTAGE, "Cell 3 Voltage: ", "", 1000, REPORT_VOLTAGE) \
+    X(CELL4_VOLTAGE, FORMAT_VOLTAGE, "Cell 4 Voltage: ", "", 1000, REPORT_VOLTAGE) \
+    X(STATE_OF_HEALTH, FORMAT_NUMBER, "State of Health: ", "", 60000, REPORT_EVERY_CHANGE)
+
+// Value depends on capacity mode
+#define SBM_AT_RATE_REGISTERS(X) \
+    X(AtRateTimeToFull, FORMAT_TIME, "TimeToFull at rate: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(AtRateTimeToEmpty, FORMAT_TIME, "TimeToEmpty at rate: ", "", 0, REPORT_EVERY_CHANGE) \
+    X(AtRateOK, FORMAT_NUMBER, "Can be delivered for 10 seconds at rate: ", "", 0, REPORT_EVERY_CHANGE)
+
+// Extended registers of the TI controllers, only the registers of the driver of the controller are probed and polled
+#define SBM_CONTROLLER_REGISTERS(X) \
+    X(BQ20Z70_SafetyStatus, FORMAT_BINARY, "Safety Status: ", "", 2000, REPORT_EVERY_CHANGE) \
+    X(BQ20Z70_PFStatus, FORMAT_BINARY, "Permanent Failure Status: ", "", 2000, REPORT_EVERY_CHANGE) \
+    X(BQ20Z70_OperationStatus, FORMAT_BINARY, "Operation Status: ", "", 1000, REPORT_EVERY_CHANGE) \
+    X(BQ20Z70_ChargingStatus, FORMAT_BINARY, "Charging Status: ", "", 1000, REPORT_EVERY_CHANGE) \
+    X(BQ20Z70_PackVoltage, FORMAT_VOLTAGE, "Pack Voltage: ", "", 1000, REPORT_VOLTAGE) \
+    X(BQ20Z70_AverageVoltage, FORMAT_VOLTAGE, "Average Voltage of last minute: ", "", 10000, REPORT_VOLTAGE) \
+    X(BQ20Z70_SenseResistor, FORMAT_NUMBER, "Sense Resistor (uOhm): ", "", 0, REPORT_EVERY_CHANGE)
+
+/*
+ * Block registers of the TI controllers, printed with the manufacturer info by the decoder selected by Format.
+ * X(FunctionCode, Length, Format, Description)
+ */
+#define BLOCK_FORMAT_BYTES  0 // hex bytes
+#define BLOCK_FORMAT_FLAGS  1 // little endian bit field
+#define BLOCK_FORMAT_WORDS  2 // little endian unsigned words
+#define SBM_CONTROLLER_BLOCKS(X) \
+    X(BQ20Z70_AFEData, 11, BLOCK_FORMAT_BYTES, "AFE Data: 0x") \
+    X(BQ20Z70_ManufacturerInfo, 8, BLOCK_FORMAT_BYTES, "Manufacturer Info: 0x") \
+    X(BQ40Z50_SafetyStatus, 4, BLOCK_FORMAT_FLAGS, "Safety Status: ") \
+    X(BQ40Z50_PFStatus, 4, BLOCK_FORMAT_FLAGS, "Permanent Failure Status: ") \
+    X(BQ40Z50_OperationStatus, 4, BLOCK_FORMAT_FLAGS, "Operation Status: ") \
+    X(BQ40Z50_ChargingStatus, 3, BLOCK_FORMAT_FLAGS, "Charging Status: ") \
+    X(BQ40Z50_GaugingStatus, 3, BLOCK_FORMAT_FLAGS, "Gauging Status: ") \
+    X(BQ40Z50_DAStatus1, 32, BLOCK_FORMAT_WORDS, "DA Status 1: ")
+
+/*
+ * Records of ManufacturerAccess commands which have no block register, only read with ManufacturerBlockAccess.
+ * X(Command, Length, Format, Description)
+ */
+#define SBM_MANUFACTURER_BLOCKS(X) \
+    X(BQ40Z50_ManufacturingStatus, 2, BLOCK_FORMAT_FLAGS, "Manufacturing Status: ") \
+    X(BQ40Z50_LifetimeDataBlock1, 32, BLOCK_FORMAT_WORDS, "Lifetime Data 1: ")
+
+struct SBMControllerBlockStruct {
+    uint8_t FunctionCode; // or the lower byte of the ManufacturerAccess command
+    uint8_t Length; // without the length byte
+    uint8_t Format; // BLOCK_FORMAT_*
+    const char * Description;
+};
+
+/*
+ * Bit masks for the drivers, bit n selects entry n of SBM_CONTROLLER_REGISTERS or SBM_CONTROLLER_BLOCKS
+ */
+#define SBM_CONTROLLER_INDEX_ENUM(aFunctionCode, ...) CONTROLLER_INDEX_##aFunctionCode,
+enum {
+    SBM_CONTROLLER_REGISTERS(SBM_CONTROLLER_INDEX_ENUM)
+};
+enum {
+    SBM_CONTROLLER_BLOCKS(SBM_CONTROLLER_INDEX_ENUM)
+};
+#define CONTROLLER_HAS(aFunctionCode) (1 << CONTROLLER_INDEX_##aFunctionCode)
+
+#define BQ20Z45_REGISTERS (CONTROLLER_HAS(BQ20Z70_SafetyStatus) | CONTROLLER_HAS(BQ20Z70_PFStatus) \
+        | CONTROLLER_HAS(BQ20Z70_OperationStatus) | CONTROLLER_HAS(BQ20Z70_ChargingStatus) \
+        | CONTROLLER_HAS(BQ20Z70_PackVoltage) | CONTROLLER_HAS(BQ20Z70_AverageVoltage))
+#define BQ20Z70_REGISTERS (BQ20Z45_REGISTERS | CONTROLLER_HAS(BQ20Z70_SenseResistor))
+#define BQ20Z70_BLOCKS (CONTROLLER_HAS(BQ20Z70_AFEData) | CONTROLLER_HAS(BQ20Z70_ManufacturerInfo))
+#define BQ40Z50_BLOCKS (CONTROLLER_HAS(BQ40Z50_SafetyStatus) | CONTROLLER_HAS(BQ40Z50_PFStatus) \
+        | CONTROLLER_HAS(BQ40Z50_OperationStatus) | CONTROLLER_HAS(BQ40Z50_ChargingStatus) \
+        | CONTROLLER_HAS(BQ40Z50_GaugingStatus) | CONTROLLER_HAS(BQ40Z50_DAStatus1))
+
+/*
+ * ManufacturerAccess commands of a controller
+ */
+#define CONTROLLER_EDV_LEVEL            0x01 // 0x0003 is the end of discharge voltage
+#define CONTROLLER_HARDWARE_VERSION     0x02 // 0x0003 is the hardware version
+#define CONTROLLER_MANUFACTURER_STATUS  0x04 // 0x0006 is the manufacturer status
+#define CONTROLLER_DATA_FLASH           0x08 // data flash subclasses can be read with 0x77 and 0x78 to 0x7F
+#define CONTROLLER_BLOCK_ACCESS         0x10 // ManufacturerAccess records can be read with ManufacturerBlockAccess 0x44
+#define CONTROLLER_UNKNOWN_FEATURES     (CONTROLLER_HARDWARE_VERSION | CONTROLLER_MANUFACTURER_STATUS)
+
+/*
+ * Drivers for the TI controllers, selected by the device type read with ManufacturerAccess.
+ * Support for another controller is a new entry here.
+ * X(DeviceType, Name, Features, RegisterMask, BlockMask)
+ */
+#define SBM_CONTROLLER_DRIVERS(X) \
+    X(2083, "bq2085", CONTROLLER_EDV_LEVEL | CONTROLLER_MANUFACTURER_STATUS, 0, 0) \
+    X(2084, "bq2084", CONTROLLER_EDV_LEVEL | CONTROLLER_MANUFACTURER_STATUS, 0, 0) \
+    X(0x0700, "bq20z70, bq20z75, bq29330", CONTROLLER_HARDWARE_VERSION | CONTROLLER_MANUFACTURER_STATUS | CONTROLLER_DATA_FLASH, \
+            BQ20Z70_REGISTERS, BQ20Z70_BLOCKS) \
+    X(0x0451, "bq20z45-R1", CONTROLLER_HARDWARE_VERSION | CONTROLLER_MANUFACTURER_STATUS | CONTROLLER_DATA_FLASH, BQ20Z45_REGISTERS, \
+            BQ20Z70_BLOCKS) \
+    X(0x4500, "bq40z50", CONTROLLER_HARDWARE_VERSION | CONTROLLER_BLOCK_ACCESS, 0, BQ40Z50_BLOCKS)
+
+struct SBMControllerDriverStruct {
+    uint16_t DeviceType;
+    const char * Name;
+    uint8_t Features; // CONTROLLER_*
+    uint8_t RegisterMask;
+    uint8_t BlockMask;
+};
+
 #endif /* SRC_SBMINFO_H_ */
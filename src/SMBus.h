@@ -0,0 +1,183 @@
+/*
+ * SMBus.h
+ *
+ * SMBus protocol functions for one device, independent of the transport used.
+ * The transport is a template parameter, so there is no virtual call overhead.
+ *
+ * A transport is a class with the following static functions, which return one of the SMBUS_STATUS_* values
+ * and set the read word to 0xFFFF if the device does not respond.
+ *   bool init();
+ *   uint8_t quickCommand(uint8_t aAddress);
+ *   uint8_t sendByte(uint8_t aAddress, uint8_t aValue); // without PEC, e.g. to select the channel of an I2C multiplexer
+ *   uint8_t readWord(uint8_t aAddress, uint8_t aCommand, uint16_t * aValue, bool aUsePEC);
+ *   uint8_t writeWord(uint8_t aAddress, uint8_t aCommand, uint16_t aValue, bool aUsePEC);
+ *   uint8_t readBlock(uint8_t aAddress, uint8_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength,
+ *           uint8_t * aLengthOfData, bool aUsePEC);
+ *   uint8_t readManufacturerAccessWord(uint8_t aAddress, uint16_t aCommand, uint16_t * aValue, bool aUsePEC);
+ *   uint8_t readManufacturerAccessBlock(uint8_t aAddress, uint16_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength,
+ *           uint8_t * aLengthOfData, bool aUsePEC); // with ManufacturerBlockAccess of the bq40z50
+ *   bool startReadWord(uint8_t aAddress, uint8_t aCommand, bool aUsePEC); // returns false if busy
+ *   uint8_t getStartedReadWordResult(uint16_t * aValue); // returns SMBUS_STATUS_PENDING until finished
+ *
+ * Synchronous transports execute the read in startReadWord(), asynchronous ones in the background.
+ * Transports with a clock which can be changed at runtime also have
+ *   void setClock(uint32_t aClockHz);
+ * See ByteLevelTransport.h, AsyncTWI.h and LinuxI2CDevTransport.h.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_SMBUS_H_
+#define SRC_SMBUS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define SMBUS_WRITE 0
+#define SMBUS_READ  1
+
+// same values as the TWI_STATUS_* of AsyncTWI.h
+#define SMBUS_STATUS_PENDING    0
+#define SMBUS_STATUS_OK         1
+#define SMBUS_STATUS_NAK        2 // address or data not acknowledged
+#define SMBUS_STATUS_PEC_ERROR  3
+#define SMBUS_STATUS_BUS_ERROR  4
+
+#define SMBUS_MAX_TRIES 3 // only transfers with PEC errors are repeated
+
+template<class Transport>
+class SMBusDevice {
+public:
+    uint8_t Address;
+    bool PECEnabled;
+    bool LastReadIsValid; // false if device did not respond or all tries of last read had a PEC error
+    uint16_t PECErrorCount;
+
+    SMBusDevice(uint8_t aAddress = 0) :
+            Address(aAddress), PECEnabled(false), LastReadIsValid(true), PECErrorCount(0), mStartedCommand(0), mStartedTries(0) {
+    }
+
+    bool isAttached() {
+        return Transport::quickCommand(Address) == SMBUS_STATUS_OK;
+    }
+
+    uint16_t readWord(uint8_t aCommand) {
+        uint16_t tValue = 0xFFFF;
+        LastReadIsValid = false;
+        for (uint8_t i = 0; i < SMBUS_MAX_TRIES; ++i) {
+            uint8_t tStatus = Transport::readWord(Address, aCommand, &tValue, PECEnabled);
+            if (tStatus != SMBUS_STATUS_PEC_ERROR) {
+                LastReadIsValid = (tStatus == SMBUS_STATUS_OK);
+                break;
+            }
+            PECErrorCount++;
+        }
+        return tValue;
+    }
+
+    /*
+     * @return true if the word was acknowledged
+     */
+    bool writeWord(uint8_t aCommand, uint16_t aValue) {
+        for (uint8_t i = 0; i < SMBUS_MAX_TRIES; ++i) {
+            uint8_t tStatus = Transport::writeWord(Address, aCommand, aValue, PECEnabled);
+            if (tStatus != SMBUS_STATUS_PEC_ERROR) {
+                return (tStatus == SMBUS_STATUS_OK);
+            }
+            PECErrorCount++;
+        }
+        return false;
+    }
+
+    /*
+     * Write manufacturer command word and read manufacturer result word
+     */
+    uint16_t readWordFromManufacturerAccess(uint16_t aCommand) {
+        uint16_t tValue = 0xFFFF;
+        LastReadIsValid = false;
+        for (uint8_t i = 0; i < SMBUS_MAX_TRIES; ++i) {
+            uint8_t tStatus = Transport::readManufacturerAccessWord(Address, aCommand, &tValue, PECEnabled);
+            if (tStatus != SMBUS_STATUS_PEC_ERROR) {
+                LastReadIsValid = (tStatus == SMBUS_STATUS_OK);
+                break;
+            }
+            PECErrorCount++;
+        }
+        return tValue;
+    }
+
+    /*
+     * @return number of bytes stored in buffer
+     */
+    uint8_t readBlock(uint8_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength) {
+        uint8_t tLengthOfData = 0;
+        LastReadIsValid = false;
+        for (uint8_t i = 0; i < SMBUS_MAX_TRIES; ++i) {
+            uint8_t tStatus = Transport::readBlock(Address, aCommand, aDataBuffer, aDataBufferLength, &tLengthOfData, PECEnabled);
+            if (tStatus != SMBUS_STATUS_PEC_ERROR) {
+                LastReadIsValid = (tStatus == SMBUS_STATUS_OK);
+                break;
+            }
+            PECErrorCount++;
+        }
+        return tLengthOfData;
+    }
+
+    /*
+     * Write manufacturer command to ManufacturerBlockAccess and read the record, which starts with the command.
+     * A record which does not start with the command is invalid.
+     * @return number of bytes of the record without the command stored in buffer
+     */
+    uint8_t readBlockFromManufacturerBlockAccess(uint16_t aCommand, uint8_t * aDataBuffer, uint8_t aDataBufferLength) {
+        uint8_t tLengthOfData = 0;
+        LastReadIsValid = false;
+        for (uint8_t i = 0; i < SMBUS_MAX_TRIES; ++i) {
+            uint8_t tStatus = Transport::readManufacturerAccessBlock(Address, aCommand, aDataBuffer, aDataBufferLength,
+                    &tLengthOfData, PECEnabled);
+            if (tStatus != SMBUS_STATUS_PEC_ERROR) {
+                LastReadIsValid = (tStatus == SMBUS_STATUS_OK && tLengthOfData >= 2 && aDataBuffer[0] == (uint8_t) aCommand
+                        && aDataBuffer[1] == (uint8_t) (aCommand >> 8));
+                break;
+            }
+            PECErrorCount++;
+        }
+        if (!LastReadIsValid) {
+            return 0;
+        }
+        memmove(aDataBuffer, &aDataBuffer[2], tLengthOfData - 2);
+        return tLengthOfData - 2;
+    }
+
+    /*
+     * Read word without waiting for the result. Only one read can be started at a time.
+     */
+    bool startReadWord(uint8_t aCommand) {
+        mStartedCommand = aCommand;
+        mStartedTries = 1;
+        return Transport::startReadWord(Address, aCommand, PECEnabled);
+    }
+
+    /*
+     * Restarts the read if PEC does not match.
+     * @return SMBUS_STATUS_PENDING until the read started by startReadWord() is finished
+     */
+    uint8_t getStartedReadWordResult(uint16_t * aValue) {
+        uint8_t tStatus = Transport::getStartedReadWordResult(aValue);
+        if (tStatus == SMBUS_STATUS_PEC_ERROR) {
+            PECErrorCount++;
+            if (mStartedTries < SMBUS_MAX_TRIES) {
+                mStartedTries++;
+                Transport::startReadWord(Address, mStartedCommand, PECEnabled);
+                return SMBUS_STATUS_PENDING;
+            }
+        }
+        return tStatus;
+    }
+
+private:
+    uint8_t mStartedCommand;
+    uint8_t mStartedTries;
+};
+
+#endif /* SRC_SMBUS_H_ */
@@ -0,0 +1,125 @@
+/*
+ * ShadowLCD.h
+ *
+ * Shadow framebuffer for the 20x4 LiquidCrystal display.
+ * The formatters print into the shadow buffer and only the cells which differ from the display content are marked dirty.
+ * render() sends at most the given number of dirty cells to the display, so a loop is never blocked
+ * by a complete rewrite of a line. Adjacent dirty cells of a row are sent with only one cursor command,
+ * since the display increments its cursor after each written character.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_SHADOWLCD_H_
+#define SRC_SHADOWLCD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "LiquidCrystal.h"
+
+#define LCD_COLUMNS 20
+#define LCD_ROWS 4
+#define LCD_NUMBER_OF_CELLS (LCD_COLUMNS * LCD_ROWS)
+#define LCD_CURSOR_UNKNOWN 0xFF
+
+class ShadowLCD: public Print {
+public:
+    ShadowLCD(LiquidCrystal & aLCD) :
+            mLCD(aLCD) {
+    }
+
+    /*
+     * Clears the display and the shadow buffer
+     */
+    void begin() {
+        mLCD.begin(LCD_COLUMNS, LCD_ROWS);
+        memset(mContent, ' ', sizeof(mContent));
+        memset(mDirtyBits, 0, sizeof(mDirtyBits));
+        mNumberOfDirtyCells = 0;
+        mCursorIndex = 0;
+        mLCDCursorIndex = 0;
+        mRenderIndex = 0;
+    }
+
+    void setCursor(uint8_t aColumn, uint8_t aRow) {
+        mCursorIndex = (aColumn < LCD_COLUMNS && aRow < LCD_ROWS) ? aRow * LCD_COLUMNS + aColumn : LCD_NUMBER_OF_CELLS;
+    }
+
+    /*
+     * Characters beyond the end of the row are discarded
+     */
+    size_t write(uint8_t aCharacter) {
+        if (mCursorIndex < LCD_NUMBER_OF_CELLS) {
+            if (mContent[mCursorIndex] != (char) aCharacter) {
+                mContent[mCursorIndex] = aCharacter;
+                if (!isDirty(mCursorIndex)) {
+                    mDirtyBits[mCursorIndex / 8] |= 1 << (mCursorIndex % 8);
+                    mNumberOfDirtyCells++;
+                }
+            }
+            mCursorIndex++;
+            if (mCursorIndex % LCD_COLUMNS == 0) {
+                mCursorIndex = LCD_NUMBER_OF_CELLS;
+            }
+        }
+        return 1;
+    }
+    using Print::write;
+
+    /*
+     * Overwrites the rest of a field with spaces, to remove the trailing characters of a longer old value
+     * @param aEndColumn - the first column after the field
+     */
+    void clearToColumn(uint8_t aEndColumn) {
+        while (mCursorIndex < LCD_NUMBER_OF_CELLS && mCursorIndex % LCD_COLUMNS < aEndColumn) {
+            write(' ');
+        }
+    }
+
+    /*
+     * Sends dirty cells to the display, starting after the last cell sent by the previous call
+     * @return number of cells sent
+     */
+    uint8_t render(uint8_t aMaxCells) {
+        uint8_t tCells = 0;
+        for (uint8_t i = 0; i < LCD_NUMBER_OF_CELLS && tCells < aMaxCells && mNumberOfDirtyCells > 0; ++i) {
+            uint8_t tIndex = mRenderIndex;
+            if (isDirty(tIndex)) {
+                if (mLCDCursorIndex != tIndex) {
+                    mLCD.setCursor(tIndex % LCD_COLUMNS, tIndex / LCD_COLUMNS);
+                }
+                mLCD.write(mContent[tIndex]);
+                mDirtyBits[tIndex / 8] &= ~(1 << (tIndex % 8));
+                mNumberOfDirtyCells--;
+                tCells++;
+                // the next row does not follow the last column in the display RAM
+                mLCDCursorIndex = ((tIndex + 1) % LCD_COLUMNS == 0) ? LCD_CURSOR_UNKNOWN : tIndex + 1;
+            }
+            mRenderIndex = (tIndex + 1) % LCD_NUMBER_OF_CELLS;
+        }
+        return tCells;
+    }
+
+    /*
+     * Blocks until the display shows the content of the shadow buffer, for messages of setup()
+     */
+    void renderAll() {
+        render(LCD_NUMBER_OF_CELLS);
+    }
+
+private:
+    bool isDirty(uint8_t aIndex) {
+        return mDirtyBits[aIndex / 8] & (1 << (aIndex % 8));
+    }
+
+    LiquidCrystal & mLCD;
+    char mContent[LCD_NUMBER_OF_CELLS]; // the content the display will show after all dirty cells are sent
+    uint8_t mDirtyBits[(LCD_NUMBER_OF_CELLS + 7) / 8];
+    uint8_t mNumberOfDirtyCells;
+    uint8_t mCursorIndex; // LCD_NUMBER_OF_CELLS if outside of the display
+    uint8_t mLCDCursorIndex; // the cursor of the display or LCD_CURSOR_UNKNOWN
+    uint8_t mRenderIndex;
+};
+
+#endif /* SRC_SHADOWLCD_H_ */
@@ -0,0 +1,45 @@
+/*
+ * SoftI2CTransport.h
+ *
+ * SMBus transport using the SoftI2CMaster library. See SMBus.h.
+ * SoftI2CMaster.h must be included before, after its configuration macros.
+ *
+ *  Copyright (C) 2016  Armin Joachimsmeyer
+ *  armin.joachimsmeyer@gmail.com
+ */
+
+#ifndef SRC_SOFTI2CTRANSPORT_H_
+#define SRC_SOFTI2CTRANSPORT_H_
+
+#include "ByteLevelTransport.h"
+
+/*
+ * With I2C_NOINTERRUPT, i2c_start() disables and i2c_stop() enables interrupts.
+ */
+class SoftI2CBus {
+public:
+    static bool start(uint8_t aAddressAndDirection) {
+        return i2c_start(aAddressAndDirection);
+    }
+    static bool repeatedStart(uint8_t aAddressAndDirection) {
+        return i2c_rep_start(aAddressAndDirection);
+    }
+    static bool write(uint8_t aValue) {
+        return i2c_write(aValue);
+    }
+    static uint8_t read(bool aLast) {
+        return i2c_read(aLast);
+    }
+    static void stop() {
+        i2c_stop();
+    }
+};
+
+class SoftI2CTransport: public ByteLevelTransport<SoftI2CBus> {
+public:
+    static bool init() {
+        return i2c_init();
+    }
+};
+
+#endif /* SRC_SOFTI2CTRANSPORT_H_ */